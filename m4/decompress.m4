@@ -0,0 +1,63 @@
+# decompress.m4 - check for run-time decompression library support
+
+# Copyright (C) 2026 Free Software Foundation, Inc.
+# This file is free software; the Free Software Foundation
+# gives unlimited permission to copy and/or distribute it,
+# with or without modifications, as long as this notice is preserved.
+
+# grep --decompress loads zlib, libbz2, liblzma and libzstd with
+# dlopen only when an input file needs them, so only their headers
+# are needed at build time.  LIB_DLOPEN is the library (if any)
+# needed for dlopen.  LIB_PTHREAD is the library (if any) needed for
+# the threads that decode independent compressed frames in parallel.
+
+AC_DEFUN([gl_DECOMPRESS],
+[
+  AC_ARG_ENABLE([decompress],
+    AS_HELP_STRING([--disable-decompress],
+                   [disable transparent decompression (--decompress)]),
+    [case $enableval in
+       yes|no) test_decompress=$enableval;;
+       *) AC_MSG_ERROR([invalid value $enableval for --disable-decompress]);;
+     esac],
+    [test_decompress=maybe])
+
+  AC_SUBST([LIB_DLOPEN])
+  AC_SUBST([LIB_PTHREAD])
+  LIB_DLOPEN=
+  LIB_PTHREAD=
+  use_decompress=no
+
+  if test $test_decompress != no; then
+    AC_CHECK_HEADERS_ONCE([dlfcn.h])
+    decompress_saved_LIBS=$LIBS
+    AC_SEARCH_LIBS([dlopen], [dl],
+      [test "$ac_cv_search_dlopen" = "none required" \
+         || LIB_DLOPEN=$ac_cv_search_dlopen])
+    LIBS=$decompress_saved_LIBS
+
+    if test "$ac_cv_header_dlfcn_h" = yes \
+       && test "$ac_cv_search_dlopen" != no; then
+      use_decompress=yes
+      AC_CHECK_HEADERS([zlib.h bzlib.h lzma.h zstd.h])
+      AC_CHECK_HEADERS([pthread.h])
+      if test "$ac_cv_header_pthread_h" = yes; then
+        AC_SEARCH_LIBS([pthread_create], [pthread],
+          [test "$ac_cv_search_pthread_create" = "none required" \
+             || LIB_PTHREAD=$ac_cv_search_pthread_create
+           AC_DEFINE([HAVE_DECOMPRESS_THREADS], [1],
+             [Define to 1 if grep --decompress can decode in parallel.])])
+        LIBS=$decompress_saved_LIBS
+      fi
+    elif test $test_decompress = yes; then
+      AC_MSG_ERROR([dlopen is needed for --enable-decompress])
+    else
+      AC_MSG_WARN([AC_PACKAGE_NAME will be built without --decompress.])
+    fi
+  fi
+
+  if test $use_decompress = yes; then
+    AC_DEFINE([HAVE_DECOMPRESS], [1],
+      [Define to 1 if grep --decompress can load decompression libraries.])
+  fi
+])
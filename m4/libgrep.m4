@@ -0,0 +1,33 @@
+# libgrep.m4 - check whether libgrep.a can be built
+
+# Copyright (C) 2026 Free Software Foundation, Inc.
+# This file is free software; the Free Software Foundation
+# gives unlimited permission to copy and/or distribute it,
+# with or without modifications, as long as this notice is preserved.
+
+# libgrep.a, grep's matchers as a library, serializes compilation with
+# a POSIX mutex and needs thread-local storage.  LIB_LIBGREP is the
+# library (if any) that programs linking with libgrep.a need for the
+# mutex.
+
+AC_DEFUN([gl_LIBGREP],
+[
+  AC_SUBST([LIB_LIBGREP])
+  LIB_LIBGREP=
+  build_libgrep=no
+
+  AC_CACHE_CHECK([for _Thread_local], [gl_cv_thread_local],
+    [AC_COMPILE_IFELSE(
+       [AC_LANG_PROGRAM([[static _Thread_local int x;]], [[return x;]])],
+       [gl_cv_thread_local=yes], [gl_cv_thread_local=no])])
+  AC_CHECK_HEADERS([pthread.h])
+  if test "$gl_cv_thread_local" = yes \
+     && test "$ac_cv_header_pthread_h" = yes; then
+    libgrep_saved_LIBS=$LIBS
+    AC_SEARCH_LIBS([pthread_mutex_lock], [pthread],
+      [build_libgrep=yes
+       test "$ac_cv_search_pthread_mutex_lock" = "none required" \
+         || LIB_LIBGREP=$ac_cv_search_pthread_mutex_lock])
+    LIBS=$libgrep_saved_LIBS
+  fi
+])
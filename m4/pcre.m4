@@ -15,6 +15,14 @@ AC_DEFUN([gl_FUNC_PCRE],
        *) AC_MSG_ERROR([invalid value $enableval for --disable-perl-regexp]);;
      esac],
     [test_pcre=maybe])
+  AC_ARG_ENABLE([pcre-dlopen],
+    AS_HELP_STRING([--disable-pcre-dlopen],
+                   [link with PCRE instead of loading it when -P is used]),
+    [case $enableval in
+       yes|no) test_pcre_dlopen=$enableval;;
+       *) AC_MSG_ERROR([invalid value $enableval for --disable-pcre-dlopen]);;
+     esac],
+    [test_pcre_dlopen=maybe])
 
   AC_SUBST([PCRE_CFLAGS])
   AC_SUBST([PCRE_LIBS])
@@ -69,6 +77,26 @@ AC_DEFUN([gl_FUNC_PCRE],
     AC_DEFINE([HAVE_LIBPCRE], [1],
       [Define to 1 if you have the Perl Compatible Regular Expressions
        library.])
+
+    # Load PCRE with dlopen when -P is used, if possible, so that other
+    # searches do not pay to link it.  PCRE_LIBS then names the library
+    # (if any) needed for dlopen.
+    if test $test_pcre_dlopen != no; then
+      AC_CHECK_HEADERS_ONCE([dlfcn.h])
+      pcre_saved_LIBS=$LIBS
+      AC_SEARCH_LIBS([dlopen], [dl])
+      LIBS=$pcre_saved_LIBS
+      if test "$ac_cv_header_dlfcn_h" = yes \
+         && test "$ac_cv_search_dlopen" != no; then
+        AC_DEFINE([PCRE_DLOPEN], [1],
+          [Define to 1 if grep loads the PCRE library when -P is used.])
+        PCRE_LIBS=
+        test "$ac_cv_search_dlopen" = "none required" \
+          || PCRE_LIBS=$ac_cv_search_dlopen
+      elif test $test_pcre_dlopen = yes; then
+        AC_MSG_ERROR([dlopen is needed for --enable-pcre-dlopen])
+      fi
+    fi
   else
     PCRE_CFLAGS=
     PCRE_LIBS=
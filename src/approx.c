@@ -0,0 +1,742 @@
+/* approx.c - approximate matching of fixed strings for grep.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* For --max-errors=K, a line matches a -F pattern if some part of it
+   can be made equal to the pattern by inserting, deleting and
+   replacing at most K characters in all.  The edit distance is found
+   with the bit-vector algorithm of G. Myers, "A fast bit-vector
+   algorithm for approximate string matching based on dynamic
+   programming", J. ACM 46 (1999), 395-415, which advances a column of
+   the dynamic programming matrix for each character of text with a
+   few word operations, in the blocked form of H. Hyyrö for patterns
+   longer than a word.
+
+   Most lines are never looked at.  An error breaks at most one piece
+   of a pattern, so of any K + 1 pieces that do not overlap, at least
+   one is intact in any match with at most K errors.  The pieces of
+   all the patterns are searched for with a kwset, and only the lines
+   that contain one are checked, except against the patterns with too
+   few characters for such pieces, which are checked on every line.  */
+
+#include <config.h>
+
+#include <search.h>
+
+#include <ctype.h>
+#include <uchar.h>
+
+/* A character of a pattern or of the text: a byte in a single-byte
+   locale; in UTF-8, a character, or ENCODING_ERROR plus the byte for
+   each byte of an encoding error, so that such bytes match only
+   themselves.  */
+enum { ENCODING_ERROR = 0x110000 };
+
+/* The fewest characters in each piece that is searched for, as
+   shorter pieces would be on too many lines to save any work.  */
+enum { PIECE_MIN = 2 };
+
+/* A pattern and, for each character, the positions in the pattern
+   that match it, as a bit vector of NWORDS words.  */
+struct apat
+{
+  /* The length of the pattern in characters, the words in a bit
+     vector, and the bit for the last position in the last word.  */
+  idx_t len;
+  idx_t nwords;
+  uint64_t high;
+
+  /* In UTF-8, the NWIDE non-ASCII characters that match a position,
+     in increasing order.  */
+  idx_t nwide;
+  char32_t *wide;
+
+  /* The vectors for each byte, in UTF-8 for each ASCII byte; then one
+     of zeros, for the characters that match no position; then one for
+     each of WIDE.  EQ is for the pattern and REQ for it reversed.  */
+  uint64_t *eq;
+  uint64_t *req;
+};
+
+/* A compiled --max-errors pattern list.  */
+struct approx
+{
+  /* The options the pattern list was compiled with.  */
+  struct matchopts opts;
+  bool utf8;
+
+  /* The patterns, and the user's patterns they were compiled from.  */
+  char *pattern;
+  struct apat *pats;
+  idx_t npats;
+
+  /* The pieces of the patterns, or null if none of the patterns
+     could be split into pieces long enough, and the shortest piece.  */
+  kwset_t kwset;
+  idx_t piece_min;
+
+  /* The NLOOSE patterns that could not be split, to be checked on
+     every line.  */
+  idx_t *loose;
+  idx_t nloose;
+
+  /* For each word I of the kwset, the patterns from HIT_PATS[HIT_BEG[I]]
+     up to HIT_PATS[HIT_BEG[I + 1]] have that piece.  */
+  idx_t *hit_beg;
+  idx_t *hit_pats;
+
+  /* The lines in which a piece was found, counted, and for each
+     pattern, the count when it was last checked.  */
+  intmax_t line_count;
+  intmax_t *checked;
+
+  /* Room for a column of the matrix, as long as the longest pattern.  */
+  uint64_t *pv;
+  uint64_t *mv;
+};
+
+/* Return the length of the character at P, before LIM, and set *C to
+   it.  */
+static int
+next_char (struct approx const *ap, char const *p, char const *lim,
+           char32_t *c)
+{
+  unsigned char b = *p;
+  if (!ap->utf8 || b < 0x80)
+    {
+      *c = b;
+      return 1;
+    }
+  mbstate_t mbs; mbszero (&mbs);
+  size_t n = mbrtoc32 (c, p, lim - p, &mbs);
+  if (n <= MB_LEN_MAX)
+    return n;
+  *c = ENCODING_ERROR + b;
+  return 1;
+}
+
+/* Return the start of the character that ends at P, after BEG, and
+   set *C to it.  */
+static char const *
+prev_char (struct approx const *ap, char const *beg, char const *p,
+           char32_t *c)
+{
+  char const *q = p - 1;
+  if (ap->utf8 && (*q & 0xC0) == 0x80)
+    {
+      char const *lead = q;
+      while (beg < lead && p - lead < 4 && (*lead & 0xC0) == 0x80)
+        lead--;
+      if (next_char (ap, lead, p, c) == p - lead)
+        return lead;
+    }
+  next_char (ap, q, p, c);
+  return q;
+}
+
+/* The row for the vectors for C in PAT's tables.  */
+enum { NO_ROW = UCHAR_MAX + 1 };
+static idx_t
+char_row (struct apat const *pat, char32_t c)
+{
+  if (c <= UCHAR_MAX && (c < 0x80 || !pat->wide))
+    return c;
+  idx_t lo = 0, hi = pat->nwide;
+  while (lo < hi)
+    {
+      idx_t mid = lo + (hi - lo) / 2;
+      if (pat->wide[mid] < c)
+        lo = mid + 1;
+      else if (c < pat->wide[mid])
+        hi = mid;
+      else
+        return NO_ROW + 1 + mid;
+    }
+  return NO_ROW;
+}
+
+/* Return the vector for C in PAT, forward or, if REV, reversed.  */
+static uint64_t const *
+eq_vector (struct apat const *pat, char32_t c, bool rev)
+{
+  return (rev ? pat->req : pat->eq) + char_row (pat, c) * pat->nwords;
+}
+
+static int
+char32_cmp (void const *a, void const *b)
+{
+  char32_t x = *(char32_t const *) a, y = *(char32_t const *) b;
+  return (y < x) - (x < y);
+}
+
+/* Return the number of characters in the counterparts of C under -i,
+   C included, storing them into FOLDED.  */
+static int
+fold (struct approx const *ap, char32_t c,
+      char32_t folded[CASE_FOLDED_BUFSIZE + 1])
+{
+  folded[0] = c;
+  if (!ap->opts.icase || ENCODING_ERROR <= c)
+    return 1;
+  if (!ap->utf8)
+    {
+      int n = 1;
+      for (int b = 0; b <= UCHAR_MAX; b++)
+        if (b != c && toupper (b) == toupper (c) && n <= CASE_FOLDED_BUFSIZE)
+          folded[n++] = b;
+      return n;
+    }
+  return 1 + case_folded_counterparts (c, folded + 1);
+}
+
+/* A piece of a pattern: its LEN bytes at STR, in the pattern PAT.  */
+struct piece
+{
+  char const *str;
+  idx_t len;
+  idx_t pat;
+};
+
+/* Compile into PAT the pattern P of SIZE bytes, and return whether
+   pieces of it can be searched for in AP's kwset.  If so, append them
+   to the *NPIECES pieces in *PIECES, of which *PIECES_ALLOC are
+   allocated.  */
+static bool
+compile_pattern (struct approx *ap, struct apat *pat, char const *p,
+                 idx_t size, struct piece **pieces, idx_t *npieces,
+                 idx_t *pieces_alloc)
+{
+  char const *lim = p + size;
+  char32_t *chars = xinmalloc (size + 1, sizeof *chars);
+  idx_t *offs = xinmalloc (size + 1, sizeof *offs);
+  idx_t len = 0;
+  for (idx_t i = 0; i < size; len++)
+    {
+      offs[len] = i;
+      i += next_char (ap, p + i, lim, &chars[len]);
+    }
+  offs[len] = size;
+
+  /* Under -i in UTF-8, the kwset finds only ASCII counterparts, so
+     it cannot find the characters with others, such as 'k', which has
+     the Kelvin sign.  */
+  char32_t folded[CASE_FOLDED_BUFSIZE + 1];
+  bool *findable = xinmalloc (len + 1, sizeof *findable);
+  for (idx_t i = 0; i < len; i++)
+    findable[i] = true;
+  idx_t nwide = 0;
+  char32_t *wide = nullptr;
+  if (ap->utf8)
+    {
+      wide = xinmalloc (len * (CASE_FOLDED_BUFSIZE + 1) + 1, sizeof *wide);
+      for (idx_t i = 0; i < len; i++)
+        {
+          int n = fold (ap, chars[i], folded);
+          for (int j = 0; j < n; j++)
+            if (0x80 <= folded[j])
+              {
+                wide[nwide++] = folded[j];
+                findable[i] &= n == 1;
+              }
+        }
+      qsort (wide, nwide, sizeof *wide, char32_cmp);
+      idx_t n = 0;
+      for (idx_t i = 0; i < nwide; i++)
+        if (n == 0 || wide[n - 1] != wide[i])
+          wide[n++] = wide[i];
+      nwide = n;
+    }
+
+  idx_t nwords = MAX (1, (len + 63) / 64);
+  idx_t rows = NO_ROW + 1 + nwide;
+  pat->len = len;
+  pat->nwords = nwords;
+  pat->high = (uint64_t) 1 << (len + 63) % 64;
+  pat->nwide = nwide;
+  pat->wide = wide;
+  pat->eq = xicalloc (rows * nwords, sizeof *pat->eq);
+  pat->req = xicalloc (rows * nwords, sizeof *pat->req);
+  for (idx_t i = 0; i < len; i++)
+    for (int n = fold (ap, chars[i], folded); 0 <= --n; )
+      {
+        idx_t row = char_row (pat, folded[n]) * nwords;
+        idx_t r = len - 1 - i;
+        pat->eq[row + i / 64] |= (uint64_t) 1 << i % 64;
+        pat->req[row + r / 64] |= (uint64_t) 1 << r % 64;
+      }
+
+  /* Cut MAX_ERRORS + 1 pieces, as long as can be, out of the runs of
+     characters that the kwset can find, in the simplest case by
+     splitting the whole pattern into pieces of about equal length.  */
+  idx_t n = MIN (ap->opts.max_errors, len) + 1;
+  idx_t piece_len = 0;
+  for (idx_t l = len / n; PIECE_MIN <= l && !piece_len; l--)
+    {
+      idx_t count = 0;
+      for (idx_t i = 0, j; i < len; i = j + 1)
+        {
+          for (j = i; j < len && findable[j]; j++)
+            continue;
+          count += (j - i) / l;
+        }
+      if (n <= count)
+        piece_len = l;
+    }
+  if (piece_len)
+    for (idx_t i = 0, j, cut = 0; cut < n; i = j + 1)
+      {
+        for (j = i; j < len && findable[j]; j++)
+          continue;
+        idx_t m = MIN ((j - i) / piece_len, n - cut);
+        for (idx_t k = 0; k < m; k++, cut++)
+          {
+            idx_t b = offs[i + k * (j - i) / m];
+            idx_t e = offs[i + (k + 1) * (j - i) / m];
+            if (*npieces == *pieces_alloc)
+              *pieces = xpalloc (*pieces, pieces_alloc, 1, -1,
+                                 sizeof **pieces);
+            (*pieces)[(*npieces)++]
+              = (struct piece) { .str = p + b, .len = e - b,
+                                 .pat = pat - ap->pats };
+          }
+      }
+  if (piece_len)
+    ap->piece_min = MIN (ap->piece_min, piece_len);
+
+  free (findable);
+  free (offs);
+  free (chars);
+  return !!piece_len;
+}
+
+/* Compile the -F style PATTERN, containing SIZE bytes that are
+   followed by '\n', to match with at most OPTS->max_errors errors
+   and the other options OPTS.  Return a description of the compiled
+   pattern, which takes over PATTERN.  */
+
+void *
+Acompile (char *pattern, idx_t size, reg_syntax_t ignored, bool exact,
+          struct matchopts const *opts)
+{
+  struct approx *ap = xmalloc (sizeof *ap);
+  ap->opts = *opts;
+  ap->utf8 = localeinfo.using_utf8;
+  ap->pattern = pattern;
+  ap->pats = nullptr;
+  ap->npats = 0;
+  ap->kwset = kwsinit (true, opts->icase);
+  ap->piece_min = IDX_MAX;
+  ap->hit_beg = ap->hit_pats = nullptr;
+  ap->loose = nullptr;
+  ap->nloose = 0;
+  ap->line_count = 0;
+
+  idx_t pats_alloc = 0, loose_alloc = 0;
+  idx_t len_max = 0;
+  struct piece *pieces = nullptr;
+  idx_t npieces = 0, pieces_alloc = 0;
+  char const *p = pattern;
+  do
+    {
+      char const *sep = rawmemchr (p, '\n');
+      if (ap->npats == pats_alloc)
+        ap->pats = xpalloc (ap->pats, &pats_alloc, 1, -1, sizeof *ap->pats);
+      struct apat *pat = &ap->pats[ap->npats++];
+      if (!compile_pattern (ap, pat, p, sep - p,
+                            &pieces, &npieces, &pieces_alloc))
+        {
+          if (ap->nloose == loose_alloc)
+            ap->loose = xpalloc (ap->loose, &loose_alloc, 1, -1,
+                                 sizeof *ap->loose);
+          ap->loose[ap->nloose++] = ap->npats - 1;
+        }
+      len_max = MAX (len_max, pat->len);
+      p = sep + 1;
+    }
+  while (p <= pattern + size);
+
+  if (npieces)
+    {
+      for (idx_t i = 0; i < npieces; i++)
+        kwsincr (ap->kwset, pieces[i].str, pieces[i].len);
+      kwsprep (ap->kwset);
+
+      /* A piece added to the kwset again keeps the index of the
+         first, which is what a search for the piece itself finds.
+         List the patterns by the index of their pieces.  */
+      idx_t *word = xinmalloc (npieces, sizeof *word);
+      ap->hit_beg = xicalloc (npieces + 1, sizeof *ap->hit_beg);
+      ap->hit_pats = xinmalloc (npieces, sizeof *ap->hit_pats);
+      for (idx_t i = 0; i < npieces; i++)
+        {
+          struct kwsmatch kwsmatch;
+          kwsexec (ap->kwset, pieces[i].str, pieces[i].len, &kwsmatch, true);
+          word[i] = kwsmatch.index;
+          ap->hit_beg[word[i] + 1]++;
+        }
+      for (idx_t i = 0; i < npieces; i++)
+        ap->hit_beg[i + 1] += ap->hit_beg[i];
+      for (idx_t i = 0; i < npieces; i++)
+        ap->hit_pats[ap->hit_beg[word[i]]++] = pieces[i].pat;
+      for (idx_t i = npieces; 0 < i; i--)
+        ap->hit_beg[i] = ap->hit_beg[i - 1];
+      ap->hit_beg[0] = 0;
+      free (word);
+    }
+  else
+    {
+      kwsfree (ap->kwset);
+      ap->kwset = nullptr;
+    }
+  free (pieces);
+  ap->checked = xicalloc (ap->npats, sizeof *ap->checked);
+
+  idx_t nwords = MAX (1, (len_max + 63) / 64);
+  ap->pv = xinmalloc (nwords, sizeof *ap->pv);
+  ap->mv = xinmalloc (nwords, sizeof *ap->mv);
+  return ap;
+}
+
+/* Start a column of the matrix for PAT, in AP.  */
+static void
+column_init (struct approx *ap, struct apat const *pat)
+{
+  for (idx_t i = 0; i < pat->nwords; i++)
+    {
+      ap->pv[i] = -1;
+      ap->mv[i] = 0;
+    }
+}
+
+/* Advance AP's column for PAT past a character whose vector is EQ.
+   The top cell of the column goes up by HIN, which is 0 when a match
+   may start anywhere and 1 when it must start where the column did.
+   Return how much the bottom cell, the distance, goes up by.  */
+static int
+column_advance (struct approx *ap, struct apat const *pat,
+                uint64_t const *eq, int hin)
+{
+  if (!pat->len)
+    return hin;
+  uint64_t *pv = ap->pv, *mv = ap->mv;
+  for (idx_t i = 0; i < pat->nwords; i++)
+    {
+      uint64_t p = pv[i], m = mv[i], e = eq[i];
+      uint64_t xv = e | m;
+      uint64_t top = i < pat->nwords - 1 ? (uint64_t) 1 << 63 : pat->high;
+      e |= hin < 0;
+      uint64_t xh = (((e & p) + p) ^ p) | e;
+      uint64_t ph = m | ~(xh | p);
+      uint64_t mh = p & xh;
+      int hout = !!(ph & top) - !!(mh & top);
+      ph = ph << 1 | (0 < hin);
+      mh = mh << 1 | (hin < 0);
+      pv[i] = mh | ~(xv | ph);
+      mv[i] = ph & xv;
+      hin = hout;
+    }
+  return hin;
+}
+
+/* Return true if the line from BEG to END matches PAT, in AP.  */
+static bool
+line_matches (struct approx *ap, struct apat const *pat,
+              char const *beg, char const *end)
+{
+  idx_t k = ap->opts.max_errors;
+  bool lines = ap->opts.lines;
+  idx_t dist = pat->len;
+  if (!lines && dist <= k)
+    return true;
+  column_init (ap, pat);
+  idx_t chars = 0;
+  for (char const *p = beg; p < end; chars++)
+    {
+      /* With -x, a line with more than LEN + K characters is too long.  */
+      if (lines && k <= chars - pat->len)
+        return false;
+      char32_t c;
+      p += next_char (ap, p, end, &c);
+      dist += column_advance (ap, pat, eq_vector (pat, c, false), lines);
+      if (!lines && dist <= k)
+        return true;
+    }
+  return dist <= k;
+}
+
+/* Return the offset from BEG of the match of PAT in the text from BEG
+   to END, which is a line or the end of one, and store its size into
+   *LEN; or return -1 if there is none.  Of the matches, find the one
+   that ends first, extended while that reduces its distance, and of
+   its starts, the one with the least distance and then the longest
+   match.  With -x, the match must be the line, which starts at
+   LINE_BEG.  */
+static ptrdiff_t
+locate (struct approx *ap, struct apat const *pat, char const *line_beg,
+        char const *beg, char const *end, idx_t *len)
+{
+  idx_t k = ap->opts.max_errors;
+  if (ap->opts.lines)
+    {
+      if (beg != line_beg || !line_matches (ap, pat, beg, end))
+        return -1;
+      *len = end - beg;
+      return 0;
+    }
+
+  /* Find the first end of a match, then extend it.  */
+  idx_t dist = pat->len;
+  char const *p = beg;
+  char32_t c;
+  column_init (ap, pat);
+  while (k < dist)
+    {
+      if (p == end)
+        return -1;
+      p += next_char (ap, p, end, &c);
+      dist += column_advance (ap, pat, eq_vector (pat, c, false), 0);
+    }
+  char const *match_end = p;
+  while (p < end)
+    {
+      p += next_char (ap, p, end, &c);
+      idx_t d = dist + column_advance (ap, pat, eq_vector (pat, c, false), 0);
+      if (dist <= d)
+        break;
+      dist = d;
+      match_end = p;
+    }
+
+  /* Match the reversed pattern back from the end, to find the start.
+     A match has at most LEN + K characters.  */
+  char const *match_beg = match_end;
+  idx_t best = pat->len;
+  dist = pat->len;
+  p = match_end;
+  column_init (ap, pat);
+  for (idx_t chars = 0; beg < p && chars - pat->len < k; chars++)
+    {
+      p = prev_char (ap, beg, p, &c);
+      dist += column_advance (ap, pat, eq_vector (pat, c, true), 1);
+      if (dist <= best)
+        {
+          best = dist;
+          match_beg = p;
+        }
+    }
+  *len = match_end - match_beg;
+  return match_beg - beg;
+}
+
+/* Return the start of the first line at or after BEG, before LIM,
+   that matches a pattern of AP with pieces, and set *NEXT to the
+   start of the line after it; or return null if there is none.  */
+static char const *
+next_piece_line (struct approx *ap, char const *beg, char const *lim,
+                 char const **next)
+{
+  /* Check the line of each piece found against the patterns with
+     that piece, each pattern once per line.  The pieces found at the
+     same place are the longest one and its prefixes.  */
+  char eol = ap->opts.eol;
+  char const *line = beg, *end = beg;
+  while (beg < lim)
+    {
+      struct kwsmatch kwsmatch;
+      xtime_t start_time = stats_clock ();
+      ptrdiff_t offset = kwsexec (ap->kwset, beg, lim - beg, &kwsmatch,
+                                  true);
+      stats_charge (PHASE_KWSET, start_time);
+      if (offset < 0)
+        break;
+      stats.kwset_candidates++;
+      char const *hit = beg + offset;
+      if (end <= hit)
+        {
+          line = memrchr (end, eol, hit - end);
+          line = line ? line + 1 : end;
+          end = memchr (hit, eol, lim - hit);
+          if (!end)
+            end = lim;
+          ap->line_count++;
+
+          /* next_line counts the lines if it checks them all.  */
+          stats.approx_checks += !ap->nloose;
+        }
+      do
+        for (idx_t i = ap->hit_beg[kwsmatch.index];
+             i < ap->hit_beg[kwsmatch.index + 1]; i++)
+          {
+            idx_t p = ap->hit_pats[i];
+            if (ap->checked[p] == ap->line_count)
+              continue;
+            ap->checked[p] = ap->line_count;
+            if (line_matches (ap, &ap->pats[p], line, end))
+              {
+                stats.kwset_matches++;
+                *next = end < lim ? end + 1 : lim;
+                return line;
+              }
+          }
+      while (kwsexec (ap->kwset, hit, kwsmatch.size - 1, &kwsmatch, true)
+             == 0);
+      beg = hit + 1;
+    }
+  return nullptr;
+}
+
+/* Return the start of the first line at or after BEG, before LIM,
+   that matches AP, and set *NEXT to the start of the line after it;
+   or return null if there is none.  */
+static char const *
+next_line (struct approx *ap, char const *beg, char const *lim,
+           char const **next)
+{
+  if (!ap->nloose)
+    return next_piece_line (ap, beg, lim, next);
+
+  /* Check each line against the patterns without pieces, and search
+     it for the pieces of the others.  */
+  char eol = ap->opts.eol;
+  while (beg < lim)
+    {
+      char const *line = beg;
+      char const *end = memchr (line, eol, lim - line);
+      beg = end ? end + 1 : lim;
+      if (!end)
+        end = lim;
+      stats.approx_checks++;
+      for (idx_t i = 0; i < ap->nloose; i++)
+        if (line_matches (ap, &ap->pats[ap->loose[i]], line, end))
+          {
+            *next = beg;
+            return line;
+          }
+      char const *ignored;
+      if (ap->kwset && next_piece_line (ap, line, end, &ignored))
+        {
+          *next = beg;
+          return line;
+        }
+    }
+  return nullptr;
+}
+
+/* Use the compiled pattern VCP to search the buffer BUF of size SIZE.
+   If found, return the offset of the first match and store its
+   size into *MATCH_SIZE.  If not found, return -1.
+   If START_PTR is nonnull, start searching there.  */
+ptrdiff_t
+Aexecute (void *vcp, char const *buf, idx_t size, idx_t *match_size,
+          char const *start_ptr)
+{
+  struct approx *ap = vcp;
+  char eol = ap->opts.eol;
+  char const *lim = buf + size;
+
+  if (!start_ptr)
+    {
+      char const *next;
+      char const *line = next_line (ap, buf, lim, &next);
+      if (!line)
+        return -1;
+      *match_size = next - line;
+      return line - buf;
+    }
+
+  char const *line_beg = memrchr (buf, eol, start_ptr - buf);
+  line_beg = line_beg ? line_beg + 1 : buf;
+  for (char const *beg = start_ptr; beg < lim; )
+    {
+      char const *end = memchr (beg, eol, lim - beg);
+      if (!end)
+        end = lim;
+      ptrdiff_t off = -1;
+      idx_t len = 0;
+      for (idx_t i = 0; i < ap->npats; i++)
+        {
+          idx_t l;
+          ptrdiff_t o = locate (ap, &ap->pats[i], line_beg, beg, end, &l);
+          if (0 <= o && (off < 0 || o < off || (o == off && len < l)))
+            {
+              off = o;
+              len = l;
+            }
+        }
+      if (0 <= off)
+        {
+          *match_size = len;
+          return beg + off - buf;
+        }
+      beg = line_beg = end + 1;
+    }
+  return -1;
+}
+
+/* Return the number of lines in the buffer BUF of size SIZE that
+   match the compiled pattern VCP.  BUF must end in a line
+   terminator.  */
+ptrdiff_t
+Acount (void *vcp, char const *buf, idx_t size)
+{
+  struct approx *ap = vcp;
+  char const *lim = buf + size;
+  ptrdiff_t count = 0;
+  for (char const *beg = buf; next_line (ap, beg, lim, &beg); )
+    count++;
+  return count;
+}
+
+/* Describe how the compiled pattern VCP will be matched, for --explain.  */
+void
+Aexplain (void *vcp, explain_printf_t print)
+{
+  struct approx *ap = vcp;
+  print (_("approximate strings: %td, with at most %td error(s)\n"),
+         ap->npats, ap->opts.max_errors);
+  if (ap->kwset)
+    print (_("fixed-string pieces: %td, of at least %td character(s)\n"),
+           kwswords (ap->kwset), ap->piece_min);
+  else
+    print (_("fixed-string pieces: none, every line is checked\n"));
+  if (ap->kwset && ap->nloose)
+    print (_("strings without pieces, checked on every line: %td\n"),
+           ap->nloose);
+}
+
+/* Free the compiled pattern VCP, and the pattern it was compiled from.  */
+void
+Afree (void *vcp)
+{
+  struct approx *ap = vcp;
+  for (idx_t i = 0; i < ap->npats; i++)
+    {
+      struct apat *pat = &ap->pats[i];
+      free (pat->eq);
+      free (pat->req);
+      free (pat->wide);
+    }
+  free (ap->pats);
+  if (ap->kwset)
+    kwsfree (ap->kwset);
+  free (ap->hit_beg);
+  free (ap->hit_pats);
+  free (ap->loose);
+  free (ap->checked);
+  free (ap->pv);
+  free (ap->mv);
+  free (ap->pattern);
+  free (ap);
+}
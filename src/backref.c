@@ -0,0 +1,1084 @@
+/* backref.c - match patterns with back-references by backtracking.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* The DFA cannot match back-references, so for lines that the DFA
+   accepts, a pattern with them used to be matched by regex, which is
+   slow and in some cases superlinear or wrong.  This matcher compiles
+   such a pattern into a small program and runs it by backtracking
+   over the line the DFA found, trying every way to match at each
+   starting point in turn, so that it finds the leftmost match and, if
+   asked, the longest one there, as POSIX requires.
+
+   It handles the grep and egrep syntaxes in single-byte locales and,
+   without -i, in UTF-8.  It declines patterns with constructs whose
+   exact meaning it leaves to regex, such as equivalence classes,
+   ranges outside the C locale, and repetition operators with nothing
+   to repeat; and it gives up on a line, letting the caller use regex
+   after all, when the line has an encoding error where the match
+   depends on it, or when matching takes more steps than the line's
+   budget.  */
+
+#include <config.h>
+
+#include <search.h>
+
+#include <ctype.h>
+#include <stdckdint.h>
+#include <uchar.h>
+
+#include "c-ctype.h"
+
+/* The most instructions in a program, so that patterns like
+   \(a\)\{1000\}\1 are left to regex.  */
+enum { PROG_MAX = 1 << 14 };
+
+/* The steps a search may take before giving up: STEPS_MIN, plus
+   STEPS_PER_BYTE for each byte of the line.  */
+enum { STEPS_MIN = 1 << 16 };
+enum { STEPS_PER_BYTE = 1 << 8 };
+
+/* Groups 1 through REFS_MAX - 1 can be referred to.  */
+enum { REFS_MAX = 10 };
+
+/* The most character classes in a bracket expression.  */
+enum { CLASSES_MAX = 16 };
+
+enum opcode
+  {
+    I_BYTE,			/* Match the byte ARG.  */
+    I_ANY,			/* Match any character, as '.' does.  */
+    I_SET,			/* Match a character in set ARG.  */
+    I_SPLIT,			/* Go on at X, and then at Y.  */
+    I_JMP,			/* Go on at X.  */
+    I_SAVE,			/* Set slot ARG to the position.  */
+    I_LOOP,			/* End an iteration, going on at X, or at Y
+                                   if it was empty and may be.  */
+    I_BACKREF,			/* Match again what group ARG matched.  */
+    I_ASSERT,			/* Check that assertion ARG holds.  */
+    I_MATCH			/* A match ends here.  */
+  };
+
+enum assertion
+  {
+    A_BEGLINE,			/* ^ or \` */
+    A_ENDLINE,			/* $ or \' */
+    A_WORD_BOUNDARY,		/* \b */
+    A_NOT_WORD_BOUNDARY,	/* \B */
+    A_WORD_BEG,			/* \< */
+    A_WORD_END			/* \> */
+  };
+
+struct inst
+{
+  enum opcode op;
+  int arg;
+  idx_t x;
+  idx_t y;
+};
+
+/* A sequence of instructions, whose jumps are to indexes in it.  */
+struct prog
+{
+  struct inst *v;
+  idx_t n;
+  idx_t alloc;
+};
+
+/* A set of characters.  A single-byte character or, in UTF-8, an
+   ASCII character B is in the set if bit B of BITS is set.  In UTF-8,
+   another character is in the set if it is one of CHARS or in one of
+   CLASSES, or, if INVERT, if it is not.  */
+struct set
+{
+  uint64_t bits[4];
+  bool invert;
+  char32_t *chars;
+  idx_t nchars;
+  idx_t chars_alloc;
+  c32_type_test_t classes[CLASSES_MAX];
+  int nclasses;
+};
+
+/* An entry of the backtracking stack: either a place to go on from,
+   if PC is nonnegative, or the old value POS of slot -1 - PC.  */
+struct frame
+{
+  idx_t pc;
+  idx_t pos;
+};
+
+struct backref
+{
+  struct inst *prog;
+  idx_t nprog;
+  struct set *sets;
+  idx_t nsets;
+
+  /* The slots: the start and end of each group that can be referred
+     to, and then for each repetition, where its current optional
+     iteration and the repetition itself began.  */
+  idx_t *slot;
+  idx_t nslots;
+
+  /* The byte that every match begins with, or -1 if none is known.  */
+  int firstbyte;
+
+  bool utf8;
+  bool dot_newline;
+  bool dot_not_null;
+
+  /* How single-byte characters are compared: by their upper case
+     counterparts with -i, as regex does, and otherwise as they are.  */
+  unsigned char trans[UCHAR_MAX + 1];
+
+  struct frame *stack;
+  idx_t stack_alloc;
+};
+
+/* A pattern being compiled.  */
+struct parser
+{
+  char const *p;
+  char const *lim;
+  reg_syntax_t syntax_bits;
+  bool icase;
+  struct backref *br;
+  idx_t sets_alloc;
+
+  /* Nesting depth of groups, the number of groups opened so far, the
+     groups below REFS_MAX that have been closed, and the number of
+     repetitions with optional iterations.  */
+  idx_t depth;
+  int ngroups;
+  unsigned int closed;
+  int nloops;
+
+  /* Whether the atom just parsed is an anchor, and whether the
+     pattern cannot be compiled.  */
+  bool anchor;
+  bool fail;
+};
+
+/* The operators of a pattern, apart from brackets, anchors and
+   escapes.  */
+enum op
+  {
+    OP_NONE,			/* Not an operator.  */
+    OP_OR,
+    OP_LPAREN,
+    OP_RPAREN,
+    OP_STAR,
+    OP_PLUS,
+    OP_QMARK,
+    OP_INTERVAL
+  };
+
+static void
+emit (struct parser *ps, struct prog *prog, enum opcode op, int arg,
+      idx_t x, idx_t y)
+{
+  if (prog->n == PROG_MAX)
+    {
+      ps->fail = true;
+      return;
+    }
+  if (prog->n == prog->alloc)
+    prog->v = xpalloc (prog->v, &prog->alloc, 1, PROG_MAX, sizeof *prog->v);
+  prog->v[prog->n++] = (struct inst) { op, arg, x, y };
+}
+
+/* Append SRC to DST, moving its jumps along with it.  */
+static void
+append (struct parser *ps, struct prog *dst, struct prog const *src)
+{
+  idx_t base = dst->n;
+  for (idx_t i = 0; i < src->n && !ps->fail; i++)
+    {
+      struct inst const *in = &src->v[i];
+      bool jump = in->op == I_SPLIT || in->op == I_JMP || in->op == I_LOOP;
+      emit (ps, dst, in->op, in->arg, in->x + jump * base,
+            in->y + jump * base);
+    }
+}
+
+/* Replace *PROG by itself repeated at least MIN and at most MAX times,
+   or without limit if MAX is negative.  */
+static void
+repeat (struct parser *ps, struct prog *prog, idx_t min, idx_t max)
+{
+  struct prog r = { 0 };
+
+  /* As POSIX says, an iteration beyond the first MIN may match the
+     empty string only if that is all the repetition matches, and then
+     it is the last one.  Such iterations are followed by I_LOOP, with
+     one slot for where the iteration began and the next for where the
+     repetition did.  */
+  int loop = 2 * REFS_MAX + 2 * ps->nloops;
+  if (max < 0 || min < max)
+    {
+      ps->nloops++;
+      emit (ps, &r, I_SAVE, loop + 1, 0, 0);
+    }
+
+  for (idx_t i = 0; i < min && !ps->fail; i++)
+    append (ps, &r, prog);
+
+  /* Each optional iteration may be skipped to the end, and so may the
+     loop of an unbounded one.  */
+  idx_t first = r.n;
+  for (idx_t i = min; (max < 0 ? i == min : i < max) && !ps->fail; i++)
+    {
+      idx_t top = r.n;
+      emit (ps, &r, I_SPLIT, 0, top + 1, 0);
+      emit (ps, &r, I_SAVE, loop, 0, 0);
+      append (ps, &r, prog);
+      emit (ps, &r, I_LOOP, loop, max < 0 ? top : r.n + 1, 0);
+    }
+  if (!ps->fail)
+    for (idx_t i = first; i < r.n; i += prog->n + 3)
+      r.v[i].y = r.v[i + prog->n + 2].y = r.n;
+
+  free (prog->v);
+  *prog = r;
+}
+
+/* Return the operator at the start of PS's input, and set *LEN to its
+   length.  */
+static enum op
+op_at (struct parser const *ps, char const *p, int *len)
+{
+  reg_syntax_t bits = ps->syntax_bits;
+  bool bk = *p == '\\' && p + 1 < ps->lim;
+  char c = p[bk];
+  *len = 1 + bk;
+
+  if (c == '*' && !bk)
+    return OP_STAR;
+  if ((c == '+' || c == '?') && bk == !!(bits & RE_BK_PLUS_QM)
+      && ! (bits & RE_LIMITED_OPS))
+    return c == '+' ? OP_PLUS : OP_QMARK;
+  if ((c == '(' || c == ')') && bk == ! (bits & RE_NO_BK_PARENS))
+    return c == '(' ? OP_LPAREN : OP_RPAREN;
+  if (c == '|' && bk == ! (bits & RE_NO_BK_VBAR) && ! (bits & RE_LIMITED_OPS))
+    return OP_OR;
+  if (c == '\n' && !bk && bits & RE_NEWLINE_ALT)
+    return OP_OR;
+  if (c == '{' && bk == ! (bits & RE_NO_BK_BRACES) && bits & RE_INTERVALS)
+    return OP_INTERVAL;
+  return OP_NONE;
+}
+
+/* Return the length of the character at P in PS's input and set *C to
+   it, or return -1 if it is not a valid character.  */
+static int
+parse_char (struct parser const *ps, char const *p, char32_t *c)
+{
+  unsigned char b = *p;
+  if (!ps->br->utf8 || b < 0x80)
+    {
+      *c = b;
+      return 1;
+    }
+  mbstate_t mbs; mbszero (&mbs);
+  size_t n = mbrtoc32 (c, p, ps->lim - p, &mbs);
+  return n <= MB_LEN_MAX ? n : -1;
+}
+
+/* Parse the interval whose contents start at PS's input, and set *MIN
+   and *MAX to its bounds, with *MAX negative if there is no upper
+   bound.  */
+static void
+parse_interval (struct parser *ps, idx_t *min, idx_t *max)
+{
+  bool bk = ! (ps->syntax_bits & RE_NO_BK_BRACES);
+  char const *p = ps->p;
+  idx_t n[2] = { -1, -1 };
+  for (int i = 0; i < 2; i++)
+    {
+      for (; p < ps->lim && c_isdigit (*p); p++)
+        n[i] = (n[i] < 0 ? 0 : n[i]) * 10 + (*p - '0');
+      if (RE_DUP_MAX < n[i])
+        break;
+      if (i == 0)
+        {
+          if (! (p < ps->lim && *p == ','))
+            {
+              n[1] = n[0];
+              break;
+            }
+          p++;
+        }
+    }
+  if (bk)
+    {
+      if (! (p < ps->lim && *p == '\\'))
+        p = ps->lim;
+      p++;
+    }
+  if (! (p < ps->lim && *p == '}' && n[0] <= RE_DUP_MAX && n[1] <= RE_DUP_MAX
+         && (n[1] < 0 || MAX (n[0], 0) <= n[1])))
+    {
+      /* An invalid interval, which is an error or, in some syntaxes,
+         literal text.  */
+      ps->fail = true;
+      return;
+    }
+  ps->p = p + 1;
+  *min = MAX (n[0], 0);
+  *max = n[1];
+}
+
+/* Return the set S of PS, added to its backref.  */
+static struct set *
+new_set (struct parser *ps, idx_t *s)
+{
+  struct backref *br = ps->br;
+  if (br->nsets == ps->sets_alloc)
+    br->sets = xpalloc (br->sets, &ps->sets_alloc, 1, -1, sizeof *br->sets);
+  *s = br->nsets++;
+  struct set *set = &br->sets[*s];
+  *set = (struct set) { 0 };
+  return set;
+}
+
+static void
+set_bit (struct set *set, unsigned char b)
+{
+  set->bits[b >> 6] |= (uint64_t) 1 << (b & 63);
+}
+
+static bool
+set_has_byte (struct set const *set, unsigned char b)
+{
+  return (set->bits[b >> 6] >> (b & 63)) & 1;
+}
+
+/* Add to SET of PS the character C, or the characters from C through
+   C2.  */
+static void
+set_add_range (struct parser *ps, struct set *set, char32_t c, char32_t c2)
+{
+  for (; c <= c2; c++)
+    if (!ps->br->utf8 || c < 0x80)
+      set_bit (set, ps->br->trans[c]);
+    else
+      {
+        if (set->nchars == set->chars_alloc)
+          set->chars = xpalloc (set->chars, &set->chars_alloc, 1, -1,
+                                sizeof *set->chars);
+        set->chars[set->nchars++] = c;
+      }
+}
+
+/* Add to SET of PS the characters in the class NAME.  */
+static void
+set_add_class (struct parser *ps, struct set *set, char const *name)
+{
+  /* Regex matches the upper case counterparts of characters with -i,
+     and so treats these classes as letters.  */
+  if (ps->icase && (strcmp (name, "upper") == 0 || strcmp (name, "lower") == 0))
+    name = "alpha";
+  c32_type_test_t test = c32_get_type_test (name);
+  if (!test || set->nclasses == CLASSES_MAX)
+    {
+      ps->fail = true;
+      return;
+    }
+  set->classes[set->nclasses++] = test;
+  for (int b = 0; b < (ps->br->utf8 ? 0x80 : UCHAR_MAX + 1); b++)
+    {
+      wint_t wc = ps->br->utf8 ? b : localeinfo.sbctowc[b];
+      if (wc != WEOF && c32_apply_type_test (wc, test))
+        set_bit (set, b);
+    }
+}
+
+/* Finish SET of PS, which matches the characters not listed if
+   INVERT.  */
+static void
+set_finish (struct parser *ps, struct set *set, bool invert)
+{
+  if (invert)
+    {
+      for (int i = 0; i < 4; i++)
+        set->bits[i] = ~set->bits[i];
+      set->invert = true;
+      if (ps->syntax_bits & RE_HAT_LISTS_NOT_NEWLINE)
+        set->bits[0] &= ~((uint64_t) 1 << '\n');
+    }
+}
+
+/* Parse the bracket expression whose contents start at PS's input,
+   and append to PROG an instruction to match it.  */
+static void
+parse_bracket (struct parser *ps, struct prog *prog)
+{
+  char const *p = ps->p;
+  bool invert = p < ps->lim && *p == '^';
+  p += invert;
+  idx_t s;
+  struct set *set = new_set (ps, &s);
+
+  for (bool first = true; ; first = false)
+    {
+      if (p == ps->lim)
+        {
+          ps->fail = true;
+          return;
+        }
+      if (*p == ']' && !first)
+        break;
+      if (*p == '[' && p + 1 < ps->lim
+          && (p[1] == '.' || p[1] == '=' || p[1] == ':'))
+        {
+          /* Collating symbols and equivalence classes are left to
+             regex.  */
+          char const *name = p + 2;
+          char const *end = name;
+          while (end + 1 < ps->lim && ! (end[0] == ':' && end[1] == ']'))
+            end++;
+          if (p[1] != ':' || ps->lim <= end + 1 || 32 <= end - name)
+            {
+              ps->fail = true;
+              return;
+            }
+          char buf[32];
+          memcpy (buf, name, end - name);
+          buf[end - name] = '\0';
+          set_add_class (ps, set, buf);
+          if (ps->fail)
+            return;
+          p = end + 2;
+          continue;
+        }
+
+      char32_t c, c2;
+      int n = parse_char (ps, p, &c);
+      if (n < 0 || (c == '-' && !first && p + 1 < ps->lim && p[1] != ']'))
+        {
+          ps->fail = true;
+          return;
+        }
+      p += n;
+      if (p + 1 < ps->lim && *p == '-' && p[1] != ']')
+        {
+          int n2 = parse_char (ps, p + 1, &c2);
+          if (n2 < 0 || p[1] == '[' || c2 < c
+              || ! (localeinfo.simple || (c_isdigit (c) && c_isdigit (c2))))
+            {
+              ps->fail = true;
+              return;
+            }
+          p += 1 + n2;
+          set_add_range (ps, set, c, c2);
+        }
+      else
+        set_add_range (ps, set, c, c);
+    }
+
+  ps->p = p + 1;
+  set_finish (ps, set, invert);
+  emit (ps, prog, I_SET, s, 0, 0);
+}
+
+/* Append to PROG of PS an instruction to match a word character, or
+   if INVERT, any other character; or if SPACE, a white space
+   character or any other.  */
+static void
+emit_class (struct parser *ps, struct prog *prog, bool space, bool invert)
+{
+  idx_t s;
+  struct set *set = new_set (ps, &s);
+  set_add_class (ps, set, space ? "space" : "alnum");
+  if (!space)
+    set_add_range (ps, set, '_', '_');
+  set_finish (ps, set, invert);
+  emit (ps, prog, I_SET, s, 0, 0);
+}
+
+static void
+emit_assert (struct parser *ps, struct prog *prog, enum assertion a)
+{
+  emit (ps, prog, I_ASSERT, a, 0, 0);
+  ps->anchor = true;
+}
+
+static void parse_regexp (struct parser *, struct prog *);
+
+/* Parse an atom at PS's input, and set *PROG to match it.  START says
+   whether the atom starts a branch, where '^' is an anchor even in a
+   basic regular expression.  */
+static void
+parse_atom (struct parser *ps, struct prog *prog, bool start)
+{
+  int len;
+  char const *p = ps->p;
+  enum op op = op_at (ps, p, &len);
+  reg_syntax_t bits = ps->syntax_bits;
+  *prog = (struct prog) { 0 };
+  ps->anchor = false;
+
+  if (op == OP_LPAREN)
+    {
+      ps->p += len;
+      ps->depth++;
+      int group = ++ps->ngroups;
+      struct prog body;
+      parse_regexp (ps, &body);
+      ps->depth--;
+      if (ps->fail || ps->p == ps->lim
+          || op_at (ps, ps->p, &len) != OP_RPAREN)
+        ps->fail = true;
+      else
+        ps->p += len;
+      if (group < REFS_MAX)
+        {
+          emit (ps, prog, I_SAVE, 2 * group, 0, 0);
+          append (ps, prog, &body);
+          emit (ps, prog, I_SAVE, 2 * group + 1, 0, 0);
+          ps->closed |= 1u << group;
+          free (body.v);
+        }
+      else
+        *prog = body;
+      return;
+    }
+  if (op != OP_NONE)
+    {
+      /* A repetition with nothing to repeat, or a stray parenthesis,
+         which regex may treat as literal text or ignore.  */
+      ps->fail = true;
+      return;
+    }
+
+  ps->p++;
+  switch (*p)
+    {
+    case '[':
+      parse_bracket (ps, prog);
+      return;
+
+    case '.':
+      emit (ps, prog, I_ANY, 0, 0, 0);
+      return;
+
+    case '^':
+      if (start || bits & RE_CONTEXT_INDEP_ANCHORS)
+        {
+          emit_assert (ps, prog, A_BEGLINE);
+          return;
+        }
+      break;
+
+    case '$':
+      if (ps->p == ps->lim || bits & RE_CONTEXT_INDEP_ANCHORS)
+        {
+          emit_assert (ps, prog, A_ENDLINE);
+          return;
+        }
+      op = op_at (ps, ps->p, &len);
+      if (op == OP_OR || op == OP_RPAREN)
+        {
+          emit_assert (ps, prog, A_ENDLINE);
+          return;
+        }
+      break;
+
+    case '\\':
+      if (ps->p == ps->lim)
+        {
+          ps->fail = true;
+          return;
+        }
+      p = ps->p++;
+      switch (*p)
+        {
+        case '1': case '2': case '3': case '4': case '5':
+        case '6': case '7': case '8': case '9':
+          if (! (ps->closed & (1u << (*p - '0'))))
+            ps->fail = true;
+          emit (ps, prog, I_BACKREF, *p - '0', 0, 0);
+          return;
+        case 'w': case 'W':
+          emit_class (ps, prog, false, *p == 'W');
+          return;
+        case 's': case 'S':
+          emit_class (ps, prog, true, *p == 'S');
+          return;
+        case 'b':
+          emit_assert (ps, prog, A_WORD_BOUNDARY);
+          return;
+        case 'B':
+          emit_assert (ps, prog, A_NOT_WORD_BOUNDARY);
+          return;
+        case '<':
+          emit_assert (ps, prog, A_WORD_BEG);
+          return;
+        case '>':
+          emit_assert (ps, prog, A_WORD_END);
+          return;
+        case '`':
+          emit_assert (ps, prog, A_BEGLINE);
+          return;
+        case '\'':
+          emit_assert (ps, prog, A_ENDLINE);
+          return;
+        }
+      break;
+    }
+
+  /* An ordinary character, possibly escaped.  */
+  char32_t c;
+  int n = parse_char (ps, p, &c);
+  if (n < 0)
+    {
+      ps->fail = true;
+      return;
+    }
+  ps->p = p + n;
+  for (int i = 0; i < n; i++)
+    emit (ps, prog, I_BYTE, ps->br->trans[to_uchar (p[i])], 0, 0);
+}
+
+/* Parse a piece at PS's input: an atom and any repetitions of it.
+   Set *PROG to match it.  START is as for parse_atom.  */
+static void
+parse_piece (struct parser *ps, struct prog *prog, bool start)
+{
+  parse_atom (ps, prog, start);
+
+  /* A repetition operator after an anchor starts a new expression.  */
+  while (!ps->fail && !ps->anchor && ps->p < ps->lim)
+    {
+      int len;
+      idx_t min, max;
+      switch (op_at (ps, ps->p, &len))
+        {
+        case OP_STAR:
+          min = 0, max = -1;
+          break;
+        case OP_PLUS:
+          min = 1, max = -1;
+          break;
+        case OP_QMARK:
+          min = 0, max = 1;
+          break;
+        case OP_INTERVAL:
+          ps->p += len;
+          parse_interval (ps, &min, &max);
+          if (ps->fail)
+            return;
+          len = 0;
+          break;
+        default:
+          return;
+        }
+      ps->p += len;
+      repeat (ps, prog, min, max);
+    }
+}
+
+/* Parse a branch at PS's input: a concatenation of pieces.  Set *PROG
+   to match it.  */
+static void
+parse_branch (struct parser *ps, struct prog *prog)
+{
+  *prog = (struct prog) { 0 };
+  bool start = true;
+
+  while (!ps->fail && ps->p < ps->lim)
+    {
+      int len;
+      enum op op = op_at (ps, ps->p, &len);
+      if (op == OP_OR || (op == OP_RPAREN && ps->depth))
+        break;
+
+      struct prog piece;
+      parse_piece (ps, &piece, start);
+      append (ps, prog, &piece);
+      free (piece.v);
+      start = false;
+    }
+}
+
+/* Parse a regular expression at PS's input: alternated branches.  Set
+   *PROG to match it.  */
+static void
+parse_regexp (struct parser *ps, struct prog *prog)
+{
+  parse_branch (ps, prog);
+  while (!ps->fail && ps->p < ps->lim)
+    {
+      int len;
+      if (op_at (ps, ps->p, &len) != OP_OR)
+        break;
+      ps->p += len;
+      struct prog b;
+      parse_branch (ps, &b);
+
+      struct prog r = { 0 };
+      emit (ps, &r, I_SPLIT, 0, 1, prog->n + 2);
+      append (ps, &r, prog);
+      emit (ps, &r, I_JMP, 0, prog->n + b.n + 2, 0);
+      append (ps, &r, &b);
+      free (prog->v);
+      free (b.v);
+      *prog = r;
+    }
+}
+
+/* Free the back-reference matcher BR.  */
+void
+backref_free (struct backref *br)
+{
+  if (br)
+    {
+      for (idx_t i = 0; i < br->nsets; i++)
+        free (br->sets[i].chars);
+      free (br->sets);
+      free (br->prog);
+      free (br->slot);
+      free (br->stack);
+      free (br);
+    }
+}
+
+/* Compile the SIZE bytes of PATTERN, a single pattern in the syntax
+   SYNTAX_BITS that regex has accepted, for backref_search.  Return
+   null if this matcher leaves PATTERN to regex.  */
+struct backref *
+backref_compile (char const *pattern, idx_t size, reg_syntax_t syntax_bits)
+{
+  bool icase = !!(syntax_bits & RE_ICASE);
+  if ((localeinfo.multibyte && (!localeinfo.using_utf8 || icase))
+      || (syntax_bits & (RE_BACKSLASH_ESCAPE_IN_LISTS | RE_NO_GNU_OPS
+                         | RE_NO_BK_REFS))
+      || ! (syntax_bits & RE_CHAR_CLASSES))
+    return nullptr;
+
+  struct backref *br = xzalloc (sizeof *br);
+  br->utf8 = localeinfo.using_utf8;
+  br->dot_newline = !!(syntax_bits & RE_DOT_NEWLINE);
+  br->dot_not_null = !!(syntax_bits & RE_DOT_NOT_NULL);
+  for (int b = 0; b <= UCHAR_MAX; b++)
+    br->trans[b] = icase ? toupper (b) : b;
+
+  struct parser ps = { .p = pattern, .lim = pattern + size,
+                       .syntax_bits = syntax_bits, .icase = icase,
+                       .br = br };
+  struct prog prog;
+  parse_regexp (&ps, &prog);
+  if (ps.p < ps.lim)
+    ps.fail = true;
+  emit (&ps, &prog, I_MATCH, 0, 0, 0);
+  br->prog = prog.v;
+  br->nprog = prog.n;
+  if (ps.fail)
+    {
+      backref_free (br);
+      return nullptr;
+    }
+
+  br->nslots = 2 * REFS_MAX + 2 * ps.nloops;
+  br->slot = xinmalloc (br->nslots, sizeof *br->slot);
+  br->firstbyte = -1;
+  for (idx_t pc = 0; pc < br->nprog; pc++)
+    if (br->prog[pc].op != I_SAVE)
+      {
+        if (br->prog[pc].op == I_BYTE && !icase)
+          br->firstbyte = br->prog[pc].arg;
+        break;
+      }
+  return br;
+}
+
+/* Return the length of the character at P, before LIM, and set *C to
+   it, or return -1 if it is an encoding error.  */
+static int
+next_char (struct backref const *br, char const *p, char const *lim,
+           char32_t *c)
+{
+  unsigned char b = *p;
+  if (!br->utf8 || b < 0x80)
+    {
+      *c = br->utf8 ? b : localeinfo.sbctowc[b];
+      return 1;
+    }
+  mbstate_t mbs; mbszero (&mbs);
+  size_t n = mbrtoc32 (c, p, lim - p, &mbs);
+  return n <= MB_LEN_MAX ? n : -1;
+}
+
+/* Return 1 if the character at position POS of the SIZE bytes of S is
+   a word character, 0 if it is not or if there is no character there,
+   and -1 if it is an encoding error.  If BEFORE, look at the
+   character that ends at POS instead.  */
+static int
+word_at (struct backref const *br, char const *s, idx_t size, idx_t pos,
+         bool before)
+{
+  if (before ? pos == 0 : pos == size)
+    return 0;
+  idx_t p = pos - before;
+  if (br->utf8 && before)
+    while (0 < p && pos - p < 4 && (s[p] & 0xC0) == 0x80)
+      p--;
+  char32_t c;
+  int n = next_char (br, s + p, s + size, &c);
+  if (n < 0 || (before && p + n != pos))
+    return -1;
+  if (!br->utf8 || c < 0x80)
+    {
+      unsigned char b = s[p];
+      return isalnum (b) || b == '_';
+    }
+  return c32isalnum (c) || c == '_';
+}
+
+/* Whether the character C, which is not a single-byte character,
+   is in SET.  */
+static bool
+set_has_char (struct set const *set, char32_t c)
+{
+  bool in = false;
+  for (idx_t i = 0; i < set->nchars && !in; i++)
+    in = set->chars[i] == c;
+  for (int i = 0; i < set->nclasses && !in; i++)
+    in = !!c32_apply_type_test (c, set->classes[i]);
+  return in != set->invert;
+}
+
+/* Give up searching, and let the caller use regex instead.  */
+enum { GAVE_UP = -2 };
+
+/* Match BR against the SIZE bytes of S starting at position FROM,
+   calling ACCEPT as in backref_search and spending at most *STEPS
+   steps.  Return the end of the longest accepted match, or of the
+   first one if !LONGEST, or -1 if there is none, or GAVE_UP.  */
+static idx_t
+run (struct backref *br, char const *s, idx_t size, idx_t from,
+     bool longest, bool (*accept) (void *, idx_t, idx_t), void *arg,
+     idx_t *steps)
+{
+  idx_t best = -1;
+  idx_t sp = 0;
+  idx_t pc = 0;
+  idx_t pos = from;
+  for (idx_t i = 0; i < br->nslots; i++)
+    br->slot[i] = -1;
+
+  for (;;)
+    {
+      if (--*steps < 0)
+        return GAVE_UP;
+
+      struct inst const *in = &br->prog[pc];
+      switch (in->op)
+        {
+        case I_BYTE:
+          if (pos < size && br->trans[to_uchar (s[pos])] == in->arg)
+            {
+              pos++;
+              pc++;
+              continue;
+            }
+          break;
+
+        case I_ANY:
+        case I_SET:
+          if (pos < size)
+            {
+              unsigned char b = s[pos];
+              int n = 1;
+              bool in_set;
+              if (!br->utf8 || b < 0x80)
+                in_set = (in->op == I_SET
+                          ? set_has_byte (&br->sets[in->arg], br->trans[b])
+                          : ! ((b == '\n' && !br->dot_newline)
+                               || (b == '\0' && br->dot_not_null)));
+              else
+                {
+                  char32_t c;
+                  n = next_char (br, s + pos, s + size, &c);
+                  if (n < 0)
+                    return GAVE_UP;
+                  in_set = (in->op == I_ANY
+                            || set_has_char (&br->sets[in->arg], c));
+                }
+              if (in_set)
+                {
+                  pos += n;
+                  pc++;
+                  continue;
+                }
+            }
+          break;
+
+        case I_SPLIT:
+          if (sp == br->stack_alloc)
+            br->stack = xpalloc (br->stack, &br->stack_alloc, 1, -1,
+                                 sizeof *br->stack);
+          br->stack[sp++] = (struct frame) { in->y, pos };
+          pc = in->x;
+          continue;
+
+        case I_JMP:
+          pc = in->x;
+          continue;
+
+        case I_SAVE:
+          if (sp == br->stack_alloc)
+            br->stack = xpalloc (br->stack, &br->stack_alloc, 1, -1,
+                                 sizeof *br->stack);
+          br->stack[sp++] = (struct frame) { -1 - in->arg,
+                                             br->slot[in->arg] };
+          br->slot[in->arg] = pos;
+          pc++;
+          continue;
+
+        case I_LOOP:
+          if (br->slot[in->arg] != pos)
+            {
+              pc = in->x;
+              continue;
+            }
+          if (br->slot[in->arg + 1] == pos)
+            {
+              pc = in->y;
+              continue;
+            }
+          break;
+
+        case I_BACKREF:
+          {
+            idx_t b = br->slot[2 * in->arg];
+            idx_t e = br->slot[2 * in->arg + 1];
+            if (0 <= b && b <= e && e - b <= size - pos)
+              {
+                idx_t i = 0;
+                while (i < e - b && (br->trans[to_uchar (s[b + i])]
+                                     == br->trans[to_uchar (s[pos + i])]))
+                  i++;
+                if (i == e - b)
+                  {
+                    pos += i;
+                    pc++;
+                    continue;
+                  }
+              }
+          }
+          break;
+
+        case I_ASSERT:
+          {
+            bool ok;
+            if (in->arg == A_BEGLINE)
+              ok = pos == 0;
+            else if (in->arg == A_ENDLINE)
+              ok = pos == size;
+            else
+              {
+                int before = word_at (br, s, size, pos, true);
+                int after = word_at (br, s, size, pos, false);
+                if (before < 0 || after < 0)
+                  return GAVE_UP;
+                ok = (in->arg == A_WORD_BOUNDARY ? before != after
+                      : in->arg == A_NOT_WORD_BOUNDARY ? before == after
+                      : in->arg == A_WORD_BEG ? !before && after
+                      : before && !after);
+              }
+            if (ok)
+              {
+                pc++;
+                continue;
+              }
+          }
+          break;
+
+        case I_MATCH:
+          if (best < pos && (!accept || accept (arg, from, pos)))
+            {
+              best = pos;
+              if (!longest || pos == size)
+                return best;
+            }
+          break;
+        }
+
+      /* Backtrack to the most recent place to go on from, undoing
+         what was saved since.  */
+      for (;;)
+        {
+          if (sp == 0)
+            return best;
+          struct frame f = br->stack[--sp];
+          if (0 <= f.pc)
+            {
+              pc = f.pc;
+              pos = f.pos;
+              break;
+            }
+          br->slot[-1 - f.pc] = f.pos;
+        }
+    }
+}
+
+/* Search the SIZE bytes of S for a match of BR that starts at position
+   START or up to RANGE bytes after it, and set *MATCH_SIZE to its
+   length.  Look for the leftmost match; of those that start there,
+   find the longest if LONGEST, and otherwise any.  If ACCEPT is not
+   null, count only matches from I to J where ACCEPT (ARG, I, J).
+   Return the start of the match, -1 if there is none, or
+   BACKREF_GAVE_UP if the caller should ask regex instead.  */
+ptrdiff_t
+backref_search (struct backref *br, char const *s, idx_t size, idx_t start,
+                idx_t range, bool longest,
+                bool (*accept) (void *, idx_t, idx_t), void *arg,
+                idx_t *match_size)
+{
+  idx_t steps;
+  if (ckd_mul (&steps, size, STEPS_PER_BYTE)
+      || ckd_add (&steps, steps, STEPS_MIN))
+    steps = IDX_MAX;
+  idx_t last = range < size - start ? start + range : size;
+
+  for (idx_t from = start; ; )
+    {
+      if (0 <= br->firstbyte)
+        {
+          char const *p = (from < size
+                           ? memchr (s + from, br->firstbyte,
+                                     MIN (last + 1, size) - from)
+                           : nullptr);
+          if (!p)
+            return -1;
+          from = p - s;
+        }
+
+      idx_t end = run (br, s, size, from, longest, accept, arg, &steps);
+      if (end == GAVE_UP)
+        return BACKREF_GAVE_UP;
+      if (0 <= end)
+        {
+          *match_size = end - from;
+          return from;
+        }
+      if (last <= from)
+        return -1;
+      char32_t c;
+      from += MAX (1, next_char (br, s + from, s + size, &c));
+    }
+}
@@ -0,0 +1,275 @@
+/* cache.c - cache of per-file search results, for grep --cache.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* The cache is a file holding a header and a fixed number of slots.
+   Each slot records the result of searching one file with one set of
+   patterns and options: the file's device, inode, size and
+   modification time, a hash of the patterns and options, and the
+   number of lines grep selected.  A slot is used only if all of these
+   match, so a file that changes, or a search with other patterns or
+   options, misses the cache.
+
+   The file is mapped into memory.  Any number of grep processes read
+   it without locking: each slot has a sequence number that is odd
+   while the slot is being written, and a reader ignores a slot whose
+   number is odd or changes while the slot is read.  Only the process
+   holding a write lock on the file updates it; if another process has
+   the lock, the cache is used read-only.  */
+
+#include <config.h>
+
+#include "cache.h"
+
+#include <stdatomic.h>
+#include <time.h>
+
+#include "system.h"
+#include "die.h"
+#include "stat-time.h"
+
+static char const cache_magic[] = "GREPCAC1";
+enum { CACHE_BYTE_ORDER = 0x01020304 };
+
+/* The number of slots, and the number of consecutive slots, starting
+   at a multiple of CACHE_WAYS, where the result for a file may be.  */
+enum { CACHE_SLOTS = 1 << 16, CACHE_WAYS = 4 };
+
+/* A file modified less than this many seconds before its result would
+   be recorded could change again without its modification time
+   changing, as time stamps are as coarse as 2 s on some file systems
+   and lag the clock a little on others.  Its result is not recorded.  */
+enum { CACHE_RACY_SECONDS = 2 };
+
+struct cache_header
+{
+  char magic[8];
+  uint32_t byte_order;
+  uint32_t slots;
+  char unused[48];
+};
+
+struct cache_slot
+{
+  _Atomic uint64_t seq;
+  _Atomic uint64_t dev, ino, size, mtime;
+  _Atomic uint64_t key;
+  _Atomic uint64_t count;
+  _Atomic uint64_t unused;
+};
+
+/* The identity of a file as the cache sees it.  */
+struct file_id
+{
+  uint64_t dev, ino, size, mtime;
+};
+
+/* The mapped slots, or null if the cache is not usable; whether this
+   process may write them; and the hash of the patterns and options.  */
+static struct cache_slot *slots;
+static bool writer;
+static uint64_t cache_key;
+
+/* Return the hash of the SIZE bytes at P, continuing from the hash H
+   of any preceding data, or from 0.  This is FNV-1a.  */
+uint64_t
+result_cache_hash (uint64_t h, void const *p, idx_t size)
+{
+  unsigned char const *b = p;
+  for (idx_t i = 0; i < size; i++)
+    h = (h ^ b[i]) * 0x100000001b3;
+  return h;
+}
+
+/* Use the cache in FILE, creating it if need be, for searches whose
+   patterns and options have the hash KEY.  Report an error and exit
+   if FILE is not a cache.  Return false if caches are not supported.  */
+bool
+result_cache_open (char const *file, uint64_t key)
+{
+#if HAVE_SYS_MMAN_H
+  idx_t size = sizeof (struct cache_header)
+               + CACHE_SLOTS * sizeof (struct cache_slot);
+  int fd = open (file, O_RDWR | O_CREAT | O_NOCTTY | O_CLOEXEC,
+                 (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP
+                  | S_IROTH | S_IWOTH));
+  bool writable = 0 <= fd;
+  if (!writable)
+    fd = open (file, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat (fd, &st) != 0)
+    die (EXIT_TROUBLE, errno, "%s", file);
+
+  /* Become the writer unless another process is.  The lock lasts
+     until grep exits.  */
+  struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+  writer = writable && fcntl (fd, F_SETLK, &lock) == 0;
+
+  cache_key = key;
+  if (st.st_size == 0)
+    {
+      /* A new cache, perhaps being created by another process.  */
+      if (!writer)
+        {
+          close (fd);
+          return true;
+        }
+      if (ftruncate (fd, size) != 0)
+        die (EXIT_TROUBLE, errno, "%s", file);
+    }
+  else if (st.st_size != size)
+    die (EXIT_TROUBLE, 0, _("%s: not a valid grep cache"), file);
+
+  void *p = mmap (nullptr, size, PROT_READ | (writer ? PROT_WRITE : 0),
+                  MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    die (EXIT_TROUBLE, errno, "%s", file);
+  if (!writer)
+    close (fd);
+
+  struct cache_header *h = p;
+  static char const zeros[sizeof h->magic];
+  if (memcmp (h->magic, zeros, sizeof h->magic) == 0)
+    {
+      /* The header is written last when creating a cache, so that
+         readers see either no header or a complete one.  */
+      if (writer)
+        {
+          h->byte_order = CACHE_BYTE_ORDER;
+          h->slots = CACHE_SLOTS;
+          memcpy (h->magic, cache_magic, sizeof h->magic);
+        }
+    }
+  else if (! (memcmp (h->magic, cache_magic, sizeof h->magic) == 0
+              && h->byte_order == CACHE_BYTE_ORDER
+              && h->slots == CACHE_SLOTS))
+    die (EXIT_TROUBLE, 0, _("%s: not a valid grep cache"), file);
+
+  slots = (struct cache_slot *) (h + 1);
+  return true;
+#else
+  return false;
+#endif
+}
+
+static struct file_id
+get_file_id (struct stat const *st)
+{
+  struct timespec mtime = get_stat_mtime (st);
+  return (struct file_id) { .dev = st->st_dev, .ino = st->st_ino,
+                            .size = st->st_size,
+                            .mtime = (mtime.tv_sec * (uint64_t) 1000000000
+                                      + mtime.tv_nsec) };
+}
+
+/* Return the first of the slots where the result for ID may be.
+   These depend only on the file, not its contents, so that a new
+   result for a changed file replaces the old one.  */
+static struct cache_slot *
+find_slots (struct file_id const *id)
+{
+  uint64_t h = result_cache_hash (cache_key, &id->dev, sizeof id->dev);
+  h = result_cache_hash (h, &id->ino, sizeof id->ino);
+  return &slots[h % CACHE_SLOTS / CACHE_WAYS * CACHE_WAYS];
+}
+
+/* Return true if SLOT holds the result for ID.  The caller checks that
+   SLOT did not change meanwhile.  */
+static bool
+slot_matches (struct cache_slot *slot, struct file_id const *id)
+{
+  return (atomic_load_explicit (&slot->key, memory_order_relaxed) == cache_key
+          && atomic_load_explicit (&slot->ino, memory_order_relaxed) == id->ino
+          && atomic_load_explicit (&slot->dev, memory_order_relaxed) == id->dev
+          && (atomic_load_explicit (&slot->size, memory_order_relaxed)
+              == id->size)
+          && (atomic_load_explicit (&slot->mtime, memory_order_relaxed)
+              == id->mtime));
+}
+
+/* If the cache has the result for the file with status ST, set *COUNT
+   to its number of selected lines and return true.  Otherwise return
+   false.  */
+bool
+result_cache_lookup (struct stat const *st, intmax_t *count)
+{
+  if (!slots)
+    return false;
+
+  struct file_id id = get_file_id (st);
+  struct cache_slot *set = find_slots (&id);
+  for (int i = 0; i < CACHE_WAYS; i++)
+    {
+      struct cache_slot *slot = &set[i];
+      uint64_t seq = atomic_load_explicit (&slot->seq, memory_order_acquire);
+      if (seq == 0 || seq & 1)
+        continue;
+      bool hit = slot_matches (slot, &id);
+      uint64_t n = atomic_load_explicit (&slot->count, memory_order_relaxed);
+      atomic_thread_fence (memory_order_acquire);
+      if (hit && n <= INTMAX_MAX
+          && atomic_load_explicit (&slot->seq, memory_order_relaxed) == seq)
+        {
+          *count = n;
+          return true;
+        }
+    }
+  return false;
+}
+
+/* Record COUNT as the number of selected lines in the file with
+   status ST, if this process writes the cache and the file was not
+   modified too recently.  */
+void
+result_cache_store (struct stat const *st, intmax_t count)
+{
+  if (!writer)
+    return;
+
+  time_t now = time (nullptr);
+  if (now == (time_t) -1
+      || now - CACHE_RACY_SECONDS < get_stat_mtime (st).tv_sec)
+    return;
+
+  struct file_id id = get_file_id (st);
+  struct cache_slot *set = find_slots (&id);
+
+  /* Replace an older result for the same file, or else use a free
+     slot, or else evict the slots in turn.  */
+  static unsigned int victim;
+  struct cache_slot *slot = nullptr;
+  for (int i = 0; i < CACHE_WAYS && !slot; i++)
+    if ((atomic_load_explicit (&set[i].ino, memory_order_relaxed) == id.ino
+         && atomic_load_explicit (&set[i].dev, memory_order_relaxed) == id.dev
+         && (atomic_load_explicit (&set[i].key, memory_order_relaxed)
+             == cache_key))
+        || atomic_load_explicit (&set[i].seq, memory_order_relaxed) == 0)
+      slot = &set[i];
+  if (!slot)
+    slot = &set[victim++ % CACHE_WAYS];
+
+  /* Make the sequence number odd even if an earlier writer died
+     while writing the slot.  */
+  uint64_t seq = atomic_load_explicit (&slot->seq, memory_order_relaxed) | 1;
+  atomic_store_explicit (&slot->seq, seq, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+  atomic_store_explicit (&slot->dev, id.dev, memory_order_relaxed);
+  atomic_store_explicit (&slot->ino, id.ino, memory_order_relaxed);
+  atomic_store_explicit (&slot->size, id.size, memory_order_relaxed);
+  atomic_store_explicit (&slot->mtime, id.mtime, memory_order_relaxed);
+  atomic_store_explicit (&slot->key, cache_key, memory_order_relaxed);
+  atomic_store_explicit (&slot->count, count, memory_order_relaxed);
+  atomic_store_explicit (&slot->seq, seq + 1, memory_order_release);
+}
@@ -0,0 +1,30 @@
+/* cache.h - cache of per-file search results, for grep --cache.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef GREP_CACHE_H
+#define GREP_CACHE_H 1
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <idx.h>
+
+extern uint64_t result_cache_hash (uint64_t, void const *, idx_t)
+  _GL_ATTRIBUTE_PURE;
+extern bool result_cache_open (char const *, uint64_t);
+extern bool result_cache_lookup (struct stat const *, intmax_t *);
+extern void result_cache_store (struct stat const *, intmax_t);
+
+#endif
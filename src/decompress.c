@@ -0,0 +1,1088 @@
+/* decompress.c - transparent decompression of grep's input.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* The decompression libraries are loaded with dlopen the first time
+   an input file needs them, so that grep neither pays their startup
+   cost nor depends on them being installed when --decompress is not
+   used or the input is not compressed.
+
+   When the input consists of independent frames whose compressed
+   sizes can be found without decoding them, as with multi-frame zstd
+   and with gzip members that record their size as BGZF does, runs of
+   frames are handed to a pool of worker threads and their output is
+   returned in input order.  Other input is decoded by the main thread.
+   Only this file is multithreaded; the workers call nothing but the
+   decompression libraries and the C library.  */
+
+#include <config.h>
+
+#include "decompress.h"
+
+#include <dlfcn.h>
+#include <stdalign.h>
+#include <stdckdint.h>
+#if HAVE_DECOMPRESS_THREADS
+# include <pthread.h>
+#endif
+
+#include "system.h"
+#include "alignalloc.h"
+#include "grep.h"
+#include "safe-read.h"
+#include "xalloc.h"
+
+#if HAVE_ZLIB_H
+# include <zlib.h>
+#endif
+#if HAVE_BZLIB_H
+# include <bzlib.h>
+#endif
+#if HAVE_LZMA_H
+# include <lzma.h>
+#endif
+#if HAVE_ZSTD_H
+# include <zstd.h>
+#endif
+
+/* Initial size of the buffer holding compressed input.  */
+enum { INBUF_SIZE = 128 * 1024 };
+
+/* When decoding in parallel, the compressed size of the runs of
+   frames handed to worker threads, and the size of the largest frame
+   that is decoded in parallel.  A frame whose size cannot be told
+   until all of it has been read, as with the single frame of a large
+   zstd file, is buffered up to the latter size before it is decoded
+   in the main thread.  */
+enum { CHUNK_SIZE = 1024 * 1024 };
+enum { PARALLEL_INPUT_MAX = 8 * 1024 * 1024 };
+
+/* Length of the longest magic number below.  */
+enum { MAGIC_MAX = 6 };
+
+/* Outcome of one decompression step.  */
+enum step
+  {
+    STEP_OK,			/* Progress was made, or more input is needed.  */
+    STEP_END,			/* A compressed stream ended.  */
+    STEP_TRUNCATED,		/* The input ended in mid-stream.  */
+    STEP_ERROR			/* The input is corrupt.  */
+  };
+
+/* A shared library symbol, and where to store its address.  */
+struct symbol
+{
+  char const *name;
+  void **addr;
+};
+
+/* The address of the function pointer F, as needed by dlsym.  */
+#define SYMBOL(f) { #f, (void **) &f##_ptr }
+
+struct chunk;
+
+struct decoder
+{
+  /* Format name, for diagnostics.  */
+  char const *name;
+
+  /* Magic number that starts each compressed stream.  */
+  unsigned char magic[MAGIC_MAX];
+  int magic_len;
+
+  /* Names of the shared library to try, in order, terminated by a
+     null pointer.  */
+  char const *const *libraries;
+
+  /* The functions to look up in the library, terminated by a null
+     name.  */
+  struct symbol const *symbols;
+
+  /* Prepare to decode a stream.  */
+  void (*init) (void);
+
+  /* Decode from the *INSIZE bytes at *IN into the OUTSIZE bytes at
+     OUT, advancing *IN past the input consumed and setting *OUTLEN to
+     the number of bytes output.  EOF says whether the input ends
+     after the *INSIZE bytes.  */
+  enum step (*step) (unsigned char const **in, idx_t *insize, bool eof,
+                     char *out, idx_t outsize, idx_t *outlen);
+
+  /* Free the decoding state.  */
+  void (*end) (void);
+
+  /* If the N bytes at P start with a frame that can be decoded on its
+     own, return the frame's size; return 0 if more input is needed to
+     tell, and -1 if the input cannot be split into frames.  Null if
+     the format cannot be decoded in parallel.  */
+  idx_t (*frame_size) (unsigned char const *p, idx_t n);
+
+  /* Decode the complete frames in a chunk, returning STEP_END if
+     successful.  This is called from worker threads, so it must use
+     no static state.  */
+  enum step (*decode_chunk) (struct chunk *);
+
+  /* The library handle, or null if not yet loaded.  */
+  void *handle;
+
+  /* True if the library could not be loaded.  */
+  bool unavailable;
+};
+
+/* A run of complete frames, decoded as a unit by a worker thread.  */
+struct chunk
+{
+  struct decoder *decoder;
+
+  /* The compressed data.  */
+  unsigned char *in;
+  idx_t insize;
+
+  /* The decompressed data, its length and allocated size, and how much
+     of it decompress_read has returned.  */
+  char *out;
+  idx_t outlen, outalloc, outpos;
+
+  /* The outcome of decoding, whether memory was exhausted, and
+     whether OUT was advised to use huge pages.  */
+  enum step status;
+  bool nomem;
+  bool huge;
+
+  /* True once a worker has decoded the chunk.  Protected by pool_lock.  */
+  bool done;
+
+  /* The next chunk in input order, and the next chunk awaiting a
+     worker.  */
+  struct chunk *next;
+  struct chunk *next_todo;
+};
+
+/* Enlarge C's output buffer, returning false if memory is exhausted.
+   This is called from worker threads, so it must not call xalloc_die.
+   The worker is the first to touch the new buffer, so on NUMA systems
+   the kernel places it on the worker's node.  The decoder rereads
+   recent output as its window there, whereas the main thread reads
+   each byte just once, to copy it into its own buffer.  */
+static bool
+chunk_grow (struct chunk *c)
+{
+  idx_t incr = c->outalloc ? c->outalloc : 4 * c->insize + 1;
+  idx_t n;
+  if (ckd_add (&n, c->outalloc, incr)
+      || (HUGE_PAGE_SIZE <= n
+          && ckd_add (&n, n, HUGE_PAGE_SIZE - 1 - (n - 1) % HUGE_PAGE_SIZE)))
+    {
+      c->nomem = true;
+      return false;
+    }
+
+  bool huge = HUGE_PAGE_SIZE <= n;
+  char *out = alignalloc (huge ? HUGE_PAGE_SIZE : alignof (max_align_t), n);
+  if (!out)
+    {
+      c->nomem = true;
+      return false;
+    }
+  if (huge)
+    c->huge = advise_huge_pages (out, n);
+  if (c->outlen)
+    memcpy (out, c->out, c->outlen);
+  alignfree (c->out);
+  c->out = out;
+  c->outalloc = n;
+  return true;
+}
+
+
+#if HAVE_ZLIB_H
+
+static int (*inflateInit2__ptr) (z_streamp, int, char const *, int);
+static int (*inflate_ptr) (z_streamp, int);
+static int (*inflateReset_ptr) (z_streamp);
+static int (*inflateEnd_ptr) (z_streamp);
+
+static char const *const gzip_libraries[] = { "libz.so.1", "libz.so", nullptr };
+static struct symbol const gzip_symbols[] =
+  {
+    SYMBOL (inflateInit2_), SYMBOL (inflate), SYMBOL (inflateReset),
+    SYMBOL (inflateEnd), { nullptr, nullptr }
+  };
+
+static z_stream gzip_stream;
+static bool gzip_stream_initialized;
+
+static void
+gzip_init (void)
+{
+  int r;
+  if (gzip_stream_initialized)
+    r = inflateReset_ptr (&gzip_stream);
+  else
+    {
+      /* Add 16 to the window size to accept only the gzip format.  */
+      r = inflateInit2__ptr (&gzip_stream, 16 + MAX_WBITS,
+                             ZLIB_VERSION, sizeof gzip_stream);
+      gzip_stream_initialized = r == Z_OK;
+    }
+  if (r != Z_OK)
+    xalloc_die ();
+}
+
+static enum step
+gzip_step (unsigned char const **in, idx_t *insize, bool eof,
+           char *out, idx_t outsize, idx_t *outlen)
+{
+  gzip_stream.next_in = (Bytef *) *in;
+  gzip_stream.avail_in = MIN (*insize, UINT_MAX);
+  gzip_stream.next_out = (Bytef *) out;
+  gzip_stream.avail_out = MIN (outsize, UINT_MAX);
+  int r = inflate_ptr (&gzip_stream, Z_NO_FLUSH);
+  idx_t used = gzip_stream.next_in - *in;
+  *in += used;
+  *insize -= used;
+  *outlen = (char *) gzip_stream.next_out - out;
+  switch (r)
+    {
+    case Z_OK:
+      return STEP_OK;
+    case Z_STREAM_END:
+      return STEP_END;
+    case Z_BUF_ERROR:
+      return eof && *insize == 0 ? STEP_TRUNCATED : STEP_OK;
+    case Z_MEM_ERROR:
+      xalloc_die ();
+    default:
+      return STEP_ERROR;
+    }
+}
+
+static void
+gzip_end (void)
+{
+}
+
+/* Return the size of the gzip member at P, if it records its size in
+   a BGZF extra subfield.  */
+static idx_t
+gzip_frame_size (unsigned char const *p, idx_t n)
+{
+  enum { FEXTRA = 4, HEADER_SIZE = 12, TRAILER_SIZE = 8 };
+  if (n < 4)
+    return 0;
+  if (! (p[0] == 0x1f && p[1] == 0x8b && p[2] == 0x08 && p[3] & FEXTRA))
+    return -1;
+  if (n < HEADER_SIZE)
+    return 0;
+  idx_t extra_end = HEADER_SIZE + (p[10] | p[11] << 8);
+  if (n < extra_end)
+    return 0;
+  for (idx_t i = HEADER_SIZE; i + 4 <= extra_end;
+       i += 4 + (p[i + 2] | p[i + 3] << 8))
+    if (p[i] == 'B' && p[i + 1] == 'C' && p[i + 2] == 2 && p[i + 3] == 0
+        && i + 6 <= extra_end)
+      {
+        idx_t size = (p[i + 4] | p[i + 5] << 8) + 1;
+        return size < extra_end + TRAILER_SIZE ? -1 : size <= n ? size : 0;
+      }
+  return -1;
+}
+
+static enum step
+gzip_decode_chunk (struct chunk *c)
+{
+  z_stream z = { 0 };
+  switch (inflateInit2__ptr (&z, 16 + MAX_WBITS, ZLIB_VERSION, sizeof z))
+    {
+    case Z_OK:
+      break;
+    case Z_MEM_ERROR:
+      c->nomem = true;
+      FALLTHROUGH;
+    default:
+      return STEP_ERROR;
+    }
+
+  z.next_in = c->in;
+  z.avail_in = c->insize;
+  enum step s = STEP_OK;
+  while (s == STEP_OK)
+    {
+      if (c->outlen == c->outalloc && !chunk_grow (c))
+        s = STEP_ERROR;
+      else
+        {
+          z.next_out = (Bytef *) c->out + c->outlen;
+          z.avail_out = MIN (c->outalloc - c->outlen, UINT_MAX);
+          int r = inflate_ptr (&z, Z_NO_FLUSH);
+          c->outlen = (char *) z.next_out - c->out;
+          if (r == Z_STREAM_END)
+            s = (z.avail_in == 0 ? STEP_END
+                 : inflateReset_ptr (&z) == Z_OK ? STEP_OK : STEP_ERROR);
+          else if (r == Z_MEM_ERROR)
+            {
+              c->nomem = true;
+              s = STEP_ERROR;
+            }
+          else if (! (r == Z_OK || r == Z_BUF_ERROR))
+            s = STEP_ERROR;
+          else if (z.avail_in == 0 && z.avail_out != 0)
+            s = STEP_TRUNCATED;
+        }
+    }
+  inflateEnd_ptr (&z);
+  return s;
+}
+
+#endif /* HAVE_ZLIB_H */
+
+
+#if HAVE_BZLIB_H
+
+static int (*BZ2_bzDecompressInit_ptr) (bz_stream *, int, int);
+static int (*BZ2_bzDecompress_ptr) (bz_stream *);
+static int (*BZ2_bzDecompressEnd_ptr) (bz_stream *);
+
+static char const *const bzip2_libraries[] =
+  { "libbz2.so.1.0", "libbz2.so.1", "libbz2.so", nullptr };
+static struct symbol const bzip2_symbols[] =
+  {
+    SYMBOL (BZ2_bzDecompressInit), SYMBOL (BZ2_bzDecompress),
+    SYMBOL (BZ2_bzDecompressEnd), { nullptr, nullptr }
+  };
+
+static bz_stream bzip2_stream;
+
+static void
+bzip2_init (void)
+{
+  if (BZ2_bzDecompressInit_ptr (&bzip2_stream, 0, 0) != BZ_OK)
+    xalloc_die ();
+}
+
+static enum step
+bzip2_step (unsigned char const **in, idx_t *insize, bool eof,
+            char *out, idx_t outsize, idx_t *outlen)
+{
+  bzip2_stream.next_in = (char *) *in;
+  bzip2_stream.avail_in = MIN (*insize, UINT_MAX);
+  bzip2_stream.next_out = out;
+  bzip2_stream.avail_out = MIN (outsize, UINT_MAX);
+  int r = BZ2_bzDecompress_ptr (&bzip2_stream);
+  idx_t used = (unsigned char const *) bzip2_stream.next_in - *in;
+  *in += used;
+  *insize -= used;
+  *outlen = bzip2_stream.next_out - out;
+  switch (r)
+    {
+    case BZ_OK:
+      return eof && *insize == 0 && *outlen == 0 ? STEP_TRUNCATED : STEP_OK;
+    case BZ_STREAM_END:
+      return STEP_END;
+    case BZ_MEM_ERROR:
+      xalloc_die ();
+    default:
+      return STEP_ERROR;
+    }
+}
+
+static void
+bzip2_end (void)
+{
+  BZ2_bzDecompressEnd_ptr (&bzip2_stream);
+}
+
+#endif /* HAVE_BZLIB_H */
+
+
+#if HAVE_LZMA_H
+
+static lzma_ret (*lzma_stream_decoder_ptr) (lzma_stream *, uint64_t, uint32_t);
+static lzma_ret (*lzma_code_ptr) (lzma_stream *, lzma_action);
+static void (*lzma_end_ptr) (lzma_stream *);
+
+static char const *const xz_libraries[] =
+  { "liblzma.so.5", "liblzma.so", nullptr };
+static struct symbol const xz_symbols[] =
+  {
+    SYMBOL (lzma_stream_decoder), SYMBOL (lzma_code), SYMBOL (lzma_end),
+    { nullptr, nullptr }
+  };
+
+static lzma_stream xz_stream = LZMA_STREAM_INIT;
+
+static void
+xz_init (void)
+{
+  /* liblzma itself handles concatenated streams and stream padding.  */
+  if (lzma_stream_decoder_ptr (&xz_stream, UINT64_MAX, LZMA_CONCATENATED)
+      != LZMA_OK)
+    xalloc_die ();
+}
+
+static enum step
+xz_step (unsigned char const **in, idx_t *insize, bool eof,
+         char *out, idx_t outsize, idx_t *outlen)
+{
+  xz_stream.next_in = *in;
+  xz_stream.avail_in = *insize;
+  xz_stream.next_out = (uint8_t *) out;
+  xz_stream.avail_out = outsize;
+  lzma_ret r = lzma_code_ptr (&xz_stream, eof ? LZMA_FINISH : LZMA_RUN);
+  idx_t used = xz_stream.next_in - *in;
+  *in += used;
+  *insize -= used;
+  *outlen = (char *) xz_stream.next_out - out;
+  switch (r)
+    {
+    case LZMA_OK:
+      return STEP_OK;
+    case LZMA_STREAM_END:
+      return STEP_END;
+    case LZMA_BUF_ERROR:
+      return STEP_TRUNCATED;
+    case LZMA_MEM_ERROR:
+      xalloc_die ();
+    default:
+      return STEP_ERROR;
+    }
+}
+
+static void
+xz_end (void)
+{
+  lzma_end_ptr (&xz_stream);
+}
+
+#endif /* HAVE_LZMA_H */
+
+
+#if HAVE_ZSTD_H
+
+static ZSTD_DStream *(*ZSTD_createDStream_ptr) (void);
+static size_t (*ZSTD_initDStream_ptr) (ZSTD_DStream *);
+static size_t (*ZSTD_decompressStream_ptr) (ZSTD_DStream *, ZSTD_outBuffer *,
+                                            ZSTD_inBuffer *);
+static unsigned (*ZSTD_isError_ptr) (size_t);
+static size_t (*ZSTD_freeDStream_ptr) (ZSTD_DStream *);
+static size_t (*ZSTD_findFrameCompressedSize_ptr) (void const *, size_t);
+
+static char const *const zstd_libraries[] =
+  { "libzstd.so.1", "libzstd.so", nullptr };
+static struct symbol const zstd_symbols[] =
+  {
+    SYMBOL (ZSTD_createDStream), SYMBOL (ZSTD_initDStream),
+    SYMBOL (ZSTD_decompressStream), SYMBOL (ZSTD_isError),
+    SYMBOL (ZSTD_freeDStream), SYMBOL (ZSTD_findFrameCompressedSize),
+    { nullptr, nullptr }
+  };
+
+static ZSTD_DStream *zstd_stream;
+
+/* True if the last frame seen was complete.  */
+static bool zstd_frame_done;
+
+static void
+zstd_init (void)
+{
+  zstd_stream = ZSTD_createDStream_ptr ();
+  if (!zstd_stream || ZSTD_isError_ptr (ZSTD_initDStream_ptr (zstd_stream)))
+    xalloc_die ();
+  zstd_frame_done = false;
+}
+
+static enum step
+zstd_step (unsigned char const **in, idx_t *insize, bool eof,
+           char *out, idx_t outsize, idx_t *outlen)
+{
+  /* libzstd itself decodes a sequence of frames, so this reports
+     STEP_END only at the end of the input.  */
+  ZSTD_inBuffer input = { *in, *insize, 0 };
+  ZSTD_outBuffer output = { out, outsize, 0 };
+  size_t r = ZSTD_decompressStream_ptr (zstd_stream, &output, &input);
+  *in += input.pos;
+  *insize -= input.pos;
+  *outlen = output.pos;
+  if (ZSTD_isError_ptr (r))
+    return STEP_ERROR;
+  if (input.pos || output.pos)
+    zstd_frame_done = r == 0;
+  if (eof && *insize == 0 && *outlen == 0)
+    return zstd_frame_done ? STEP_END : STEP_TRUNCATED;
+  return STEP_OK;
+}
+
+static void
+zstd_end (void)
+{
+  ZSTD_freeDStream_ptr (zstd_stream);
+}
+
+/* Return the size of the zstd frame at P.  libzstd does not say
+   whether a frame is corrupt or merely incomplete, so corrupt data is
+   diagnosed only when it is decoded serially.  */
+static idx_t
+zstd_frame_size (unsigned char const *p, idx_t n)
+{
+  size_t r = ZSTD_findFrameCompressedSize_ptr (p, n);
+  return ZSTD_isError_ptr (r) ? 0 : r;
+}
+
+static enum step
+zstd_decode_chunk (struct chunk *c)
+{
+  ZSTD_DStream *stream = ZSTD_createDStream_ptr ();
+  if (!stream || ZSTD_isError_ptr (ZSTD_initDStream_ptr (stream)))
+    {
+      ZSTD_freeDStream_ptr (stream);
+      c->nomem = true;
+      return STEP_ERROR;
+    }
+
+  ZSTD_inBuffer input = { c->in, c->insize, 0 };
+  enum step s = STEP_OK;
+  while (s == STEP_OK)
+    {
+      if (c->outlen == c->outalloc && !chunk_grow (c))
+        s = STEP_ERROR;
+      else
+        {
+          ZSTD_outBuffer output = { c->out + c->outlen,
+                                    c->outalloc - c->outlen, 0 };
+          size_t r = ZSTD_decompressStream_ptr (stream, &output, &input);
+          c->outlen += output.pos;
+          if (ZSTD_isError_ptr (r))
+            s = STEP_ERROR;
+          else if (input.pos == input.size && output.pos < output.size)
+            s = r == 0 ? STEP_END : STEP_TRUNCATED;
+        }
+    }
+  ZSTD_freeDStream_ptr (stream);
+  return s;
+}
+
+#endif /* HAVE_ZSTD_H */
+
+
+/* The supported formats, indexed by enum compression - 1.  A format
+   whose header was missing at build time has a null STEP, and its
+   input is diagnosed as unsupported.  */
+static struct decoder decoders[] =
+  {
+    { "gzip", { 0x1f, 0x8b, 0x08 }, 3,
+#if HAVE_ZLIB_H
+      gzip_libraries, gzip_symbols, gzip_init, gzip_step, gzip_end,
+      gzip_frame_size, gzip_decode_chunk
+#endif
+    },
+    { "bzip2", { 'B', 'Z', 'h' }, 3,
+#if HAVE_BZLIB_H
+      bzip2_libraries, bzip2_symbols, bzip2_init, bzip2_step, bzip2_end
+#endif
+    },
+    { "xz", { 0xfd, '7', 'z', 'X', 'Z', 0x00 }, 6,
+#if HAVE_LZMA_H
+      xz_libraries, xz_symbols, xz_init, xz_step, xz_end
+#endif
+    },
+    { "zstd", { 0x28, 0xb5, 0x2f, 0xfd }, 4,
+#if HAVE_ZSTD_H
+      zstd_libraries, zstd_symbols, zstd_init, zstd_step, zstd_end,
+      zstd_frame_size, zstd_decode_chunk
+#endif
+    },
+  };
+
+/* Compressed input not yet decoded, or for uncompressed input the
+   bytes read while looking for a magic number.  */
+static unsigned char *inbuf;
+static idx_t inbuf_size;
+static unsigned char const *inptr;
+static idx_t inlen;
+
+/* True if the input file is at end of file.  */
+static bool ineof;
+
+/* The decoder for the current file, or null if it is not compressed.  */
+static struct decoder *decoder;
+
+/* True if DECODER has state to be freed.  */
+static bool decoding;
+
+/* True if the decoder reached the end of a stream.  */
+static bool stream_end;
+
+/* True if no more data should be output for the current file.  */
+static bool finished;
+
+/* The number of threads to decode with, or 0 to choose automatically.  */
+idx_t decompress_threads;
+
+/* Load the library for D if possible, and return true if it can be
+   used.  Diagnose a missing library once per file.  */
+static bool
+load_decoder (struct decoder *d)
+{
+  if (!d->handle && !d->unavailable && d->step)
+    {
+      for (char const *const *lib = d->libraries; *lib; lib++)
+        {
+          d->handle = dlopen (*lib, RTLD_LAZY | RTLD_LOCAL);
+          if (d->handle)
+            break;
+        }
+      for (struct symbol const *s = d->symbols; d->handle && s->name; s++)
+        {
+          *s->addr = dlsym (d->handle, s->name);
+          if (!*s->addr)
+            {
+              dlclose (d->handle);
+              d->handle = nullptr;
+            }
+        }
+      d->unavailable = !d->handle;
+    }
+
+  if (d->handle)
+    return true;
+  input_data_error (d->name, (d->step
+                              ? _("cannot load decompression library")
+                              : _("decompression not supported")));
+  return false;
+}
+
+/* Diagnose the decoding failure S, and stop output for this file.  */
+static void
+step_error (enum step s)
+{
+  input_data_error (decoder->name,
+                    (s == STEP_TRUNCATED
+                     ? _("unexpected end of compressed data")
+                     : _("invalid compressed data")));
+  finished = true;
+}
+
+/* Return true if the pending input starts with D's magic number, as
+   far as the available input shows.  */
+static bool
+has_magic (struct decoder const *d)
+{
+  return 0 < inlen && memcmp (inptr, d->magic, MIN (inlen, d->magic_len)) == 0;
+}
+
+/* Move the pending input to the start of the compressed input buffer.  */
+static void
+compact_inbuf (void)
+{
+  if (inptr != inbuf)
+    inptr = memmove (inbuf, inptr, inlen);
+}
+
+/* Read into the compressed input buffer from FD, appending to the
+   INLEN bytes already there; the buffer must not be full.  Return the
+   number of bytes read, or -1 (setting errno) on failure.  */
+static ptrdiff_t
+fill_inbuf (int fd)
+{
+  compact_inbuf ();
+  ptrdiff_t nread = safe_read (fd, inbuf + inlen, inbuf_size - inlen);
+  if (0 < nread)
+    inlen += nread;
+  else if (nread == 0)
+    ineof = true;
+  return nread;
+}
+
+#if HAVE_DECOMPRESS_THREADS
+
+/* The worker thread pool.  POOL_LOCK protects the queue of chunks
+   awaiting a worker, and each chunk's DONE member.  */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static struct chunk *todo;
+static struct chunk **todo_tail = &todo;
+static idx_t nworkers;
+
+/* The chunks of the current file not yet wholly returned, in input
+   order, and how many there are.  Only the main thread uses these.  */
+static struct chunk *pipeline;
+static struct chunk **pipeline_tail = &pipeline;
+static idx_t pipeline_len;
+
+/* True if the current file is being decoded in parallel, and if
+   its input is still being split into chunks.  */
+static bool parallel;
+static bool splitting;
+
+static void *
+worker (void *arg)
+{
+  pthread_mutex_lock (&pool_lock);
+  while (true)
+    {
+      while (!todo)
+        pthread_cond_wait (&pool_work, &pool_lock);
+      struct chunk *c = todo;
+      todo = c->next_todo;
+      if (!todo)
+        todo_tail = &todo;
+      pthread_mutex_unlock (&pool_lock);
+
+      c->status = c->decoder->decode_chunk (c);
+
+      pthread_mutex_lock (&pool_lock);
+      c->done = true;
+      pthread_cond_broadcast (&pool_done);
+    }
+  return nullptr;
+}
+
+/* Start the worker threads if not already started, and return how
+   many there are.  */
+static idx_t
+start_workers (void)
+{
+  idx_t nthreads = decompress_threads;
+  if (nthreads == 0)
+    {
+      /* Default to one thread per processor, but not so many that
+         the chunks in flight use too much memory.  */
+      long int nprocs = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+      nprocs = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+      nthreads = MAX (1, MIN (nprocs, 16));
+    }
+
+  for (; nworkers < nthreads; nworkers++)
+    {
+      pthread_t thread;
+      if (pthread_create (&thread, nullptr, worker, nullptr) != 0)
+        break;
+      pthread_detach (thread);
+    }
+  return nworkers;
+}
+
+/* Return true if C has been decoded.  */
+static bool
+chunk_done (struct chunk *c)
+{
+  pthread_mutex_lock (&pool_lock);
+  bool done = c->done;
+  pthread_mutex_unlock (&pool_lock);
+  return done;
+}
+
+/* Wait until C has been decoded.  */
+static void
+wait_for_chunk (struct chunk *c)
+{
+  pthread_mutex_lock (&pool_lock);
+  while (!c->done)
+    pthread_cond_wait (&pool_done, &pool_lock);
+  pthread_mutex_unlock (&pool_lock);
+}
+
+/* Remove the first chunk from the pipeline; it must have been decoded.  */
+static void
+pop_chunk (void)
+{
+  struct chunk *c = pipeline;
+  pipeline = c->next;
+  if (!pipeline)
+    pipeline_tail = &pipeline;
+  pipeline_len--;
+  if (HUGE_PAGE_SIZE <= c->outalloc)
+    {
+      stats.buffers++;
+      stats.advised_buffers += c->huge;
+    }
+  free (c->in);
+  alignfree (c->out);
+  free (c);
+}
+
+/* Discard the chunks of the current file.  */
+static void
+discard_chunks (void)
+{
+  while (pipeline)
+    {
+      wait_for_chunk (pipeline);
+      pop_chunk ();
+    }
+  parallel = splitting = false;
+}
+
+/* Hand the next run of complete frames in the input from FD to a
+   worker.  Stop splitting if the rest of the input is not a run of
+   complete frames of reasonable size; the main thread decodes it.
+   Return -1 (setting errno) on a read error, 0 otherwise.  */
+static int
+split_input (int fd)
+{
+  idx_t len = 0;
+  while (len < CHUNK_SIZE)
+    {
+      idx_t size = decoder->frame_size (inptr + len, inlen - len);
+      if (0 < size)
+        len += size;
+      else if (size < 0 || ineof)
+        {
+          splitting = false;
+          break;
+        }
+      else
+        {
+          if (inlen == inbuf_size)
+            {
+              if (PARALLEL_INPUT_MAX <= inbuf_size)
+                {
+                  splitting = false;
+                  break;
+                }
+              compact_inbuf ();
+              inbuf = xpalloc (inbuf, &inbuf_size, 1, PARALLEL_INPUT_MAX, 1);
+              inptr = inbuf;
+            }
+          if (fill_inbuf (fd) < 0)
+            return -1;
+        }
+    }
+
+  if (0 < len)
+    {
+      struct chunk *c = xzalloc (sizeof *c);
+      c->decoder = decoder;
+      c->in = ximemdup (inptr, len);
+      c->insize = len;
+      inptr += len;
+      inlen -= len;
+
+      *pipeline_tail = c;
+      pipeline_tail = &c->next;
+      pipeline_len++;
+
+      pthread_mutex_lock (&pool_lock);
+      *todo_tail = c;
+      todo_tail = &c->next_todo;
+      pthread_cond_signal (&pool_work);
+      pthread_mutex_unlock (&pool_lock);
+    }
+  return 0;
+}
+
+static ptrdiff_t serial_read (int, char *, idx_t);
+
+/* Read decompressed data as with decompress_read, when decoding the
+   current file in parallel.  */
+static ptrdiff_t
+parallel_read (int fd, char *buf, idx_t size)
+{
+  while (true)
+    {
+      struct chunk *c = pipeline;
+      if (c && chunk_done (c))
+        {
+          if (c->outpos < c->outlen)
+            {
+              idx_t n = MIN (c->outlen - c->outpos, size);
+              memcpy (buf, c->out + c->outpos, n);
+              c->outpos += n;
+              return n;
+            }
+          if (c->nomem)
+            xalloc_die ();
+          if (c->status != STEP_END)
+            {
+              step_error (c->status);
+              discard_chunks ();
+              return 0;
+            }
+          pop_chunk ();
+        }
+      else if (splitting && pipeline_len < nworkers + 2)
+        {
+          if (split_input (fd) < 0)
+            return -1;
+        }
+      else if (c)
+        wait_for_chunk (c);
+      else
+        {
+          /* Decode the rest serially, as if a stream had just ended.  */
+          parallel = false;
+          decoder->init ();
+          decoding = stream_end = true;
+          return serial_read (fd, buf, size);
+        }
+    }
+}
+
+#endif /* HAVE_DECOMPRESS_THREADS */
+
+/* Start reading the file FD, which has not been read from yet.
+   Return the compression format of its data, or -1 (setting errno)
+   on a read error.  If FD can seek, leave its offset as it was.  */
+int
+decompress_start (int fd)
+{
+#if HAVE_DECOMPRESS_THREADS
+  discard_chunks ();
+#endif
+  if (decoding)
+    decoder->end ();
+  decoding = stream_end = finished = ineof = false;
+  decoder = nullptr;
+
+  if (!inbuf)
+    {
+      inbuf_size = INBUF_SIZE;
+      inbuf = ximalloc (inbuf_size);
+    }
+  inptr = inbuf;
+  inlen = 0;
+
+  /* Peek at the magic number of a file that can seek, so that the
+     caller can still seek in it and the data is read from where it
+     is.  Read enough of any other file to see the longest magic
+     number, even from a pipe.  */
+  off_t pos = lseek (fd, 0, SEEK_CUR);
+  if (0 <= pos)
+    {
+      ptrdiff_t n;
+      do
+        n = pread (fd, inbuf, MAGIC_MAX, pos);
+      while (n < 0 && errno == EINTR);
+      if (n < 0)
+        return -1;
+      inlen = n;
+    }
+  else
+    while (inlen < MAGIC_MAX && !ineof)
+      if (fill_inbuf (fd) < 0)
+        return -1;
+
+  int compression = COMPRESSION_NONE;
+  for (int i = 0; i < sizeof decoders / sizeof *decoders; i++)
+    if (decoders[i].magic_len <= inlen
+        && memcmp (inbuf, decoders[i].magic, decoders[i].magic_len) == 0)
+      {
+        decoder = &decoders[i];
+        if (!load_decoder (decoder))
+          finished = true;
+#if HAVE_DECOMPRESS_THREADS
+        else if (decoder->frame_size && decompress_threads != 1
+                 && 0 <= decoder->frame_size (inptr, inlen)
+                 && 1 < start_workers ())
+          parallel = splitting = true;
+#endif
+        else
+          {
+            decoder->init ();
+            decoding = true;
+          }
+        compression = i + 1;
+        break;
+      }
+
+  if (0 <= pos)
+    inlen = 0;
+  return compression;
+}
+
+/* Read decompressed data as with decompress_read, when decoding the
+   current file in the main thread.  */
+static ptrdiff_t
+serial_read (int fd, char *buf, idx_t size)
+{
+  idx_t outlen = 0;
+
+  while (!finished && outlen < size)
+    {
+      /* Read more input only if it is needed to make progress, so
+         that output already decoded is not held up by a slow pipe.  */
+      if (inlen == 0 && !ineof)
+        {
+          if (0 < outlen)
+            break;
+          if (fill_inbuf (fd) < 0)
+            return -1;
+          continue;
+        }
+
+      if (stream_end)
+        {
+          /* Another stream may follow, as in concatenated gzip files.
+             Trailing garbage is ignored, as gzip -d does.  */
+          if (inlen < decoder->magic_len && !ineof)
+            {
+              if (0 < outlen)
+                break;
+              if (fill_inbuf (fd) < 0)
+                return -1;
+              continue;
+            }
+          if (!has_magic (decoder))
+            {
+              finished = true;
+              break;
+            }
+          decoder->end ();
+          decoder->init ();
+          stream_end = false;
+        }
+
+      idx_t n;
+      enum step s = decoder->step (&inptr, &inlen, ineof,
+                                   buf + outlen, size - outlen, &n);
+      outlen += n;
+      if (s == STEP_END)
+        stream_end = true;
+      else if (s != STEP_OK)
+        step_error (s);
+    }
+
+  return outlen;
+}
+
+/* Read up to SIZE bytes of decompressed data from FD into BUF, as
+   with safe_read.  Uncompressed data is passed through unchanged.
+   Corrupt or truncated compressed data is diagnosed and treated as
+   the end of the file.  */
+ptrdiff_t
+decompress_read (int fd, char *buf, idx_t size)
+{
+  if (!decoder)
+    {
+      if (inlen == 0)
+        return safe_read (fd, buf, size);
+      idx_t n = MIN (inlen, size);
+      memcpy (buf, inptr, n);
+      inptr += n;
+      inlen -= n;
+      return n;
+    }
+
+  if (finished)
+    return 0;
+#if HAVE_DECOMPRESS_THREADS
+  if (parallel)
+    return parallel_read (fd, buf, size);
+#endif
+  return serial_read (fd, buf, size);
+}
@@ -0,0 +1,36 @@
+/* decompress.h - transparent decompression of grep's input.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef GREP_DECOMPRESS_H
+#define GREP_DECOMPRESS_H 1
+
+#include <idx.h>
+
+/* Input formats recognized by --decompress.  */
+enum compression
+  {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_BZIP2,
+    COMPRESSION_XZ,
+    COMPRESSION_ZSTD
+  };
+
+extern idx_t decompress_threads;
+extern int decompress_start (int);
+extern ptrdiff_t decompress_read (int, char *, idx_t);
+
+#endif
@@ -21,9 +21,96 @@
 #include <search.h>
 #include "die.h"
 #include <error.h>
+#include "probes.h"
+
+#if HAVE_MALLINFO2
+# include <malloc.h>
+#endif
+
+/* Keeping the DFA's memory within a limit.  The DFA builds its states
+   lazily, as the input calls for them, and keeps them, so for some
+   patterns, such as (a|b)*a(a|b){20}, it can grow until memory runs
+   out.  Each byte searched adds at most one state, of up to about
+   DFA_GROWTH_PER_BYTE bytes for typical patterns, so after searching
+   that many times fewer bytes than the limit, but no fewer than
+   DFA_MEASURE_MIN, see how much the heap has grown while searching
+   since the DFA was built.  Measuring takes a while, so it is done
+   only then and once at each end of the search of a file; growth
+   between files, as of the decompressor or the caller's buffers, is
+   not the DFA's and is not counted, but growth during a search
+   is all counted, as no measurement brackets each call.  If the
+   growth is past the limit, rebuild the DFA from scratch, freeing its
+   states.  If it reaches the limit DFA_THRASH_FLUSHES times in a row
+   after searching fewer than one byte per DFA_THRASH_RATIO bytes of the
+   limit, it is building a state for nearly every byte and gains nothing
+   over regex, so use regex for the rest of the file.  */
+enum { DFA_GROWTH_PER_BYTE = 1024 };
+enum { DFA_MEASURE_MIN = 4096 };
+enum { DFA_THRASH_FLUSHES = 2 };
+enum { DFA_THRASH_RATIO = 64 };
+
+/* After each ADAPT_WINDOW bytes, EGexecute reconsiders whether to
+   search for fixed strings before running the DFA.  If in the last
+   window the DFA rejected a fixed-string candidate every ADAPT_SPACING
+   bytes or more often, the round trips between the two cost more than
+   the skipping saves, so run the DFA over everything instead, and try
+   the fixed strings again after a number of windows that doubles, up
+   to ADAPT_BACKOFF_MAX, each time they turn out no better.  */
+enum { ADAPT_WINDOW = 1 << 16 };
+enum { ADAPT_SPACING = 1 << 8 };
+enum { ADAPT_BACKOFF_MAX = 1 << 6 };
+
+struct adapt
+{
+  /* The current strategy; the bytes searched and the candidates
+     rejected in this window; the windows to wait before trying
+     STRATEGY_KWSET again, and how many to wait next time.  */
+  enum strategy strategy;
+  idx_t scanned;
+  idx_t rejected;
+  int wait;
+  int backoff;
+};
+
+struct dfa_budget
+{
+  /* The limit, or 0 for none, and the bytes to search between
+     measurements.  */
+  idx_t limit;
+  idx_t interval;
+
+  /* What the DFA was parsed from, and how, for rebuilding it.  */
+  char *pattern;
+  idx_t size;
+  struct localeinfo const *localeinfo;
+  reg_syntax_t syntax_bits;
+  int dfaopts;
+
+  /* All the patterns without back-references, for regex to match if
+     the DFA thrashes, or null if regex already has them.  */
+  char *regex;
+  idx_t regex_size;
+
+  /* The heap growth during searches since the DFA was built, as of
+     the last measurement; the heap in use then, or -1 if the next
+     search starts a file and is to measure it; the bytes searched
+     since the DFA was built, and of those, the bytes searched since
+     the heap was last measured; how many times in a row the DFA has
+     reached the limit quickly; and whether regex is used instead of
+     the DFA for the rest of the file.  */
+  idx_t growth;
+  idx_t heap_mark;
+  idx_t scanned;
+  idx_t unmeasured;
+  int quick_flushes;
+  bool fallback;
+};
 
 struct dfa_comp
 {
+  /* The options the patterns were compiled with.  */
+  struct matchopts opts;
+
   /* KWset compiled pattern.  For GEAcompile, we compile
      a list of strings, at least one of which is known to occur in
      any string matching the regexp. */
@@ -37,12 +124,56 @@ struct dfa_comp
   idx_t pcount;
   struct re_registers regs;
 
+  /* Whether PATTERNS[0] holds all the patterns compiled together.
+     Otherwise the storage for PATTERNS starts at PATTERNS[-1].  */
+  bool patterns_whole;
+
+  /* The back-reference matcher tried before PATTERNS[I], if any, is
+     BACKREFS[I - PATTERNS_WHOLE]; it is null if the matcher declined
+     the pattern.  BACKREFS is null with --engine=regex.  */
+  struct backref **backrefs;
+
   /* Number of compiled fixed strings known to exactly match the regexp.
      If kwsexec returns < kwset_exact_matches, then we don't need to
      call the regexp matcher at all. */
   idx_t kwset_exact_matches;
 
   bool begline;
+
+  /* Whether DFA matches the bytes of UTF-8 text, one at a time.  */
+  bool utf8_bytes;
+
+  /* The character boundaries in the buffer being searched.  */
+  struct mb_bounds bounds;
+
+  /* The DFA's memory limit.  */
+  struct dfa_budget budget;
+
+  /* How candidate lines are found.  */
+  struct adapt adapt;
+
+  /* If not null, what decides whether a line matches around each
+     KWset hit, instead of the DFA.  */
+  struct inner *inner;
+
+  /* For --explain: the string given to KWSET, or null if none; the
+     number of strings given to KWSET instead, if any, and one of
+     them; the number of patterns with possible back-references, how
+     many of these the back-reference matcher accepted, and the first
+     of them and its length.  */
+  char *must;
+  idx_t nliterals;
+  char *literal;
+  idx_t backref_patterns;
+  idx_t backref_matchers;
+  char const *backref_pattern;
+  idx_t backref_pattern_len;
+
+  /* For --pattern-profile: the calls to regex and to the back-reference
+     matcher made for all the patterns without back-references together,
+     in COSTS[0], and for the pattern PATTERNS[I] otherwise, in
+     COSTS[I + 1 - PATTERNS_WHOLE].  */
+  struct pattern_cost *costs;
 };
 
 void
@@ -57,17 +188,47 @@ dfawarn (char const *mesg)
   error (0, 0, _("warning: %s"), mesg);
 }
 
+/* Return the number of bytes of heap in use, or -1 if this cannot be
+   measured.  */
+idx_t
+heap_in_use (void)
+{
+#if HAVE_MALLINFO2
+  struct mallinfo2 mi = mallinfo2 ();
+  return MIN (mi.uordblks + mi.hblkhd, IDX_MAX);
+#else
+  return -1;
+#endif
+}
+
 /* If the DFA turns out to have some set of fixed strings one of
    which must occur in the match, then we build a kwset matcher
    to find those strings, and thus quickly filter out impossible
-   matches. */
+   matches.  Otherwise, look in the SIZE bytes of KEYS, the patterns
+   in the syntax SYNTAX_BITS, for a set of strings one of which every
+   match contains.  */
 static void
-kwsmusts (struct dfa_comp *dc)
+kwsmusts (struct dfa_comp *dc, char const *keys, idx_t size,
+          reg_syntax_t syntax_bits)
 {
   struct dfamust *dm = dfamust (dc->dfa);
   if (!dm)
-    return;
-  dc->kwset = kwsinit (false);
+    {
+      idx_t n;
+      struct literal *lits = required_literals (keys, size, syntax_bits, &n);
+      if (!lits)
+        return;
+      dc->kwset = kwsinit (dc->utf8_bytes, dc->opts.icase);
+      for (idx_t i = 0; i < n; i++)
+        kwsincr (dc->kwset, lits[i].str, lits[i].len);
+      kwsprep (dc->kwset);
+      dc->nliterals = n;
+      dc->literal = xstrdup (lits[0].str);
+      free_literals (lits, n);
+      return;
+    }
+  dc->kwset = kwsinit (dc->utf8_bytes, dc->opts.icase);
+  dc->must = xstrdup (dm->must);
   if (dm->exact)
     {
       /* Prepare a substring whose presence implies a match.
@@ -78,12 +239,12 @@ kwsmusts (struct dfa_comp *dc)
       idx_t new_len = old_len + dm->begline + dm->endline;
       char *must = ximalloc (new_len);
       char *mp = must;
-      *mp = eolbyte;
+      *mp = dc->opts.eol;
       mp += dm->begline;
       dc->begline |= dm->begline;
       memcpy (mp, dm->must, old_len);
       if (dm->endline)
-        mp[old_len] = eolbyte;
+        mp[old_len] = dc->opts.eol;
       kwsincr (dc->kwset, must, new_len);
       free (must);
     }
@@ -137,6 +298,41 @@ possible_backrefs_in_pattern (char const *keys, idx_t len, bool bs_safe)
   return false;
 }
 
+/* In a UTF-8 locale, the DFA matches sets of characters that include
+   non-ASCII characters slowly, or leaves them to regex.  If the SIZE
+   bytes of PATTERN, in the syntax SYNTAX_BITS, have any such sets,
+   and can be matched one byte at a time instead, switch DC to a DFA
+   that does so.  DFAOPTS are the options for the DFA.  */
+static void
+use_utf8_bytes (struct dfa_comp *dc, char const *pattern, idx_t size,
+                reg_syntax_t syntax_bits, int dfaopts)
+{
+  idx_t bytesize;
+  char *bytes = utf8_byte_pattern (pattern, size, syntax_bits, &bytesize);
+  if (!bytes)
+    return;
+
+  /* PATTERN has already been diagnosed, so do not warn again.  */
+  struct dfa *dfa = dfaalloc ();
+  dfasyntax (dfa, utf8_byte_localeinfo (), syntax_bits,
+             dfaopts & DFA_EOL_NUL);
+  dfaparse (bytes, bytesize, dfa);
+  if (dc->budget.limit)
+    {
+      free (dc->budget.pattern);
+      dc->budget.pattern = bytes;
+      dc->budget.size = bytesize;
+      dc->budget.localeinfo = utf8_byte_localeinfo ();
+    }
+  else
+    free (bytes);
+
+  dfafree (dc->dfa);
+  free (dc->dfa);
+  dc->dfa = dfa;
+  dc->utf8_bytes = true;
+}
+
 static bool
 regex_compile (struct dfa_comp *dc, char const *p, idx_t len,
                idx_t pcount, idx_t lineno, reg_syntax_t syntax_bits,
@@ -149,7 +345,8 @@ regex_compile (struct dfa_comp *dc, char const *p, idx_t len,
   /* Do not use a fastmap with -i, to work around glibc Bug#20381.  */
   static_assert (UCHAR_MAX < IDX_MAX);
   idx_t uchar_max = UCHAR_MAX;
-  pat.fastmap = syntax_only | match_icase ? nullptr : ximalloc (uchar_max + 1);
+  pat.fastmap = (syntax_only | dc->opts.icase
+                 ? nullptr : ximalloc (uchar_max + 1));
 
   pat.translate = nullptr;
 
@@ -177,35 +374,42 @@ regex_compile (struct dfa_comp *dc, char const *p, idx_t len,
     = lineno < 0 ? "" : pattern_file_name (lineno, &pat_lineno);
 
   if (*pat_filename == '\0')
-    error (0, 0, "%s", err);
+    die_report ("%s", err);
   else
     {
       ptrdiff_t n = pat_lineno;
-      error (0, 0, "%s:%td: %s", pat_filename, n, err);
+      die_report ("%s:%td: %s", pat_filename, n, err);
     }
 
   return false;
 }
 
 /* Compile PATTERN, containing SIZE bytes that are followed by '\n'.
-   SYNTAX_BITS specifies whether PATTERN uses style -G, -E, or -A.
-   Return a description of the compiled pattern.  */
+   SYNTAX_BITS specifies whether PATTERN uses style -G, -E, or -A,
+   and OPTS the options to match with.  Return a description of the
+   compiled pattern.  */
 
 void *
 GEAcompile (char *pattern, idx_t size, reg_syntax_t syntax_bits,
-            bool exact)
+            bool exact, struct matchopts const *opts)
 {
   char *motif;
+  char *keys = pattern;
+  idx_t keycc = size;
   struct dfa_comp *dc = xcalloc (1, sizeof (*dc));
+  dc->opts = *opts;
 
   dc->dfa = dfaalloc ();
 
-  if (match_icase)
+  if (dc->opts.icase)
     syntax_bits |= RE_ICASE;
-  int dfaopts = (DFA_CONFUSING_BRACKETS_ERROR | DFA_STRAY_BACKSLASH_WARN
-                 | DFA_PLUS_WARN
-                 | (syntax_bits & RE_CONTEXT_INDEP_OPS ? DFA_STAR_WARN : 0)
-                 | (eolbyte ? 0 : DFA_EOL_NUL));
+  int dfaopts = (DFA_CONFUSING_BRACKETS_ERROR
+                 | (dc->opts.quiet
+                    ? 0
+                    : (DFA_STRAY_BACKSLASH_WARN | DFA_PLUS_WARN
+                       | (syntax_bits & RE_CONTEXT_INDEP_OPS
+                          ? DFA_STAR_WARN : 0)))
+                 | (dc->opts.eol ? 0 : DFA_EOL_NUL));
   dfasyntax (dc->dfa, &localeinfo, syntax_bits, dfaopts);
   bool bs_safe = !localeinfo.multibyte | localeinfo.using_utf8;
 
@@ -221,6 +425,11 @@ GEAcompile (char *pattern, idx_t size, reg_syntax_t syntax_bits,
   dc->patterns++;
   dc->pcount = 0;
   idx_t palloc = 1;
+  idx_t backrefs_alloc = 0;
+  idx_t costs_alloc = 0;
+  dc->costs = xpalloc (nullptr, &costs_alloc, 1, -1, sizeof *dc->costs);
+  dc->costs[0] = (struct pattern_cost) { .lineno = -1 };
+  libgrep_compiling (dc, GEAfree);
 
   char const *prev = pattern;
 
@@ -238,6 +447,12 @@ GEAcompile (char *pattern, idx_t size, reg_syntax_t syntax_bits,
 
       bool backref = possible_backrefs_in_pattern (p, len, bs_safe);
 
+      if (backref && !dc->backref_patterns++)
+        {
+          dc->backref_pattern = p;
+          dc->backref_pattern_len = len;
+        }
+
       if (backref && prev < p)
         {
           idx_t prevlen = p - prev;
@@ -262,12 +477,25 @@ GEAcompile (char *pattern, idx_t size, reg_syntax_t syntax_bits,
       if (!regex_compile (dc, p, len, dc->pcount, lineno, syntax_bits,
                           !backref))
         compilation_failed = true;
+      else if (backref && !dc->opts.regex_only)
+        {
+          if (dc->pcount == backrefs_alloc)
+            dc->backrefs = xpalloc (dc->backrefs, &backrefs_alloc, 1, -1,
+                                    sizeof *dc->backrefs);
+          dc->backrefs[dc->pcount] = backref_compile (p, len, syntax_bits);
+          dc->backref_matchers += !!dc->backrefs[dc->pcount];
+        }
 
       p = sep + 1;
       lineno++;
 
       if (backref)
         {
+          if (dc->pcount + 1 == costs_alloc)
+            dc->costs = xpalloc (dc->costs, &costs_alloc, 1, -1,
+                                 sizeof *dc->costs);
+          dc->costs[dc->pcount + 1]
+            = (struct pattern_cost) { .lineno = lineno - 1 };
           dc->pcount++;
           prev = p;
         }
@@ -275,7 +503,10 @@ GEAcompile (char *pattern, idx_t size, reg_syntax_t syntax_bits,
   while (p <= patlim);
 
   if (compilation_failed)
-    exit (EXIT_TROUBLE);
+    {
+      free (buf);
+      die_reported (EXIT_TROUBLE);
+    }
 
   if (patlim < prev)
     buflen--;
@@ -291,12 +522,14 @@ GEAcompile (char *pattern, idx_t size, reg_syntax_t syntax_bits,
       buf = pattern;
       buflen = size;
     }
+  if (buf != keys)
+    libgrep_compiling (buf, free);
 
-  /* In the match_words and match_lines cases, we use a different pattern
+  /* In the -w and -x cases, we use a different pattern
      for the DFA matcher that will quickly throw out cases that won't work.
      Then if DFA succeeds we do some hairy stuff using the regex matcher
      to decide whether the match should really count. */
-  if (match_words || match_lines)
+  if (dc->opts.words || dc->opts.lines)
     {
       static char const line_beg_no_bk[] = "^(";
       static char const line_end_no_bk[] = ")$";
@@ -310,36 +543,76 @@ GEAcompile (char *pattern, idx_t size, reg_syntax_t syntax_bits,
       idx_t bracket_bytes = sizeof word_beg_bk - 1 + sizeof word_end_bk;
       char *n = ximalloc (size + bracket_bytes);
 
-      strcpy (n, match_lines ? (bk ? line_beg_bk : line_beg_no_bk)
+      strcpy (n, dc->opts.lines ? (bk ? line_beg_bk : line_beg_no_bk)
                              : (bk ? word_beg_bk : word_beg_no_bk));
       idx_t total = strlen (n);
       memcpy (n + total, pattern, size);
       total += size;
-      strcpy (n + total, match_lines ? (bk ? line_end_bk : line_end_no_bk)
+      strcpy (n + total, dc->opts.lines ? (bk ? line_end_bk : line_end_no_bk)
                                      : (bk ? word_end_bk : word_end_no_bk));
       total += strlen (n + total);
       pattern = motif = n;
       size = total;
+      libgrep_compiling (motif, free);
     }
   else
     motif = nullptr;
 
   dfaparse (pattern, size, dc->dfa);
-  kwsmusts (dc);
+  if (dc->opts.dfa_memory && !dc->opts.regex_only && 0 <= heap_in_use ())
+    {
+      /* Keep what rebuilding the DFA takes, leaving out the options
+         that would diagnose PATTERN again.  */
+      struct dfa_budget *b = &dc->budget;
+      b->limit = dc->opts.dfa_memory;
+      b->heap_mark = -1;
+      b->interval = MAX (b->limit / DFA_GROWTH_PER_BYTE, DFA_MEASURE_MIN);
+      b->pattern = ximemdup (pattern, size);
+      b->size = size;
+      b->localeinfo = &localeinfo;
+      b->syntax_bits = syntax_bits;
+      b->dfaopts = dfaopts & DFA_EOL_NUL;
+    }
+  /* With -w the DFA only approximates a match, which wordchar_prev
+     and wordchar_next then check; but a byte DFA is exact, and its
+     [^[:alnum:]_] would not match an encoding error next to a word,
+     which those functions count as a word boundary.  */
+  if (localeinfo.using_utf8 && !dc->opts.regex_only && !dc->backref_patterns
+      && !dc->opts.words)
+    use_utf8_bytes (dc, pattern, size, syntax_bits, dfaopts);
+  kwsmusts (dc, keys, keycc, syntax_bits);
   dfacomp (nullptr, 0, dc->dfa, 1);
+  libgrep_compiled (dc);
+  if (dc->must && !dc->kwset_exact_matches && !dc->begline
+      && !dc->opts.words && !dc->opts.lines && !dc->opts.regex_only
+      && !dc->backref_patterns && !memchr (keys, '\n', keycc))
+    dc->inner = inner_compile (keys, keycc, syntax_bits, dc->must);
+  dc->adapt.strategy = (dc->kwset ? STRATEGY_KWSET
+                        : dfasuperset (dc->dfa) ? STRATEGY_SUPERSET
+                        : STRATEGY_DFA);
+  dc->adapt.backoff = 1;
 
   if (buf)
     {
-      if (exact || !dfasupported (dc->dfa))
+      if (exact || dc->opts.regex_only || !dfasupported (dc->dfa))
         {
           dc->patterns--;
           dc->pcount++;
+          dc->patterns_whole = true;
 
           if (!regex_compile (dc, buf, buflen, 0, -1, syntax_bits, false))
             abort ();
         }
+      else if (dc->budget.limit)
+        {
+          /* Keep the patterns for regex, in case the DFA thrashes.  */
+          dc->budget.regex = buf == keys ? ximemdup (buf, buflen) : buf;
+          dc->budget.regex_size = buflen;
+          buf = keys;
+        }
 
-      if (buf != pattern)
+      /* Compare with KEYS, not PATTERN, which may now be MOTIF.  */
+      if (buf != keys)
         free (buf);
     }
 
@@ -348,48 +621,250 @@ GEAcompile (char *pattern, idx_t size, reg_syntax_t syntax_bits,
   return dc;
 }
 
+/* Rebuild the DFA of DC from scratch, freeing the states it built.  */
+static void
+dfa_rebuild (struct dfa_comp *dc)
+{
+  struct dfa_budget *b = &dc->budget;
+  dfafree (dc->dfa);
+  dfasyntax (dc->dfa, b->localeinfo, b->syntax_bits, b->dfaopts);
+  dfaparse (b->pattern, b->size, dc->dfa);
+  dfacomp (nullptr, 0, dc->dfa, 1);
+  b->growth = 0;
+  b->heap_mark = heap_in_use ();
+  b->scanned = 0;
+}
+
+/* See whether the DFA of DC has grown past its limit since it was
+   built, and if so rebuild it, or give up on it if it is thrashing.  */
+static void
+dfa_measure (struct dfa_comp *dc)
+{
+  struct dfa_budget *b = &dc->budget;
+  b->scanned += b->unmeasured;
+  b->unmeasured = 0;
+  idx_t heap = heap_in_use ();
+  b->growth += heap - b->heap_mark;
+  b->heap_mark = heap;
+  if (stats.dfa_memory_peak < b->growth)
+    stats.dfa_memory_peak = b->growth;
+  if (b->growth <= b->limit)
+    return;
+
+  bool quick = b->scanned < b->limit / DFA_THRASH_RATIO;
+  b->quick_flushes = quick ? b->quick_flushes + 1 : 0;
+  dfa_rebuild (dc);
+  stats.dfa_flushes++;
+  if (b->quick_flushes < DFA_THRASH_FLUSHES)
+    return;
+
+  /* Match every line with regex, as --engine=regex does.  */
+  if (b->regex)
+    {
+      dc->patterns--;
+      dc->pcount++;
+      dc->patterns_whole = true;
+      if (!regex_compile (dc, b->regex, b->regex_size, 0, -1,
+                          b->syntax_bits, false))
+        abort ();
+    }
+  dc->opts.regex_only = true;
+  b->fallback = true;
+  stats.dfa_fallbacks++;
+}
+
+/* Prepare the compiled pattern VDC for searching another file, giving
+   its DFA another chance if it gave way to regex in the last one.  */
+void
+GEAreset (void *vdc)
+{
+  struct dfa_comp *dc = vdc;
+  struct dfa_budget *b = &dc->budget;
+  if (0 <= b->heap_mark)
+    {
+      /* Count the growth since the last measurement, and leave out
+         what the caller allocates before the next search.  */
+      b->growth += heap_in_use () - b->heap_mark;
+      b->heap_mark = -1;
+    }
+  if (!b->fallback)
+    return;
+
+  if (b->regex)
+    {
+      regfree (&dc->patterns[0]);
+      dc->patterns++;
+      dc->pcount--;
+      dc->patterns_whole = false;
+    }
+  dc->opts.regex_only = false;
+  b->fallback = false;
+  b->quick_flushes = 0;
+}
+
+/* The line being searched by the back-reference matcher: its start,
+   the end of its text, and its character boundaries.  */
+struct backref_line
+{
+  char const *beg;
+  char const *lim;
+  struct mb_bounds *bounds;
+};
+
+/* Return true if the bytes from I to J of the line ARG form a word,
+   as -w requires.  */
+static bool
+backref_word (void *arg, idx_t i, idx_t j)
+{
+  struct backref_line const *line = arg;
+  return (! wordchar_next (line->beg + j, line->lim)
+          && ! wordchar_prev (line->beg, line->beg + i, line->lim,
+                              line->bounds));
+}
+
+/* Return true if the bytes from I to J of the line ARG end it, as -x
+   requires of a match that starts it.  */
+static bool
+backref_whole (void *arg, _GL_UNUSED idx_t i, idx_t j)
+{
+  struct backref_line const *line = arg;
+  return line->beg + j == line->lim;
+}
+
+/* Note that DC has searched SCANNED more bytes, and whether the DFA
+   REJECTED a fixed-string candidate in them.  At the end of a window,
+   choose the strategy for the next one.  */
+static void
+adapt_strategy (struct dfa_comp *dc, idx_t scanned, bool rejected)
+{
+  struct adapt *a = &dc->adapt;
+  a->scanned += scanned;
+  a->rejected += rejected;
+  if (a->scanned < ADAPT_WINDOW)
+    return;
+
+  stats.strategy_windows[a->strategy]++;
+  enum strategy strategy = a->strategy;
+  enum strategy without_kwset = (dfasuperset (dc->dfa)
+                                 ? STRATEGY_SUPERSET : STRATEGY_DFA);
+
+  /* Without fixed strings there is no choice, and a slow DFA needs
+     them whatever they cost.  */
+  if (!dc->kwset)
+    strategy = without_kwset;
+  else if (!dfaisfast (dc->dfa))
+    strategy = STRATEGY_KWSET;
+  else if (strategy == STRATEGY_KWSET)
+    {
+      if (a->scanned <= a->rejected * ADAPT_SPACING)
+        {
+          strategy = without_kwset;
+          a->wait = a->backoff;
+          a->backoff = MIN (2 * a->backoff, ADAPT_BACKOFF_MAX);
+        }
+      else
+        a->backoff = 1;
+    }
+  else if (--a->wait <= 0)
+    strategy = STRATEGY_KWSET;
+
+  if (strategy != a->strategy)
+    {
+      a->strategy = strategy;
+      stats.strategy_switches++;
+    }
+  a->scanned = a->rejected = 0;
+}
+
 ptrdiff_t
 EGexecute (void *vdc, char const *buf, idx_t size, idx_t *match_size,
            char const *start_ptr)
 {
   char const *buflim, *beg, *end, *ptr, *match, *best_match, *mb_start;
-  char eol = eolbyte;
   regoff_t start;
   idx_t len, best_len;
   struct kwsmatch kwsm;
   idx_t i;
   struct dfa_comp *dc = vdc;
+  char eol = dc->opts.eol;
   struct dfa *superset = dfasuperset (dc->dfa);
   bool dfafast = dfaisfast (dc->dfa);
+  bool kwset_candidate = false;
+
+  /* The line checked by DC->inner, if it is in BUF.  */
+  char const *inner_beg = nullptr, *inner_lim = buf;
 
   mb_start = buf;
   buflim = buf + size;
+  if (localeinfo.multibyte & !localeinfo.using_utf8)
+    mb_bounds_reset (&dc->bounds, buf, buflim);
+  if (dc->budget.limit && dc->budget.heap_mark < 0)
+    dc->budget.heap_mark = heap_in_use ();
 
   for (beg = end = buf; end < buflim; beg = end)
     {
       end = buflim;
 
-      if (!start_ptr)
+      if (dc->budget.limit && dc->budget.interval <= dc->budget.unmeasured)
+        {
+          dfa_measure (dc);
+          superset = dfasuperset (dc->dfa);
+        }
+
+      if (!start_ptr && !dc->opts.regex_only)
         {
-          char const *next_beg, *dfa_beg = beg;
+          char const *next_beg, *dfa_beg = beg, *scan_beg = beg;
           idx_t count = 0;
           bool exact_kwset_match = false;
+          bool kwset_hit = false;
           bool backref = false;
 
-          /* Try matching with KWset, if it's defined.  */
-          if (dc->kwset)
+          /* Try matching with KWset, if it's defined and paying off.  */
+          if (dc->kwset && dc->adapt.strategy == STRATEGY_KWSET)
             {
               char const *prev_beg;
 
               /* Find a possible match using the KWset matcher.  */
+              xtime_t start_time = stats_clock ();
               ptrdiff_t offset = kwsexec (dc->kwset, beg - dc->begline,
                                           buflim - beg + dc->begline,
                                           &kwsm, true);
+              stats_charge (PHASE_KWSET, start_time);
               if (offset < 0)
-                return offset;
+                {
+                  adapt_strategy (dc, buflim - beg, false);
+                  return offset;
+                }
+              stats.kwset_candidates++;
+              kwset_candidate = kwset_hit = true;
               match = beg + offset;
+              PROBE2 (kwset__hit, match - buf, kwsm.size);
               prev_beg = beg;
 
+              if (dc->inner)
+                {
+                  /* Check the text around the hit, and if it does not
+                     match, go on to the next hit, which may be in the
+                     same line.  */
+                  if (inner_lim <= match)
+                    {
+                      inner_beg = memrchr (buf, eol, match - buf);
+                      inner_beg = inner_beg ? inner_beg + 1 : buf;
+                      inner_lim = rawmemchr (match, eol);
+                    }
+                  stats.inner_checks++;
+                  if (inner_match (dc->inner, inner_beg, match, inner_lim))
+                    {
+                      beg = inner_beg;
+                      end = inner_lim + 1;
+                      adapt_strategy (dc, end - scan_beg, false);
+                      goto success;
+                    }
+                  end = match + 1;
+                  adapt_strategy (dc, end - scan_beg, false);
+                  continue;
+                }
+
               /* Narrow down to the line containing the possible match.  */
               beg = memrchr (buf, eol, match - buf);
               beg = beg ? beg + 1 : buf;
@@ -419,11 +894,18 @@ EGexecute (void *vdc, char const *buf, idx_t size, idx_t *match_size,
               if (exact_kwset_match)
                 {
                   if (!localeinfo.multibyte | localeinfo.using_utf8)
-                    goto success;
+                    {
+                      adapt_strategy (dc, end - scan_beg, false);
+                      goto success;
+                    }
                   if (mb_start < beg)
                     mb_start = beg;
-                  if (mb_goback (&mb_start, nullptr, match, buflim) == 0)
-                    goto success;
+                  if (mb_goback (&mb_start, nullptr, match, buflim,
+                                 &dc->bounds) == 0)
+                    {
+                      adapt_strategy (dc, end - scan_beg, false);
+                      goto success;
+                    }
                   /* The matched line starts in the middle of a multibyte
                      character.  Perform the DFA search starting from the
                      beginning of the next character.  */
@@ -431,16 +913,32 @@ EGexecute (void *vdc, char const *buf, idx_t size, idx_t *match_size,
                 }
             }
 
+          /* Give the DFA few enough bytes at a time that its memory
+             can be measured often enough.  */
+          if (dc->budget.limit && !exact_kwset_match
+              && dc->budget.interval < end - dfa_beg)
+            {
+              end = rawmemchr (dfa_beg + dc->budget.interval, eol);
+              end++;
+            }
+
           /* Try matching with the superset of DFA, if it's defined.  */
           if (superset && !exact_kwset_match)
             {
               /* Keep using the superset while it reports multiline
                  potential matches; this is more likely to be fast
                  than falling back to KWset would be.  */
+              xtime_t start_time = stats_clock ();
               next_beg = dfaexec (superset, dfa_beg, (char *) end, 0,
                                   &count, nullptr);
+              stats_charge (PHASE_DFA, start_time);
+              stats.dfaexec_calls++;
+              dc->budget.unmeasured += end - dfa_beg;
               if (!next_beg || next_beg == end)
-                continue;
+                {
+                  adapt_strategy (dc, end - scan_beg, kwset_hit);
+                  continue;
+                }
 
               /* Narrow down to the line we've found.  */
               if (count != 0)
@@ -456,13 +954,20 @@ EGexecute (void *vdc, char const *buf, idx_t size, idx_t *match_size,
             }
 
           /* Try matching with DFA.  */
+          xtime_t start_time = stats_clock ();
           next_beg = dfaexec (dc->dfa, dfa_beg, (char *) end, 0, &count,
                               &backref);
+          stats_charge (PHASE_DFA, start_time);
+          stats.dfaexec_calls++;
+          dc->budget.unmeasured += end - dfa_beg;
 
           /* If there's no match, or if we've matched the sentinel,
              we're done.  */
           if (!next_beg || next_beg == end)
-            continue;
+            {
+              adapt_strategy (dc, end - scan_beg, kwset_hit);
+              continue;
+            }
 
           /* Narrow down to the line we've found.  */
           if (count != 0)
@@ -472,18 +977,27 @@ EGexecute (void *vdc, char const *buf, idx_t size, idx_t *match_size,
             }
           end = rawmemchr (next_beg, eol);
           end++;
+          adapt_strategy (dc, end - scan_beg, false);
 
           /* Successful, no back-references encountered! */
           if (!backref)
             goto success;
           ptr = beg;
         }
-      else
+      else if (start_ptr)
         {
           /* We are looking for the leftmost (then longest) exact match.
              We will go through the outer loop only once.  */
           ptr = start_ptr;
         }
+      else
+        {
+          /* --engine=regex: bypass KWset and the DFA, and try each
+             line with Regex alone.  */
+          end = rawmemchr (beg, eol);
+          end++;
+          ptr = beg;
+        }
 
       /* If the "line" is longer than the maximum regexp offset,
          die as if we've run out of memory.  */
@@ -491,14 +1005,56 @@ EGexecute (void *vdc, char const *buf, idx_t size, idx_t *match_size,
         xalloc_die ();
 
       /* Run the possible match through Regex.  */
+      PROBE3 (regex__fallback, beg - buf, end - beg, dc->pcount);
+      xtime_t regex_start_time = stats_clock ();
       best_match = end;
       best_len = 0;
       for (i = 0; i < dc->pcount; i++)
         {
+          /* Try the back-reference matcher, which is faster than
+             regex, and leave the line to regex only if it gives up.  */
+          idx_t b = i - dc->patterns_whole;
+          struct backref *br = (dc->backrefs && 0 <= b
+                                ? dc->backrefs[b] : nullptr);
+          struct pattern_cost *cost = &dc->costs[b + 1];
+          if (br)
+            {
+              bool whole = dc->opts.lines && (!start_ptr || dc->opts.words);
+              struct backref_line line = { beg, end - 1, &dc->bounds };
+              idx_t size;
+              ptrdiff_t off
+                = backref_search (br, beg, end - beg - 1, ptr - beg,
+                                  whole ? 0 : end - ptr - 1, !!start_ptr,
+                                  (whole ? backref_whole
+                                   : dc->opts.words ? backref_word
+                                   : nullptr),
+                                  &line, &size);
+              stats.backref_searches++;
+              cost->backref_calls++;
+              if (off == -1)
+                continue;
+              if (0 <= off)
+                {
+                  match = beg + off;
+                  len = size;
+                  if (match > best_match)
+                    continue;
+                  if (whole)
+                    {
+                      match = ptr;
+                      len = end - ptr;
+                    }
+                  goto assess_pattern_match;
+                }
+              stats.backref_fallbacks++;
+            }
+
           dc->patterns[i].not_eol = 0;
-          dc->patterns[i].newline_anchor = eolbyte == '\n';
+          dc->patterns[i].newline_anchor = dc->opts.eol == '\n';
           start = re_search (&dc->patterns[i], beg, end - beg - 1,
                              ptr - beg, end - ptr - 1, &dc->regs);
+          stats.re_search_calls++;
+          cost->regex_calls++;
           if (start < -1)
             xalloc_die ();
           else if (0 <= start)
@@ -507,10 +1063,10 @@ EGexecute (void *vdc, char const *buf, idx_t size, idx_t *match_size,
               match = beg + start;
               if (match > best_match)
                 continue;
-              if (start_ptr && !match_words)
+              if (start_ptr && !dc->opts.words)
                 goto assess_pattern_match;
-              if ((!match_lines && !match_words)
-                  || (match_lines && len == end - ptr - 1))
+              if ((!dc->opts.lines && !dc->opts.words)
+                  || (dc->opts.lines && len == end - ptr - 1))
                 {
                   match = ptr;
                   len = end - ptr;
@@ -523,12 +1079,13 @@ EGexecute (void *vdc, char const *buf, idx_t size, idx_t *match_size,
                  (b) Several alternatives in the pattern might be valid at a
                  given point, and we may need to consider a shorter one to
                  find a word boundary.  */
-              if (!match_lines && match_words)
+              if (!dc->opts.lines && dc->opts.words)
                 while (match <= best_match)
                   {
                     regoff_t shorter_len = 0;
                     if (! wordchar_next (match + len, end - 1)
-                        && ! wordchar_prev (beg, match, end - 1))
+                        && ! wordchar_prev (beg, match, end - 1,
+                                            &dc->bounds))
                       goto assess_pattern_match;
                     if (len > 0)
                       {
@@ -553,6 +1110,8 @@ EGexecute (void *vdc, char const *buf, idx_t size, idx_t *match_size,
                         start = re_search (&dc->patterns[i], beg, end - beg - 1,
                                            match - beg, end - match - 1,
                                            &dc->regs);
+                        stats.re_search_calls++;
+                        cost->regex_calls++;
                         if (start < 0)
                           {
                             if (start < -1)
@@ -569,6 +1128,7 @@ EGexecute (void *vdc, char const *buf, idx_t size, idx_t *match_size,
                 {
                   /* Good enough for a non-exact match.
                      No need to look at further patterns, if any.  */
+                  stats_charge (PHASE_REGEX, regex_start_time);
                   goto success;
                 }
               if (match < best_match || (match == best_match && len > best_len))
@@ -579,6 +1139,7 @@ EGexecute (void *vdc, char const *buf, idx_t size, idx_t *match_size,
                 }
             } /* if re_search >= 0 */
         } /* for Regex patterns.  */
+        stats_charge (PHASE_REGEX, regex_start_time);
         if (best_match < end)
           {
             /* We have found an exact match.  We were just
@@ -594,6 +1155,142 @@ EGexecute (void *vdc, char const *buf, idx_t size, idx_t *match_size,
  success:
   len = end - beg;
  success_in_len:;
+  stats.kwset_matches += kwset_candidate;
   *match_size = len;
   return beg - buf;
 }
+
+/* Return the number of lines in the buffer BUF of size SIZE that
+   match the compiled pattern VDC, or -1 if this cannot be counted
+   faster than by calling EGexecute for each line.  BUF must end in a
+   line terminator.  */
+ptrdiff_t
+GEAcount (void *vdc, char const *buf, idx_t size)
+{
+  struct dfa_comp *dc = vdc;
+
+  /* Only a KWset whose every hit is a match will do.  */
+  if (!dc->kwset || !dc->kwset_exact_matches || dc->opts.regex_only
+      || (localeinfo.multibyte & !localeinfo.using_utf8))
+    return -1;
+
+  /* Skip to the next line after each hit, without locating the start
+     of this one.  With a must that begins a line, a hit starts with
+     the line terminator before the line.  */
+  char eol = dc->opts.eol;
+  char const *lim = buf + size;
+  ptrdiff_t count = 0;
+  xtime_t start_time = stats_clock ();
+  for (char const *beg = buf; beg < lim; count++)
+    {
+      struct kwsmatch kwsm;
+      ptrdiff_t offset = kwsexec (dc->kwset, beg - dc->begline,
+                                  lim - beg + dc->begline, &kwsm, false);
+      if (offset < 0)
+        break;
+      beg = rawmemchr (beg + offset, eol) + 1;
+    }
+  stats_charge (PHASE_KWSET, start_time);
+  stats.kwset_candidates += count;
+  stats.kwset_matches += count;
+  return count;
+}
+
+/* Return a string that every match of the compiled pattern VDC
+   contains, or null if there is no such string.  */
+char const *
+GEAmust (void *vdc)
+{
+  struct dfa_comp *dc = vdc;
+  return dc->must;
+}
+
+/* Free the compiled pattern VDC.  */
+void
+GEAfree (void *vdc)
+{
+  struct dfa_comp *dc = vdc;
+  if (dc->kwset)
+    kwsfree (dc->kwset);
+  dfafree (dc->dfa);
+  free (dc->dfa);
+  mb_bounds_free (&dc->bounds);
+  free (dc->budget.pattern);
+  free (dc->budget.regex);
+  for (idx_t i = 0; i < dc->pcount; i++)
+    regfree (&dc->patterns[i]);
+  if (dc->backrefs)
+    for (idx_t i = 0; i < dc->pcount - dc->patterns_whole; i++)
+      backref_free (dc->backrefs[i]);
+  free (dc->backrefs);
+  free (dc->patterns - !dc->patterns_whole);
+  free (dc->regs.start);
+  free (dc->regs.end);
+  inner_free (dc->inner);
+  free (dc->must);
+  free (dc->literal);
+  free (dc->costs);
+  free (dc);
+}
+
+/* Set *COSTS to the calls to the slower matchers made for the patterns
+   of the compiled pattern VDC, and return how many entries it has.  */
+idx_t
+GEAcosts (void *vdc, struct pattern_cost const **costs)
+{
+  struct dfa_comp *dc = vdc;
+  *costs = dc->costs;
+  return dc->pcount + 1 - dc->patterns_whole;
+}
+
+/* Describe how the compiled pattern VDC will be matched, for --explain.  */
+void
+GEAexplain (void *vdc, explain_printf_t print)
+{
+  struct dfa_comp *dc = vdc;
+
+  if (dc->opts.regex_only)
+    print (_("fixed-string prefilter: bypassed\n"));
+  else if (dc->must)
+    print (_("fixed-string prefilter: \"%s\"%s%s\n"), dc->must,
+           dc->begline ? _(", at line start") : "",
+           (dc->kwset_exact_matches
+            ? _(", exact: a hit is a match") : ""));
+  else if (dc->nliterals)
+    print (_("fixed-string prefilter: one of %td strings, such as \"%s\"\n"),
+           dc->nliterals, dc->literal);
+  else
+    print (_("fixed-string prefilter: none\n"));
+  if (dc->inner)
+    print (_("around each fixed-string hit: checked without the DFA\n"));
+
+  if (dc->opts.regex_only)
+    print (_("DFA: bypassed\n"));
+  else
+    {
+      print (_("DFA: %s\n"),
+             (dc->utf8_bytes ? _("fast, on UTF-8 bytes")
+              : dfaisfast (dc->dfa) ? _("fast") : _("slow, multibyte")));
+      print (_("superset DFA: %s\n"),
+             dfasuperset (dc->dfa) ? _("yes") : _("no"));
+    }
+
+  if (dc->backref_patterns && !dc->opts.regex_only)
+    print (_("back-reference matcher: %td of %td pattern(s),"
+             " before regex\n"),
+           dc->backref_matchers, dc->backref_patterns);
+
+  if (dc->opts.regex_only)
+    print (_("regex: every line\n"));
+  else if (dc->backref_patterns)
+    print (_("regex: lines the DFA accepts, for back-references"
+             " in %td pattern(s), the first being \"%.*s\"\n"),
+           dc->backref_patterns, (int) MIN (dc->backref_pattern_len, INT_MAX),
+           dc->backref_pattern);
+  else if (!dfasupported (dc->dfa))
+    print (_("regex: lines the DFA accepts, as the DFA does not support"
+             " these patterns in this locale\n"));
+  else
+    print (_("regex: %s\n"),
+           dc->pcount ? _("only to find match boundaries") : _("not used"));
+}
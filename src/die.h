@@ -20,9 +20,48 @@
 #include <error.h>
 #include <verify.h>
 
+#ifdef LIBGREP
+
+/* The library reports errors to its caller instead of exiting.
+   libgrep_die (ERRNUM, FORMAT, ...) formats the message like 'error',
+   libgrep_die_report (FORMAT, ...) keeps a message for later, and
+   libgrep_die_reported () reports the messages kept.  libgrep_die and
+   libgrep_die_reported return to the library's entry point, which
+   first frees each P that libgrep_compiling (P, FREE) registered,
+   with FREE, unless libgrep_compiled (P) has since unregistered it
+   and whatever was registered after it.  */
+extern _Noreturn void libgrep_die (int, char const *, ...)
+  _GL_ATTRIBUTE_FORMAT_PRINTF_STANDARD (2, 3);
+extern void libgrep_die_report (char const *, ...)
+  _GL_ATTRIBUTE_FORMAT_PRINTF_STANDARD (1, 2);
+extern _Noreturn void libgrep_die_reported (void);
+extern void libgrep_compiling (void *, void (*) (void *));
+extern void libgrep_compiled (void const *);
+# define die(status, ...) \
+  verify_expr (status, libgrep_die (__VA_ARGS__))
+# define die_report(...) libgrep_die_report (__VA_ARGS__)
+# define die_reported(status) \
+  verify_expr (status, libgrep_die_reported ())
+
+#else
+
 /* Like 'error (STATUS, ...)', except STATUS must be a nonzero constant.
    This may pacify the compiler or help it generate better code.  */
-#define die(status, ...) \
+# define die(status, ...) \
   verify_expr (status, (error (status, __VA_ARGS__), assume (false)))
 
+/* Output a message like 'error (0, 0, ...)', for die_reported.  */
+# define die_report(...) error (0, 0, __VA_ARGS__)
+
+/* Exit with STATUS, a nonzero constant, after die_report has output
+   the messages.  */
+# define die_reported(status) \
+  verify_expr (status, exit (status))
+
+/* Only the library frees what is compiled when exiting.  */
+# define libgrep_compiling(p, free) ((void) 0)
+# define libgrep_compiled(p) ((void) 0)
+
+#endif
+
 #endif /* DIE_H */
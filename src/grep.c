@@ -27,24 +27,32 @@
 #include <stdio.h>
 #include "system.h"
 
+#include "alignalloc.h"
 #include "argmatch.h"
 #include "c-ctype.h"
+#include "cache.h"
 #include "c-stack.h"
+#include "close-stream.h"
 #include "closeout.h"
 #include "colorize.h"
+#include "decompress.h"
 #include "die.h"
 #include <error.h>
 #include "exclude.h"
 #include "exitfail.h"
 #include "fcntl-safer.h"
 #include "fts_.h"
+#include "gethrxtime.h"
 #include <getopt.h>
 #include "grep.h"
 #include "hash.h"
 #include "intprops.h"
+#include "probes.h"
 #include "safe-read.h"
 #include <search.h>
+#include "serve.h"
 #include "c-strcase.h"
+#include "trigram.h"
 #include "version-etc.h"
 #include "xalloc.h"
 #include "xbinary-io.h"
@@ -71,6 +79,9 @@ static bool suppress_errors;
 /* If nonzero, use color markers.  */
 static int color_option;
 
+/* Whether GREP_COLORS has the rv capability.  */
+static bool color_reverse;
+
 /* Show only the part of a line matching the expression. */
 static bool only_matching;
 
@@ -407,8 +418,11 @@ color_cap_mt_fct (void)
 static void
 color_cap_rv_fct (void)
 {
-  /* By this point, it was 1 (or already -1).  */
-  color_option = -1;  /* That's still != 0.  */
+  /* By this point, it was 1 (or already -1), or 0 in a server, whose
+     requests set it up again.  */
+  color_reverse = true;
+  if (color_option)
+    color_option = -1;  /* That's still != 0.  */
 }
 
 static void
@@ -435,7 +449,11 @@ static const struct color_cap color_dict[] =
     { nullptr, nullptr,            nullptr }
   };
 
-/* Saved errno value from failed output functions on stdout.
+/* The stream that output functions write to.  This is stdout,
+   except while printing a line to a --rules-output file.  */
+static FILE *out_stream;
+
+/* Saved errno value from failed output functions on OUT_STREAM.
    prline polls this to decide whether to die.
    Setting it to nonzero just before exiting can prevent clean_up_stdout
    from misbehaving on a buggy OS where 'close (STDOUT_FILENO)' fails
@@ -445,14 +463,14 @@ static int stdout_errno;
 static void
 putchar_errno (int c)
 {
-  if (putchar (c) < 0)
+  if (putc (c, out_stream) < 0)
     stdout_errno = errno;
 }
 
 static void
 fputs_errno (char const *s)
 {
-  if (fputs (s, stdout) < 0)
+  if (fputs (s, out_stream) < 0)
     stdout_errno = errno;
 }
 
@@ -461,7 +479,7 @@ printf_errno (char const *format, ...)
 {
   va_list ap;
   va_start (ap, format);
-  if (vfprintf (stdout, format, ap) < 0)
+  if (vfprintf (out_stream, format, ap) < 0)
     stdout_errno = errno;
   va_end (ap);
 }
@@ -469,14 +487,14 @@ printf_errno (char const *format, ...)
 static void
 fwrite_errno (void const *ptr, idx_t size, idx_t nmemb)
 {
-  if (fwrite (ptr, size, nmemb, stdout) != nmemb)
+  if (fwrite (ptr, size, nmemb, out_stream) != nmemb)
     stdout_errno = errno;
 }
 
 static void
 fflush_errno (void)
 {
-  if (fflush (stdout) != 0)
+  if (fflush (out_stream) != 0)
     stdout_errno = errno;
 }
 
@@ -490,15 +508,31 @@ static char const short_options[] =
 enum
 {
   BINARY_FILES_OPTION = CHAR_MAX + 1,
+  BUILD_INDEX_OPTION,
+  CACHE_OPTION,
+  CLIENT_OPTION,
   COLOR_OPTION,
+  DECOMPRESS_OPTION,
+  DECOMPRESS_THREADS_OPTION,
+  DFA_MEMORY_OPTION,
+  ENGINE_OPTION,
   EXCLUDE_DIRECTORY_OPTION,
   EXCLUDE_OPTION,
   EXCLUDE_FROM_OPTION,
+  EXPLAIN_OPTION,
   GROUP_SEPARATOR_OPTION,
   INCLUDE_OPTION,
   LINE_BUFFERED_OPTION,
+  MAX_LINE_LENGTH_OPTION,
   LABEL_OPTION,
-  NO_IGNORE_CASE_OPTION
+  MAX_ERRORS_OPTION,
+  NO_IGNORE_CASE_OPTION,
+  PATTERN_PROFILE_OPTION,
+  RULES_OPTION,
+  RULES_OUTPUT_OPTION,
+  SERVE_OPTION,
+  STATS_OPTION,
+  USE_INDEX_OPTION
 };
 
 /* Long options equivalences. */
@@ -512,16 +546,25 @@ static struct option const long_options[] =
   {"after-context", required_argument, nullptr, 'A'},
   {"before-context", required_argument, nullptr, 'B'},
   {"binary-files", required_argument, nullptr, BINARY_FILES_OPTION},
+  {"build-index", required_argument, nullptr, BUILD_INDEX_OPTION},
   {"byte-offset", no_argument, nullptr, 'b'},
+  {"cache", required_argument, nullptr, CACHE_OPTION},
+  {"client", required_argument, nullptr, CLIENT_OPTION},
   {"context", required_argument, nullptr, 'C'},
   {"color", optional_argument, nullptr, COLOR_OPTION},
   {"colour", optional_argument, nullptr, COLOR_OPTION},
   {"count", no_argument, nullptr, 'c'},
+  {"decompress", no_argument, nullptr, DECOMPRESS_OPTION},
+  {"decompress-threads", required_argument, nullptr,
+   DECOMPRESS_THREADS_OPTION},
   {"devices", required_argument, nullptr, 'D'},
+  {"dfa-memory", required_argument, nullptr, DFA_MEMORY_OPTION},
   {"directories", required_argument, nullptr, 'd'},
+  {"engine", required_argument, nullptr, ENGINE_OPTION},
   {"exclude", required_argument, nullptr, EXCLUDE_OPTION},
   {"exclude-from", required_argument, nullptr, EXCLUDE_FROM_OPTION},
   {"exclude-dir", required_argument, nullptr, EXCLUDE_DIRECTORY_OPTION},
+  {"explain", no_argument, nullptr, EXPLAIN_OPTION},
   {"file", required_argument, nullptr, 'f'},
   {"files-with-matches", no_argument, nullptr, 'l'},
   {"files-without-match", no_argument, nullptr, 'L'},
@@ -536,6 +579,8 @@ static struct option const long_options[] =
   {"line-number", no_argument, nullptr, 'n'},
   {"line-regexp", no_argument, nullptr, 'x'},
   {"max-count", required_argument, nullptr, 'm'},
+  {"max-errors", required_argument, nullptr, MAX_ERRORS_OPTION},
+  {"max-line-length", required_argument, nullptr, MAX_LINE_LENGTH_OPTION},
 
   {"no-filename", no_argument, nullptr, 'h'},
   {"no-group-separator", no_argument, nullptr, GROUP_SEPARATOR_OPTION},
@@ -543,13 +588,19 @@ static struct option const long_options[] =
   {"null", no_argument, nullptr, 'Z'},
   {"null-data", no_argument, nullptr, 'z'},
   {"only-matching", no_argument, nullptr, 'o'},
+  {"pattern-profile", no_argument, nullptr, PATTERN_PROFILE_OPTION},
   {"quiet", no_argument, nullptr, 'q'},
   {"recursive", no_argument, nullptr, 'r'},
   {"dereference-recursive", no_argument, nullptr, 'R'},
   {"regexp", required_argument, nullptr, 'e'},
   {"invert-match", no_argument, nullptr, 'v'},
+  {"rules", required_argument, nullptr, RULES_OPTION},
+  {"rules-output", required_argument, nullptr, RULES_OUTPUT_OPTION},
+  {"serve", required_argument, nullptr, SERVE_OPTION},
   {"silent", no_argument, nullptr, 'q'},
+  {"stats", optional_argument, nullptr, STATS_OPTION},
   {"text", no_argument, nullptr, 'a'},
+  {"use-index", required_argument, nullptr, USE_INDEX_OPTION},
   {"binary", no_argument, nullptr, 'U'},
   {"version", no_argument, nullptr, 'V'},
   {"with-filename", no_argument, nullptr, 'H'},
@@ -557,11 +608,11 @@ static struct option const long_options[] =
   {nullptr, 0, nullptr, 0}
 };
 
-/* Define flags declared in grep.h. */
-bool match_icase;
-bool match_words;
-bool match_lines;
-char eolbyte;
+/* Options that affect matching.  */
+static bool match_icase;	/* -i */
+static bool match_words;	/* -w */
+static bool match_lines;	/* -x */
+static char eolbyte;		/* -z */
 
 /* For error messages. */
 /* The input file name, or (if standard input) null or a --label argument.  */
@@ -570,6 +621,21 @@ static char const *filename;
 static bool omit_dot_slash;
 static bool errseen;
 
+/* Statistics reported by --stats, whether to report them, their
+   format, and when grep started gathering them.  */
+struct grep_stats stats;
+bool show_stats;
+static bool stats_json;
+static xtime_t stats_start_time;
+
+/* About how many bytes the DFA may grow by before it is rebuilt, for
+   --dfa-memory, or 0 for no limit.  */
+static idx_t dfa_memory;
+
+/* The most errors in an approximate match, for --max-errors, or 0
+   for exact matching.  */
+static idx_t max_errors;
+
 /* True if output from the current input file has been suppressed
    because an output line had an encoding error.  */
 static bool encoding_error_output;
@@ -642,13 +708,140 @@ enum { SEEK_HOLE = SEEK_SET };
 static bool seek_failed;
 static bool seek_data_failed;
 
+/* True if --decompress was given, and if the current input is being
+   decompressed.  */
+static bool decompress;
+static bool decompressing;
+
+/* The directory named by --build-index, and the index named by
+   --use-index if it is in use.  */
+static char const *build_index_dir;
+static struct trigram_index *trigram_index;
+
+/* True if --cache is in use.  */
+static bool use_cache;
+
+/* Which command-line options have been specified for filename output.
+   -1 for -h, 1 for -H, 0 for neither.  */
+static int filename_option;
+
+/* True if the working directory is searched when there are no file
+   operands.  */
+static bool search_cwd_by_default;
+
 /* Functions we'll use to search. */
-typedef void *(*compile_fp_t) (char *, idx_t, reg_syntax_t, bool);
+typedef void *(*compile_fp_t) (char *, idx_t, reg_syntax_t, bool,
+                               struct matchopts const *);
 typedef ptrdiff_t (*execute_fp_t) (void *, char const *, idx_t, idx_t *,
                                    char const *);
+typedef ptrdiff_t (*count_fp_t) (void *, char const *, idx_t);
+typedef void (*explain_fp_t) (void *, explain_printf_t);
+typedef idx_t (*costs_fp_t) (void *, struct pattern_cost const **);
+typedef void (*reset_fp_t) (void *);
 static execute_fp_t execute;
+static count_fp_t count_matching_lines;
+
+/* The matcher's function for counting matching lines, if it can be
+   used with the options given; count_matching_lines is this with -c.  */
+static count_fp_t matcher_count;
+static reset_fp_t reset_matcher;
 static void *compiled_pattern;
 
+/* A named set of patterns from the --rules file.  COMPILED_PATTERN
+   matches a line if any rule does, so each input line is searched
+   once; the patterns of each rule are also compiled by themselves,
+   to find out which rules a selected line matches.  */
+struct rule
+  {
+    /* The rule's name, and its patterns, each terminated by '\n'.  */
+    char *name;
+    char *keys;
+    idx_t keycc, keyalloc;
+
+    /* The rule's own compiled patterns, and how to search with them
+       and to prepare them for another file.  */
+    execute_fp_t execute;
+    reset_fp_t reset;
+    void *compiled;
+
+    /* With --rules-output, the file the rule's lines are output to,
+       and its name.  */
+    FILE *out;
+    char *out_name;
+  };
+static struct rule *rules;
+static idx_t nrules, rules_allocated;
+
+/* The --rules and --rules-output arguments, or null.  */
+static char const *rules_file;
+static char const *rules_output_dir;
+
+/* Print the names of the rules each line matches.  */
+static bool out_rules;
+
+/* The indexes into RULES of the rules the line being output matches.  */
+static idx_t *matched_rules;
+static idx_t n_matched_rules;
+
+/* Set MATCHED_RULES to the rules that the line from BEG to LIM
+   matches.  LIM[-1] is an end-of-line byte.  */
+static void
+find_rules (char *beg, char *lim)
+{
+  n_matched_rules = 0;
+  for (idx_t i = 0; i < nrules; i++)
+    {
+      idx_t size;
+      stats.rule_checks++;
+      if (0 <= rules[i].execute (rules[i].compiled, beg, lim - beg,
+                                 &size, nullptr))
+        matched_rules[n_matched_rules++] = i;
+    }
+}
+
+/* For --pattern-profile: a pattern, what it matched and what it cost.  */
+struct pattern_profile
+  {
+    /* The pattern as given, and its origin-0 number.  */
+    char const *text;
+    idx_t len;
+    idx_t lineno;
+
+    /* The pattern compiled by itself, and the bytes of heap that this
+       took, or -1 if they cannot be measured.  */
+    void *compiled;
+    idx_t memory;
+
+    /* The lines found to match that the pattern matches by itself, and
+       the calls to the slower matchers made for the pattern when
+       searching with all the patterns.  */
+    intmax_t matches;
+    intmax_t regex_calls;
+    intmax_t backref_calls;
+  };
+
+/* The profiles of the N_PATTERNS patterns, if --pattern-profile, and
+   how to find what the slower matchers cost for each pattern.  */
+static bool pattern_profile;
+static struct pattern_profile *profiles;
+static costs_fp_t pattern_costs;
+
+/* Count the line from BEG to LIM, which matches the patterns, as a
+   match of each pattern that matches it by itself.  */
+static void
+profile_line (char *beg, char *lim)
+{
+  /* Leave --stats to count the search with all the patterns.  */
+  struct grep_stats saved_stats = stats;
+  for (idx_t i = 0; i < n_patterns; i++)
+    {
+      idx_t size;
+      if (0 <= execute (profiles[i].compiled, beg, lim - beg, &size, nullptr))
+        profiles[i].matches++;
+    }
+  stats = saved_stats;
+}
+
 char const *
 input_filename (void)
 {
@@ -666,6 +859,16 @@ suppressible_error (int errnum)
   errseen = true;
 }
 
+/* Unless requested, diagnose a problem WHAT with the data in the
+   input file, described by MESSAGE.  */
+void
+input_data_error (char const *what, char const *message)
+{
+  if (! suppress_errors)
+    error (0, 0, "%s: %s: %s", input_filename (), what, message);
+  errseen = true;
+}
+
 /* If there has already been a write error, don't bother closing
    standard output, as that might elicit a duplicate diagnostic.  */
 static void
@@ -675,6 +878,122 @@ clean_up_stdout (void)
     close_stdout ();
 }
 
+/* The separator to print before the next JSON member, for --stats=json.  */
+static char const *stats_sep;
+
+/* Print one statistic for --stats, with JSON member name KEY and
+   description LABEL.  */
+static void
+print_stat (char const *key, char const *label, intmax_t value)
+{
+  if (stats_json)
+    {
+      fprintf (stderr, "%s\"%s\": %jd", stats_sep, key, value);
+      stats_sep = ", ";
+    }
+  else
+    fprintf (stderr, "%s: %s: %jd\n", getprogname (), label, value);
+}
+
+/* Likewise, for a duration of NS nanoseconds, printed in seconds.  */
+static void
+print_time (char const *key, char const *label, xtime_t ns)
+{
+  intmax_t sec = xtime_sec (ns);
+  int nsec = xtime_nsec (ns);
+  if (stats_json)
+    {
+      fprintf (stderr, "%s\"%s\": %jd.%09d", stats_sep, key, sec, nsec);
+      stats_sep = ", ";
+    }
+  else
+    fprintf (stderr, "%s: %s: %jd.%09d s\n", getprogname (), label, sec, nsec);
+}
+
+/* JSON member names and descriptions of the phases timed by --stats.  */
+static char const *const phase_key[PHASES] =
+  {
+    [PHASE_TRAVERSE] = "traverse_seconds",
+    [PHASE_READ] = "read_seconds",
+    [PHASE_BINARY] = "binary_seconds",
+    [PHASE_KWSET] = "kwset_seconds",
+    [PHASE_DFA] = "dfa_seconds",
+    [PHASE_REGEX] = "regex_seconds",
+    [PHASE_PCRE] = "pcre_seconds",
+    [PHASE_OUTPUT] = "output_seconds",
+  };
+static char const *const phase_label[PHASES] =
+  {
+    [PHASE_TRAVERSE] = N_("time opening files and directories"),
+    [PHASE_READ] = N_("time reading"),
+    [PHASE_BINARY] = N_("time detecting binary files"),
+    [PHASE_KWSET] = N_("time searching for fixed strings"),
+    [PHASE_DFA] = N_("time in DFA"),
+    [PHASE_REGEX] = N_("time in regex"),
+    [PHASE_PCRE] = N_("time in PCRE"),
+    [PHASE_OUTPUT] = N_("time printing lines"),
+  };
+
+/* Print the statistics gathered for --stats.  */
+static void
+print_stats (void)
+{
+  xtime_t elapsed = gethrxtime () - stats_start_time;
+
+  /* Flush any output first, leaving errors for close_stdout.  */
+  fflush (stdout);
+
+  stats_sep = "{";
+  print_stat ("files_opened", _("files opened"), stats.files_opened);
+  print_stat ("files_skipped", _("files skipped"), stats.files_skipped);
+  print_stat ("reads", _("reads"), stats.reads);
+  print_stat ("bytes_read", _("bytes read"), stats.bytes_read);
+  print_stat ("readsize_max", _("largest read size"), stats.readsize_max);
+  print_stat ("large_buffers", _("large buffers"), stats.buffers);
+  print_stat ("huge_page_advised_buffers",
+              _("large buffers advised to use huge pages"),
+              stats.advised_buffers);
+  print_stat ("lines", _("lines scanned"), stats.lines);
+  print_stat ("kwset_candidates", _("fixed-string candidates"),
+              stats.kwset_candidates);
+  print_stat ("kwset_matches", _("fixed-string candidates confirmed"),
+              stats.kwset_matches);
+  print_stat ("inner_checks", _("candidates checked around the hit"),
+              stats.inner_checks);
+  print_stat ("approx_checks", _("lines checked for approximate matches"),
+              stats.approx_checks);
+  print_stat ("rule_checks", _("lines checked against a rule"),
+              stats.rule_checks);
+  print_stat ("dfaexec_calls", _("DFA calls"), stats.dfaexec_calls);
+  print_stat ("kwset_first_windows",
+              _("windows searched for fixed strings first"),
+              stats.strategy_windows[STRATEGY_KWSET]);
+  print_stat ("dfa_only_windows", _("windows searched by the DFA alone"),
+              stats.strategy_windows[STRATEGY_DFA]);
+  print_stat ("superset_first_windows",
+              _("windows searched by the superset DFA first"),
+              stats.strategy_windows[STRATEGY_SUPERSET]);
+  print_stat ("strategy_switches", _("search strategy changes"),
+              stats.strategy_switches);
+  print_stat ("dfa_memory_limit", _("DFA memory limit"), dfa_memory);
+  print_stat ("dfa_memory_peak", _("DFA memory peak"), stats.dfa_memory_peak);
+  print_stat ("dfa_flushes", _("DFA flushes"), stats.dfa_flushes);
+  print_stat ("dfa_fallbacks", _("DFA fallbacks to regex"),
+              stats.dfa_fallbacks);
+  print_stat ("backref_searches", _("back-reference matcher calls"),
+              stats.backref_searches);
+  print_stat ("backref_fallbacks", _("back-reference matcher fallbacks"),
+              stats.backref_fallbacks);
+  print_stat ("re_search_calls", _("regex calls"), stats.re_search_calls);
+  print_stat ("jit_stack_growths", _("PCRE JIT stack enlargements"),
+              stats.jit_stack_growths);
+  for (int i = 0; i < PHASES; i++)
+    print_time (phase_key[i], _(phase_label[i]), stats.phase_time[i]);
+  print_time ("elapsed_seconds", _("total time"), elapsed);
+  if (stats_json)
+    fputs ("}\n", stderr);
+}
+
 /* A cast to TYPE of VAL.  Use this when TYPE is a pointer type, VAL
    is properly aligned for TYPE, and 'gcc -Wcast-align' cannot infer
    the alignment and would otherwise complain about the cast.  */
@@ -874,8 +1193,11 @@ static int bufdesc;		/* File descriptor. */
 static char *bufbeg;		/* Beginning of user-visible stuff. */
 static char *buflim;		/* Limit of user-visible stuff. */
 static idx_t pagesize;		/* alignment of memory pages */
+static idx_t initial_bufalloc;	/* bufalloc before any growth */
 static idx_t good_readsize;	/* good size to pass to 'read' */
+static idx_t readsize;		/* size of the next read of this file */
 static off_t bufoffset;		/* Read offset.  */
+static bool size_eof;		/* Reads have reached the file's size.  */
 static off_t after_last_match;	/* Pointer after last matching line that
                                    would have been output if we were
                                    outputting characters. */
@@ -893,6 +1215,22 @@ static intmax_t totalnl;	/* Total newline count before lastnl. */
    with an Intel Xeon W-1350.  */
 enum { GOOD_READSIZE_MIN = 96 * 1024 };
 
+/* Maximum value for readsize.  Reads of a few MiB can be much faster
+   on network and FUSE file systems, but cost memory, so limit the
+   growth of the buffer to this budget.  */
+enum { GOOD_READSIZE_MAX = 4 * 1024 * 1024 };
+
+/* A buffer larger than this was grown for an unusually long line, and
+   is shrunk before reading the next file so that the rest of a run
+   does not keep the memory.  */
+enum { BUFALLOC_KEEP_MAX = 4 * GOOD_READSIZE_MAX };
+
+/* For adapting readsize to the current file: the time per byte of the
+   last full read while readsize grew, or -1 if none; and whether
+   readsize has stopped changing.  */
+static double read_ns_per_byte;
+static bool readsize_settled;
+
 /* Return VAL aligned to the next multiple of ALIGNMENT.  VAL can be
    an integer or a pointer.  Both args must be free of side effects.  */
 #define ALIGN_TO(val, alignment) \
@@ -921,16 +1259,44 @@ all_zeros (char const *buf, idx_t size)
   return true;
 }
 
+/* Prepare the compiled patterns for searching a new file, so that
+   what a matcher learned about the last file does not carry over.  */
+static void
+reset_matchers (void)
+{
+  if (reset_matcher)
+    {
+      reset_matcher (compiled_pattern);
+      if (pattern_profile)
+        for (idx_t i = 0; i < n_patterns; i++)
+          reset_matcher (profiles[i].compiled);
+    }
+  for (idx_t i = 0; i < nrules; i++)
+    if (rules[i].reset)
+      rules[i].reset (rules[i].compiled);
+}
+
 /* Reset the buffer for a new file, returning false if we should skip it.
    Initialize on the first time through. */
 static bool
 reset (int fd, struct stat const *st)
 {
+  if (BUFALLOC_KEEP_MAX < bufalloc)
+    {
+      alignfree (buffer);
+      bufalloc = initial_bufalloc;
+      buffer = xalignalloc (pagesize, bufalloc);
+    }
+
   bufbeg = buflim = ALIGN_TO (buffer + 1, pagesize);
   bufbeg[-1] = eolbyte;
   bufdesc = fd;
+  readsize = good_readsize;
+  read_ns_per_byte = -1;
+  readsize_settled = false;
   bufoffset = fd == STDIN_FILENO ? lseek (fd, 0, SEEK_CUR) : 0;
   seek_failed = bufoffset < 0;
+  size_eof = false;
 
   /* Assume SEEK_DATA fails if SEEK_CUR does.  */
   seek_data_failed = seek_failed;
@@ -944,9 +1310,106 @@ reset (int fd, struct stat const *st)
         }
       bufoffset = 0;
     }
+
+  reset_matchers ();
+
+  decompressing = false;
+#if HAVE_DECOMPRESS
+  if (decompress)
+    {
+      int compression = decompress_start (fd);
+      if (compression < 0)
+        {
+          suppressible_error (errno);
+          return false;
+        }
+
+      /* decompress_start peeks at a file that can seek, and reads
+         ahead only in one that cannot, so seeking is still safe in
+         uncompressed input.  */
+      if (compression != COMPRESSION_NONE)
+        {
+          /* Offsets count decompressed bytes, which the file's
+             size and holes say nothing about.  */
+          decompressing = true;
+          bufoffset = 0;
+          seek_failed = seek_data_failed = true;
+        }
+    }
+#endif
   return true;
 }
 
+/* Read up to SIZE bytes of the current input into BUF, decompressing
+   if requested.  */
+static ptrdiff_t
+read_input (char *buf, idx_t size)
+{
+#if HAVE_DECOMPRESS
+  if (decompress)
+    return decompress_read (bufdesc, buf, size);
+#endif
+  return safe_read (bufdesc, buf, size);
+}
+
+/* Adapt readsize after a full read of SIZE bytes that took NS
+   nanoseconds.  Start small, as small reads are best when the data
+   is cached, and double the size while that cuts the time per byte
+   by at least 10%, as happens with high-latency file systems.  */
+static void
+adapt_readsize (idx_t size, xtime_t ns)
+{
+  double ns_per_byte = (double) ns / size;
+  if (read_ns_per_byte < 0 || ns_per_byte < 0.9 * read_ns_per_byte)
+    {
+      read_ns_per_byte = ns_per_byte;
+      if (size < GOOD_READSIZE_MAX)
+        {
+          readsize = ALIGN_TO (MIN (2 * size, GOOD_READSIZE_MAX), pagesize);
+          return;
+        }
+    }
+  else
+    {
+      /* The larger size did not help enough; go back to the last one.  */
+      readsize = size / 2;
+    }
+  readsize_settled = true;
+}
+
+/* Allocate an input buffer that is at least INCR_MIN bytes larger than
+   *ALLOC and, if ALLOC_MAX is nonnegative, preferably no larger than
+   ALLOC_MAX, growing geometrically as xpalloc does.  Set *ALLOC to
+   its size.  Align a large buffer so that it can use huge pages.  */
+static char *
+alloc_input_buffer (idx_t *alloc, idx_t incr_min, ptrdiff_t alloc_max)
+{
+  idx_t incr = MAX (incr_min, *alloc >> 1);
+  if (0 <= alloc_max && alloc_max - *alloc < incr)
+    incr = MAX (incr_min, alloc_max - *alloc);
+  idx_t n;
+  if (ckd_add (&n, *alloc, incr))
+    xalloc_die ();
+
+  idx_t alignment = pagesize;
+  idx_t huge_n;
+  if (HUGE_PAGE_SIZE <= n
+      && !ckd_add (&huge_n, n, HUGE_PAGE_SIZE - 1 - (n - 1) % HUGE_PAGE_SIZE))
+    {
+      alignment = MAX (pagesize, HUGE_PAGE_SIZE);
+      n = huge_n;
+    }
+
+  char *p = xalignalloc (alignment, n);
+  if (HUGE_PAGE_SIZE <= n)
+    {
+      stats.buffers++;
+      stats.advised_buffers += advise_huge_pages (p, n);
+    }
+  *alloc = n;
+  return p;
+}
+
 /* Read new stuff into the buffer, saving the specified
    amount of old stuff.  When we're done, 'bufbeg' points
    to the beginning of the buffer contents, and 'buflim'
@@ -955,10 +1418,13 @@ static bool
 fillbuf (idx_t save, struct stat const *st)
 {
   char *readbuf;
+  idx_t size = readsize;
+
+  PROBE2 (fillbuf__entry, save, size);
 
   /* After BUFLIM, we need room for a good-sized read plus a
      trailing uword.  */
-  idx_t min_after_buflim = good_readsize + uword_size;
+  idx_t min_after_buflim = size + uword_size;
 
   if (min_after_buflim <= buffer + bufalloc - buflim)
     readbuf = buflim;
@@ -968,7 +1434,7 @@ fillbuf (idx_t save, struct stat const *st)
 
       /* For data to be searched we need room for the saved bytes,
          plus at least a good-sized read.  */
-      idx_t minsize = save + good_readsize;
+      idx_t minsize = save + size;
 
       /* Add enough room so that the buffer is aligned and has room
          for byte sentinels fore and aft, and so that a uword can
@@ -985,7 +1451,7 @@ fillbuf (idx_t save, struct stat const *st)
              heuristic if we've already read past the file end, as most
              likely the file is growing.  */
           ptrdiff_t alloc_max = -1;
-          if (usable_st_size (st))
+          if (usable_st_size (st) && !decompressing)
             {
               off_t to_be_read = st->st_size - bufoffset;
               ptrdiff_t a;
@@ -994,7 +1460,7 @@ fillbuf (idx_t save, struct stat const *st)
                 alloc_max = MAX (a, bufalloc + incr_min);
             }
 
-          newbuf = xpalloc (nullptr, &bufalloc, incr_min, alloc_max, 1);
+          newbuf = alloc_input_buffer (&bufalloc, incr_min, alloc_max);
         }
 
       readbuf = ALIGN_TO (newbuf + 1 + save, pagesize);
@@ -1002,7 +1468,7 @@ fillbuf (idx_t save, struct stat const *st)
       memmove (readbuf - moved, buflim - moved, moved);
       if (0 < incr_min)
         {
-          free (buffer);
+          alignfree (buffer);
           buffer = newbuf;
         }
     }
@@ -1016,13 +1482,36 @@ fillbuf (idx_t save, struct stat const *st)
 
   while (true)
     {
-      fillsize = safe_read (bufdesc, readbuf, good_readsize);
+      /* After a short read ending at the size of a regular file, the
+         next read would almost surely report end of file, so save a
+         system call per file by assuming that it would.  A file that
+         has grown since it was examined, such as a log being written,
+         may still be growing, so read it until a read returns 0.  */
+      if (size_eof)
+        {
+          fillsize = 0;
+          break;
+        }
+
+      bool timed = show_stats | !readsize_settled;
+      xtime_t start = timed ? gethrxtime () : 0;
+      fillsize = read_input (readbuf, size);
+      xtime_t ns = timed ? gethrxtime () - start : 0;
+      stats.phase_time[PHASE_READ] += ns;
       if (fillsize < 0)
         {
           fillsize = 0;
           cc = false;
         }
+      else if (fillsize == size && !readsize_settled)
+        adapt_readsize (size, ns);
       bufoffset += fillsize;
+      size_eof = (0 < fillsize && fillsize < size && !decompressing
+                  && usable_st_size (st) && 0 < st->st_size
+                  && st->st_size == bufoffset);
+      stats.reads += 0 < fillsize;
+      stats.bytes_read += fillsize;
+      stats.readsize_max = MAX (stats.readsize_max, size);
 
       if (((fillsize == 0) | !skip_nuls) || !all_zeros (readbuf, fillsize))
         break;
@@ -1057,6 +1546,7 @@ fillbuf (idx_t save, struct stat const *st)
      the above memset call as ASAN-poisoned.  */
   asan_poison (buflim + uword_size, bufalloc - (buflim - buffer) - uword_size);
 
+  PROBE3 (fillbuf__return, cc, fillsize, bufoffset);
   return cc;
 }
 
@@ -1091,6 +1581,8 @@ static intmax_t out_after;	/* Lines of trailing context. */
 static bool count_matches;	/* Count matching lines.  */
 static intmax_t max_count;	/* Max number of selected
                                    lines from an input file.  */
+static intmax_t max_line_length; /* Skip lines longer than this.  */
+static bool long_line_warned;	/* A long line in this file was reported.  */
 static bool line_buffered;	/* Use line buffering.  */
 static char *label;		/* Fake filename for stdin */
 
@@ -1101,6 +1593,9 @@ static char const *lastnl;	/* Pointer after last newline counted. */
 static char *lastout;		/* Pointer after last character output;
                                    null if no character has been output
                                    or if it's conceptually before bufbeg. */
+static char *lastskip;		/* Pointer after the last line skipped for
+                                   being too long, or bufbeg if none;
+                                   context does not reach before it.  */
 static intmax_t outleft;	/* Maximum number of selected lines.  */
 static intmax_t pending;	/* Pending lines of output.
                                    Always kept 0 if out_quiet is true.  */
@@ -1109,18 +1604,25 @@ static bool exit_on_match;	/* Exit on first match.  */
 static bool dev_null_output;	/* Stdout is known to be /dev/null.  */
 static bool binary;		/* Use binary rather than text I/O.  */
 
-static void
-nlscan (char const *lim)
+/* Return the number of line terminators from BEG up to LIM.  */
+static idx_t
+count_lines (char const *beg, char const *lim)
 {
   idx_t newlines = 0;
-  for (char const *beg = lastnl; beg < lim; beg++)
+  for (; beg < lim; beg++)
     {
       beg = memchr (beg, eolbyte, lim - beg);
       if (!beg)
         break;
       newlines++;
     }
-  totalnl = add_count (totalnl, newlines);
+  return newlines;
+}
+
+static void
+nlscan (char const *lim)
+{
+  totalnl = add_count (totalnl, count_lines (lastnl, lim));
   lastnl = lim;
 }
 
@@ -1151,7 +1653,7 @@ print_offset (intmax_t pos, const char *color)
   pr_sgr_end_if (color);
 }
 
-/* Print a whole line head (filename, line, byte).  The output data
+/* Print a whole line head (filename, line, byte, rules).  The output data
    starts at BEG and contains LEN bytes; it is followed by at least
    uword_size bytes, the first of which may be temporarily modified.
    The output data comes from what is perhaps a larger input line that
@@ -1203,7 +1705,18 @@ print_line_head (char *beg, idx_t len, char const *lim, char sep)
       print_sep (sep);
     }
 
-  if (align_tabs && (out_file | out_line | out_byte) && len != 0)
+  if (out_rules)
+    {
+      for (idx_t i = 0; i < n_matched_rules; i++)
+        {
+          if (i)
+            putchar_errno (',');
+          fputs_errno (rules[matched_rules[i]].name);
+        }
+      print_sep (sep);
+    }
+
+  if (align_tabs && (out_file | out_line | out_byte | out_rules) && len != 0)
     putchar_errno ('\t');
 
   return true;
@@ -1298,8 +1811,10 @@ print_line_tail (char *beg, const char *lim, const char *line_color)
   return beg;
 }
 
+/* Print the line from BEG to LIM to OUT_STREAM, using SEP as the
+   separator on output.  */
 static void
-prline (char *beg, char *lim, char sep)
+print_line (char *beg, char *lim, char sep)
 {
   bool matching;
   const char *line_color;
@@ -1353,10 +1868,50 @@ prline (char *beg, char *lim, char sep)
   lastout = lim;
 }
 
+/* Print the line from BEG to LIM, using SEP as the separator on
+   output.  With --rules, find the rules a selected line matches, and
+   with --rules-output print it to each of their files instead.  */
+static void
+prline (char *beg, char *lim, char sep)
+{
+  if (!nrules)
+    {
+      print_line (beg, lim, sep);
+      return;
+    }
+
+  n_matched_rules = 0;
+  if (sep == SEP_CHAR_SELECTED)
+    find_rules (beg, lim);
+
+  if (!rules_output_dir)
+    {
+      print_line (beg, lim, sep);
+      return;
+    }
+
+  /* Color or output only the parts of the line that each rule matches.  */
+  execute_fp_t all_execute = execute;
+  void *all_compiled = compiled_pattern;
+  for (idx_t i = 0; i < n_matched_rules; i++)
+    {
+      struct rule *r = &rules[matched_rules[i]];
+      execute = r->execute;
+      compiled_pattern = r->compiled;
+      out_stream = r->out;
+      print_line (beg, lim, sep);
+    }
+  execute = all_execute;
+  compiled_pattern = all_compiled;
+  out_stream = stdout;
+  lastout = lim;
+}
+
 /* Print pending lines of trailing context prior to LIM.  */
 static void
 prpending (char const *lim)
 {
+  xtime_t start_time = stats_clock ();
   if (!lastout)
     lastout = bufbeg;
   for (; 0 < pending && lastout < lim; pending--)
@@ -1364,6 +1919,7 @@ prpending (char const *lim)
       char *nl = rawmemchr (lastout, eolbyte);
       prline (lastout, nl + 1, SEP_CHAR_REJECTED);
     }
+  stats_charge (PHASE_OUTPUT, start_time);
 }
 
 /* Output the lines between BEG and LIM.  Deal with context.  */
@@ -1376,12 +1932,13 @@ prtext (char *beg, char *lim)
   if (!out_quiet && pending > 0)
     prpending (beg);
 
+  xtime_t start_time = stats_clock ();
   char *p = beg;
 
   if (!out_quiet)
     {
       /* Deal with leading context.  */
-      char const *bp = lastout ? lastout : bufbeg;
+      char const *bp = lastout ? lastout : lastskip;
       intmax_t i;
       for (i = 0; i < out_before; ++i)
         if (p > bp)
@@ -1435,6 +1992,7 @@ prtext (char *beg, char *lim)
   pending = out_quiet ? 0 : MAX (0, out_after);
   used = true;
   outleft -= n;
+  stats_charge (PHASE_OUTPUT, start_time);
 }
 
 /* Replace all NUL bytes in buffer P (which ends at LIM) with EOL.
@@ -1467,6 +2025,20 @@ grepbuf (char *beg, char const *lim)
   intmax_t outleft0 = outleft;
   char *endp;
 
+  PROBE2 (grepbuf, bufoffset - (buflim - beg), lim - beg);
+
+  /* With -c, let the matcher count matching lines directly if it can,
+     as no line needs to be output.  */
+  if (count_matching_lines)
+    {
+      ptrdiff_t n = count_matching_lines (compiled_pattern, beg, lim - beg);
+      if (0 <= n)
+        {
+          outleft -= n;
+          return n;
+        }
+    }
+
   for (char *p = beg; p < lim; p = endp)
     {
       idx_t match_size;
@@ -1484,6 +2056,8 @@ grepbuf (char *beg, char const *lim)
       /* Avoid matching the empty line at the end of the buffer. */
       if (!out_invert && b == lim)
         break;
+      if (pattern_profile && b < lim)
+        profile_line (b, endp);
       if (!out_invert || p < b)
         {
           if (list_files != LISTFILES_NONE)
@@ -1506,6 +2080,88 @@ grepbuf (char *beg, char const *lim)
   return outleft0 - outleft;
 }
 
+/* Report once per file that lines are being skipped because they are
+   longer than --max-line-length.  */
+static void
+warn_long_line (void)
+{
+  if (!long_line_warned && !suppress_errors)
+    error (0, 0, _("%s: skipping lines longer than %jd bytes"),
+           input_filename (), max_line_length);
+  long_line_warned = true;
+}
+
+/* Like grepbuf, but skip lines longer than max_line_length.  Skipped
+   lines are neither selected nor output as context.  */
+static intmax_t
+grepbuf_short_lines (char *beg, char *lim)
+{
+  if (max_line_length == INTMAX_MAX)
+    return grepbuf (beg, lim);
+
+  char eol = eolbyte;
+  intmax_t nlines = 0;
+  char *seg = beg;
+
+  /* P is the start of a line.  A line is too long if and only if no
+     line terminator follows it within max_line_length + 1 bytes, so
+     skip ahead that far at a time.  */
+  for (char *p = beg; max_line_length < lim - p - 1; )
+    {
+      char *e = memrchr (p, eol, max_line_length + 1);
+      if (e)
+        p = e + 1;
+      else
+        {
+          char *end = rawmemchr (p + max_line_length + 1, eol) + 1;
+          if (seg < p)
+            {
+              nlines += grepbuf (seg, p);
+              if (!outleft || (done_on_match && 0 < nlines))
+                return nlines;
+            }
+          if (pending)
+            prpending (p);
+          pending = 0;
+          lastout = nullptr;
+          lastskip = end;
+          warn_long_line ();
+          seg = p = end;
+        }
+    }
+
+  if (seg < lim)
+    nlines += grepbuf (seg, lim);
+  return nlines;
+}
+
+/* Discard input through the end of the current line, which is longer
+   than max_line_length.  Return false if there's a read error.  */
+static bool
+skip_line_rest (struct stat const *st)
+{
+  while (true)
+    {
+      if (! fillbuf (0, st))
+        return false;
+      if (bufbeg == buflim)
+        return true;
+      char *eol = memchr (bufbeg, eolbyte, buflim - bufbeg);
+      char *end = eol ? eol + 1 : buflim;
+      if (out_byte)
+        totalcc = add_count (totalcc, end - bufbeg);
+      bufbeg = end;
+      if (eol)
+        {
+          totalnl = add_count (totalnl, 1);
+
+          /* Refill a buffer that the line ended, as the caller takes
+             an empty buffer to mean end of file.  */
+          return bufbeg < buflim || fillbuf (0, st);
+        }
+    }
+}
+
 /* Search a given (non-directory) file.  Return a count of lines printed.
    Set *INEOF to true if end-of-file reached.  */
 static intmax_t
@@ -1534,6 +2190,7 @@ grep (int fd, struct stat const *st, bool *ineof)
   pending = 0;
   skip_nuls = skip_empty_lines && !eol;
   encoding_error_output = false;
+  long_line_warned = false;
 
   nlines = 0;
   residue = 0;
@@ -1549,7 +2206,8 @@ grep (int fd, struct stat const *st, bool *ineof)
   if (align_tabs)
     {
       /* Width is log of maximum number.  Line numbers are origin-1.  */
-      intmax_t num = usable_st_size (st) ? st->st_size : INTMAX_MAX;
+      intmax_t num = (usable_st_size (st) && !decompressing
+                     ? st->st_size : INTMAX_MAX);
       num += out_line && num < INTMAX_MAX;
       do
         offset_width++;
@@ -1558,12 +2216,21 @@ grep (int fd, struct stat const *st, bool *ineof)
 
   for (bool firsttime = true; ; firsttime = false)
     {
-      if (nlines_first_null < 0 && eol && binary_files != TEXT_BINARY_FILES
-          && (buf_has_nulls (bufbeg, buflim - bufbeg)
-              || (firsttime && file_must_have_nulls (buflim - bufbeg, fd, st))))
+      xtime_t start_time = stats_clock ();
+      bool nulls = (nlines_first_null < 0 && eol
+                    && binary_files != TEXT_BINARY_FILES
+                    && (buf_has_nulls (bufbeg, buflim - bufbeg)
+                        || (firsttime
+                            && file_must_have_nulls (buflim - bufbeg,
+                                                     fd, st))));
+      stats_charge (PHASE_BINARY, start_time);
+      if (nulls)
         {
           if (binary_files == WITHOUT_MATCH_BINARY_FILES)
-            return 0;
+            {
+              stats.files_skipped++;
+              return 0;
+            }
           if (!count_matches)
             {
               out_quiet = true;
@@ -1576,6 +2243,7 @@ grep (int fd, struct stat const *st, bool *ineof)
         }
 
       lastnl = bufbeg;
+      lastskip = bufbeg;
       if (lastout)
         lastout = bufbeg;
 
@@ -1599,8 +2267,10 @@ grep (int fd, struct stat const *st, bool *ineof)
 
       if (beg < lim)
         {
+          if (show_stats)
+            stats.lines += count_lines (beg, lim);
           if (outleft)
-            nlines += grepbuf (beg, lim);
+            nlines += grepbuf_short_lines (beg, lim);
           if (pending)
             prpending (lim);
           if ((!outleft && !pending)
@@ -1608,12 +2278,32 @@ grep (int fd, struct stat const *st, bool *ineof)
             goto finish_grep;
         }
 
+      /* Rather than growing the buffer to hold an incomplete line
+         that is already too long, skip the rest of it.  */
+      if (max_line_length < residue)
+        {
+          pending = 0;
+          warn_long_line ();
+          if (out_byte)
+            totalcc = add_count (totalcc, buflim - bufbeg);
+          if (out_line)
+            nlscan (lim);
+          lastout = nullptr;
+          residue = save = 0;
+          if (! skip_line_rest (st))
+            {
+              suppressible_error (errno);
+              goto finish_grep;
+            }
+          continue;
+        }
+
       /* The last OUT_BEFORE lines at the end of the buffer will be needed as
          leading context if there is a matching line at the begin of the
          next data. Make beg point to their begin.  */
       i = 0;
       beg = lim;
-      while (i < out_before && beg > bufbeg && beg != lastout)
+      while (i < out_before && beg > lastskip && beg != lastout)
         {
           ++i;
           do
@@ -1640,8 +2330,9 @@ grep (int fd, struct stat const *st, bool *ineof)
   if (residue)
     {
       *buflim++ = eol;
+      stats.lines++;
       if (outleft)
-        nlines += grepbuf (bufbeg + save - residue, buflim);
+        nlines += grepbuf_short_lines (bufbeg + save - residue, buflim);
       if (pending)
         prpending (buflim);
     }
@@ -1671,6 +2362,7 @@ grepdirent (FTS *fts, FTSENT *ent, bool command_line)
                         || ent->fts_info == FTS_DNR)))
     {
       fts_set (fts, ent, FTS_SKIP);
+      stats.files_skipped++;
       return true;
     }
 
@@ -1719,7 +2411,10 @@ grepdirent (FTS *fts, FTSENT *ent, bool command_line)
               st = &st1;
             }
           if (is_device_mode (st->st_mode))
-            return true;
+            {
+              stats.files_skipped++;
+              return true;
+            }
         }
       break;
 
@@ -1752,6 +2447,23 @@ open_symlink_nofollow_error (int err)
   return false;
 }
 
+/* Return true if the trigram index shows that the file NAME, relative
+   to DIRDESC and following symlinks if FOLLOW, cannot match.  */
+static bool
+index_rules_out (int dirdesc, char const *name, bool follow)
+{
+  idx_t f = trigram_index_find (trigram_index, filename);
+  if (f < 0 || trigram_index_candidate (trigram_index, f))
+    return false;
+
+  /* The file cannot have matched when it was indexed; rescan it if
+     it might have changed since.  */
+  struct stat st;
+  return (fstatat (dirdesc, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0
+          && S_ISREG (st.st_mode)
+          && trigram_index_unchanged (trigram_index, f, &st));
+}
+
 static bool
 grepfile (int dirdesc, char const *name, bool follow, bool command_line)
 {
@@ -1760,13 +2472,23 @@ grepfile (int dirdesc, char const *name, bool follow, bool command_line)
                   (binary ? O_BINARY : 0))
                | (follow ? 0 : O_NOFOLLOW)
                | (skip_devices (command_line) ? O_NONBLOCK : 0));
+  xtime_t start_time = stats_clock ();
+  if (trigram_index && index_rules_out (dirdesc, name, follow))
+    {
+      stats_charge (PHASE_TRAVERSE, start_time);
+      stats.files_skipped++;
+      return true;
+    }
   int desc = openat_safer (dirdesc, name, oflag);
+  stats_charge (PHASE_TRAVERSE, start_time);
   if (desc < 0)
     {
       if (follow || ! open_symlink_nofollow_error (errno))
         suppressible_error (errno);
       return true;
     }
+  stats.files_opened++;
+  PROBE2 (file__open, filename, desc);
   return grepdesc (desc, command_line);
 }
 
@@ -1840,11 +2562,17 @@ grepdesc (int desc, bool command_line)
 
   if (desc != STDIN_FILENO && skip_devices (command_line)
       && is_device_mode (st.st_mode))
-    goto closeout;
+    {
+      stats.files_skipped++;
+      goto closeout;
+    }
 
   if (desc != STDIN_FILENO && command_line
       && skipped_file (filename, true, S_ISDIR (st.st_mode) != 0))
-    goto closeout;
+    {
+      stats.files_skipped++;
+      goto closeout;
+    }
 
   /* Don't output file names if invoked as 'grep -r PATTERN NONDIRECTORY'.  */
   if (out_file < 0)
@@ -1864,6 +2592,7 @@ grepdesc (int desc, bool command_line)
 
       /* Close DESC now, to conserve file descriptors if the race
          condition occurs many times in a deep recursion.  */
+      PROBE2 (file__close, filename, desc);
       if (close (desc) != 0)
         suppressible_error (errno);
 
@@ -1873,8 +2602,15 @@ grepdesc (int desc, bool command_line)
 
       if (!fts)
         xalloc_die ();
-      while ((ent = fts_read (fts)))
-        status &= grepdirent (fts, ent, command_line);
+      while (true)
+        {
+          xtime_t start_time = stats_clock ();
+          ent = fts_read (fts);
+          stats_charge (PHASE_TRAVERSE, start_time);
+          if (!ent)
+            break;
+          status &= grepdirent (fts, ent, command_line);
+        }
       if (errno)
         suppressible_error (errno);
       if (fts_close (fts) != 0)
@@ -1886,7 +2622,10 @@ grepdesc (int desc, bool command_line)
           || ((devices == SKIP_DEVICES
                || (devices == READ_COMMAND_LINE_DEVICES && !command_line))
               && is_device_mode (st.st_mode))))
-    goto closeout;
+    {
+      stats.files_skipped++;
+      goto closeout;
+    }
 
   /* If there is a regular file on stdout and the current file refers
      to the same i-node, we have to report the problem and skip it.
@@ -1912,10 +2651,38 @@ grepdesc (int desc, bool command_line)
       if (! suppress_errors)
         error (0, 0, _("%s: input file is also the output"), input_filename ());
       errseen = true;
+      stats.files_skipped++;
+      goto closeout;
+    }
+
+  if (build_index_dir)
+    {
+      if (desc != STDIN_FILENO && S_ISREG (st.st_mode)
+          && !trigram_index_add (filename, desc, &st))
+        suppressible_error (errno);
       goto closeout;
     }
 
-  count = grep (desc, &st, &ineof);
+  /* With --cache, a regular file's result is known if the file has
+     not changed since it was last searched with these options.  A
+     result is not cached if a diagnostic was issued.  */
+  bool cacheable = use_cache && desc != STDIN_FILENO && S_ISREG (st.st_mode);
+  if (cacheable && result_cache_lookup (&st, &count))
+    {
+      if (count && exit_on_match)
+        {
+          stdout_errno = -1;
+          exit (EXIT_SUCCESS);
+        }
+    }
+  else
+    {
+      bool errseen_0 = errseen;
+      count = grep (desc, &st, &ineof);
+      if (cacheable && errseen == errseen_0 && !long_line_warned)
+        result_cache_store (&st, count);
+    }
+
   if (count_matches)
     {
       if (out_file)
@@ -1944,8 +2711,12 @@ grepdesc (int desc, bool command_line)
     }
 
  closeout:
-  if (desc != STDIN_FILENO && close (desc) != 0)
-    suppressible_error (errno);
+  if (desc != STDIN_FILENO)
+    {
+      PROBE2 (file__close, filename, desc);
+      if (close (desc) != 0)
+        suppressible_error (errno);
+    }
   return status;
 }
 
@@ -1966,16 +2737,187 @@ grep_command_line_arg (char const *arg)
     }
 }
 
-_Noreturn void usage (int);
-void
-usage (int status)
+/* Return a hash of the options other than the matcher that affect
+   which lines of a file are selected or how many are reported.  */
+static uint64_t
+cache_options (void)
 {
-  if (status != 0)
+  intmax_t const options[] =
     {
-      fprintf (stderr, _("Usage: %s [OPTION]... PATTERNS [FILE]...\n"),
-               getprogname ());
-      fprintf (stderr, _("Try '%s --help' for more information.\n"),
-               getprogname ());
+      match_icase, match_words, match_lines, out_invert,
+      eolbyte, binary_files, max_count, max_line_length, count_matches,
+      list_files, done_on_match, exit_on_match, decompress, binary,
+      max_errors
+    };
+  return result_cache_hash (0, options, sizeof options);
+}
+
+/* The cache_options that the --cache results were recorded with.  */
+static uint64_t given_cache_options;
+
+/* Return a hash of the patterns KEYS of size KEYCC, of the matcher
+   MATCHER, and of everything else that affects which lines of a file
+   are selected or how many are reported, for --cache.  */
+static uint64_t
+cache_key (char const *keys, idx_t keycc, int matcher)
+{
+  intmax_t const options[] = { matcher, given_cache_options };
+  uint64_t h = result_cache_hash (0, VERSION, sizeof VERSION);
+  h = result_cache_hash (h, options, sizeof options);
+#if defined HAVE_SETLOCALE
+  char const *locale = setlocale (LC_ALL, nullptr);
+  h = result_cache_hash (h, locale, strlen (locale) + 1);
+#endif
+  return result_cache_hash (h, keys, keycc);
+}
+
+/* Search the files named by the NUM_OPERANDS operands OPERANDS, or
+   the default input if there are none, and return the exit status.  */
+static int
+search_operands (char *const *operands, idx_t num_operands)
+{
+  out_file = (filename_option == 0 && num_operands <= 1
+              ? - (directories == RECURSE_DIRECTORIES)
+              : 0 <= filename_option);
+
+  char *const *files;
+  if (0 < num_operands)
+    {
+      files = operands;
+    }
+  else if (search_cwd_by_default)
+    {
+      static char *const cwd_only[] = { (char *) ".", nullptr };
+      files = cwd_only;
+      omit_dot_slash = true;
+    }
+  else
+    {
+      static char *const stdin_only[] = { (char *) "-", nullptr };
+      files = stdin_only;
+    }
+
+  /* Print statistics even if grep exits early, as with -q.  */
+  if (show_stats)
+    atexit (print_stats);
+
+  bool status = true;
+  do
+    status &= grep_command_line_arg (*files++);
+  while (*files);
+
+  return errseen ? EXIT_TROUBLE : status;
+}
+
+/* The options that setup_output adjusts to standard output, as given.
+   A context length of -1 means that none was given.  */
+static struct output_options
+{
+  int list_files;
+  bool count_matches;
+  intmax_t out_before;
+  intmax_t out_after;
+  intmax_t default_context;
+  int color_option;
+} given_output = { .out_before = -1, .out_after = -1,
+                   .default_context = -1 };
+
+/* Adjust the options in GIVEN_OUTPUT to the current standard output,
+   which for a --serve request is the client's.  */
+static void
+setup_output (void)
+{
+  list_files = given_output.list_files;
+  count_matches = given_output.count_matches;
+  done_on_match = false;
+  out_before = (given_output.out_before < 0 ? given_output.default_context
+                : given_output.out_before);
+  out_after = (given_output.out_after < 0 ? given_output.default_context
+               : given_output.out_after);
+  color_option = given_output.color_option;
+  memset (&out_stat, 0, sizeof out_stat);
+
+  /* Each line goes to the file of each rule it matches, so there is
+     no one place for context lines.  */
+  if (rules_output_dir && (0 <= out_before || 0 <= out_after))
+    die (EXIT_TROUBLE, 0,
+         _("--rules-output cannot be combined with context options"));
+  dev_null_output = false;
+
+  bool possibly_tty = false;
+  struct stat tmp_stat;
+  if (! exit_on_match && ! rules_output_dir
+      && fstat (STDOUT_FILENO, &tmp_stat) == 0)
+    {
+      if (S_ISREG (tmp_stat.st_mode))
+        out_stat = tmp_stat;
+      else if (S_ISCHR (tmp_stat.st_mode))
+        {
+          struct stat null_stat;
+          if (stat ("/dev/null", &null_stat) == 0
+              && SAME_INODE (tmp_stat, null_stat))
+            dev_null_output = true;
+          else
+            possibly_tty = true;
+        }
+    }
+
+  /* POSIX says -c, -l and -q are mutually exclusive.  In this
+     implementation, -q overrides -l and -L, which in turn override -c.  */
+  if (exit_on_match | dev_null_output)
+    list_files = LISTFILES_NONE;
+  if ((exit_on_match | dev_null_output) || list_files != LISTFILES_NONE)
+    {
+      count_matches = false;
+      if (max_count == INTMAX_MAX)
+        done_on_match = true;
+    }
+  out_quiet = count_matches | done_on_match | exit_on_match;
+
+  /* Context lines are never output with -c, -l, -L or -q, so do not
+     keep them around.  */
+  if (out_quiet)
+    out_before = out_after = 0;
+
+  if (color_option == 2)
+    color_option = possibly_tty && should_colorize () && isatty (STDOUT_FILENO);
+  if (color_option && color_reverse)
+    color_option = -1;
+}
+
+/* Index the files named by the NUM_OPERANDS operands OPERANDS, and
+   the files under them, into the --build-index directory.  Return
+   the exit status.  */
+static int
+build_index (char *const *operands, int num_operands)
+{
+  if (num_operands == 0)
+    {
+      static char *const cwd_only[] = { (char *) ".", nullptr };
+      operands = cwd_only;
+      omit_dot_slash = true;
+    }
+  directories = RECURSE_DIRECTORIES;
+
+  do
+    grep_command_line_arg (*operands++);
+  while (*operands);
+
+  if (!trigram_index_write (build_index_dir))
+    die (EXIT_TROUBLE, errno, "%s", build_index_dir);
+  return errseen ? EXIT_TROUBLE : EXIT_SUCCESS;
+}
+
+_Noreturn void usage (int);
+void
+usage (int status)
+{
+  if (status != 0)
+    {
+      fprintf (stderr, _("Usage: %s [OPTION]... PATTERNS [FILE]...\n"),
+               getprogname ());
+      fprintf (stderr, _("Try '%s --help' for more information.\n"),
+               getprogname ());
     }
   else
     {
@@ -1990,15 +2932,23 @@ Pattern selection and interpretation:\n"), getprogname ());
   -E, --extended-regexp     PATTERNS are extended regular expressions\n\
   -F, --fixed-strings       PATTERNS are strings\n\
   -G, --basic-regexp        PATTERNS are basic regular expressions\n\
-  -P, --perl-regexp         PATTERNS are Perl regular expressions\n"));
+  -P, --perl-regexp         PATTERNS are Perl regular expressions\n\
+      --engine=ENGINE       match using ENGINE: 'auto' (default),\n\
+                            'fixed', 'dfa', or 'regex'\n\
+      --dfa-memory=SIZE     limit the DFA's memory to about SIZE bytes\n\
+      --explain             print how PATTERNS would be matched, and exit\n"));
   /* -X is deliberately undocumented.  */
       printf (_("\
   -e, --regexp=PATTERNS     use PATTERNS for matching\n\
   -f, --file=FILE           take PATTERNS from FILE\n\
+      --rules=FILE          take named sets of PATTERNS from FILE, and\n\
+                            print the names of those each line matches\n\
   -i, --ignore-case         ignore case distinctions in patterns and data\n\
       --no-ignore-case      do not ignore case distinctions (default)\n\
   -w, --word-regexp         match only whole words\n\
   -x, --line-regexp         match only whole lines\n\
+      --max-errors=NUM      with -F, match with at most NUM characters\n\
+                            inserted, deleted or replaced\n\
   -z, --null-data           a data line ends in 0 byte, not newline\n"));
       printf (_("\
 \n\
@@ -2006,6 +2956,12 @@ Miscellaneous:\n\
   -s, --no-messages         suppress error messages\n\
   -v, --invert-match        select non-matching lines\n\
   -V, --version             display version information and exit\n\
+      --stats[=FORMAT]      print statistics to standard error at exit;\n\
+                            FORMAT is 'text' (default) or 'json'\n\
+      --pattern-profile     print to standard error at exit how costly\n\
+                            each pattern was, the most costly first\n\
+      --serve=SOCKET        answer searches from clients on SOCKET\n\
+      --client=SOCKET       search FILEs with the server on SOCKET\n\
       --help                display this help text and exit\n"));
       printf (_("\
 \n\
@@ -2014,9 +2970,12 @@ Output control:\n\
   -b, --byte-offset         print the byte offset with output lines\n\
   -n, --line-number         print line number with output lines\n\
       --line-buffered       flush output on every line\n\
+      --max-line-length=NUM  skip lines longer than NUM bytes\n\
   -H, --with-filename       print file name with output lines\n\
   -h, --no-filename         suppress the file name prefix on output\n\
       --label=LABEL         use LABEL as the standard input file name prefix\n\
+      --rules-output=DIR    with --rules, output the lines each set matches\n\
+                            to a file in DIR named after the set\n\
 "));
       printf (_("\
   -o, --only-matching       show only nonempty parts of lines that match\n\
@@ -2033,6 +2992,10 @@ Output control:\n\
                             ACTION is 'read' or 'skip'\n\
   -r, --recursive           like --directories=recurse\n\
   -R, --dereference-recursive  likewise, but follow all symlinks\n\
+      --decompress          search the contents of gzip, bzip2, xz and\n\
+                            zstd compressed files\n\
+      --decompress-threads=NUM  decode independent compressed frames\n\
+                            with NUM threads\n\
 "));
       printf (_("\
       --include=GLOB        search only files that match GLOB (a file pattern)"
@@ -2040,6 +3003,9 @@ Output control:\n\
       --exclude=GLOB        skip files that match GLOB\n\
       --exclude-from=FILE   skip files that match any file pattern from FILE\n\
       --exclude-dir=GLOB    skip directories that match GLOB\n\
+      --build-index=DIR     index the files under FILEs into DIR, and exit\n\
+      --cache=FILE          reuse results of -c, -l, -L and -q from FILE\n\
+      --use-index=DIR       skip files that the index in DIR rules out\n\
 "));
       printf (_("\
   -L, --files-without-match  print only names of FILEs with no selected lines\n\
@@ -2082,19 +3048,74 @@ static struct
   int syntax; /* used if compile == GEAcompile */
   compile_fp_t compile;
   execute_fp_t execute;
+  count_fp_t count;
+  explain_fp_t explain;
+  costs_fp_t costs;
+  reset_fp_t reset;
 } const matchers[] = {
-  { "grep", RE_SYNTAX_GREP, GEAcompile, EGexecute },
-  { "egrep", RE_SYNTAX_EGREP, GEAcompile, EGexecute },
-  { "fgrep", 0, Fcompile, Fexecute, },
-  { "awk", RE_SYNTAX_AWK, GEAcompile, EGexecute },
-  { "gawk", RE_SYNTAX_GNU_AWK, GEAcompile, EGexecute },
-  { "posixawk", RE_SYNTAX_POSIX_AWK, GEAcompile, EGexecute },
+  { "grep", RE_SYNTAX_GREP, GEAcompile, EGexecute, GEAcount, GEAexplain,
+    GEAcosts, GEAreset },
+  { "egrep", RE_SYNTAX_EGREP, GEAcompile, EGexecute, GEAcount, GEAexplain,
+    GEAcosts, GEAreset },
+  { "fgrep", 0, Fcompile, Fexecute, Fcount, Fexplain, Fcosts, Freset },
+  { "awk", RE_SYNTAX_AWK, GEAcompile, EGexecute, GEAcount, GEAexplain,
+    GEAcosts, GEAreset },
+  { "gawk", RE_SYNTAX_GNU_AWK, GEAcompile, EGexecute, GEAcount,
+    GEAexplain, GEAcosts, GEAreset },
+  { "posixawk", RE_SYNTAX_POSIX_AWK, GEAcompile, EGexecute, GEAcount,
+    GEAexplain, GEAcosts, GEAreset },
+  { "approx", 0, Acompile, Aexecute, Acount, Aexplain, nullptr, nullptr },
 #if HAVE_LIBPCRE
-  { "perl", 0, Pcompile, Pexecute, },
+  { "perl", 0, Pcompile, Pexecute, nullptr, Pexplain, nullptr, nullptr },
 #endif
 };
 /* Keep these in sync with the 'matchers' table.  */
-enum { E_MATCHER_INDEX = 1, F_MATCHER_INDEX = 2, G_MATCHER_INDEX = 0 };
+enum { E_MATCHER_INDEX = 1, F_MATCHER_INDEX = 2, G_MATCHER_INDEX = 0,
+       A_MATCHER_INDEX = 6 };
+
+enum engine_type
+  {
+    AUTO_ENGINE,
+    FIXED_ENGINE,
+    DFA_ENGINE,
+    REGEX_ENGINE
+  };
+
+/* How to match, for --engine.  */
+static char const *const engine_args[] =
+{
+  "auto", "fixed", "dfa", "regex", nullptr
+};
+static enum engine_type const engine_types[] =
+{
+  AUTO_ENGINE, FIXED_ENGINE, DFA_ENGINE, REGEX_ENGINE
+};
+ARGMATCH_VERIFY (engine_args, engine_types);
+
+static enum engine_type engine = AUTO_ENGINE;
+
+/* Print the matching plan and exit, for --explain.  */
+static bool explain;
+
+/* Print the plan for matching, for --explain.  REQUESTED is the index
+   of the matcher requested and MATCHER that of the one chosen, for the
+   reason REWRITE if they differ.  */
+static void
+explain_plan (int requested, int matcher, char const *rewrite)
+{
+  printf_errno (_("matcher: %s\n"), matchers[matcher].name);
+  if (matcher != requested)
+    printf_errno (_("rewritten from: %s, %s\n"),
+                  matchers[requested].name, rewrite);
+  printf_errno (_("engine: %s\n"), engine_args[engine]);
+  printf_errno (_("patterns: %td\n"), n_patterns);
+  if (nrules)
+    printf_errno (_("rules: %td\n"), nrules);
+  matchers[matcher].explain (compiled_pattern, printf_errno);
+  fflush_errno ();
+  if (stdout_errno)
+    die (EXIT_TROUBLE, stdout_errno, _("write error"));
+}
 
 /* Return the index of the matcher corresponding to M if available.
    MATCHER is the index of the previous matcher, or -1 if none.
@@ -2236,22 +3257,6 @@ parse_grep_colors (void)
       return;
 }
 
-/* Return true if PAT (of length PATLEN) contains an encoding error.  */
-static bool
-contains_encoding_error (char const *pat, idx_t patlen)
-{
-  mbstate_t mbs; mbszero (&mbs);
-  ptrdiff_t charlen;
-
-  for (idx_t i = 0; i < patlen; i += charlen)
-    {
-      charlen = mb_clen (pat + i, patlen - i, &mbs);
-      if (charlen < 0)
-        return true;
-    }
-  return false;
-}
-
 /* When ignoring case and (-E or -F or -G), then for each single-byte
    character I, ok_fold[I] is 1 if every case folded counterpart of I
    is also single-byte, and is -1 otherwise.  */
@@ -2339,50 +3344,6 @@ fgrep_icase_available (char const *pat, idx_t patlen)
   return true;
 }
 
-/* Change the pattern *KEYS_P, of size *LEN_P, from fgrep to grep style.  */
-
-void
-fgrep_to_grep_pattern (char **keys_p, idx_t *len_p)
-{
-  idx_t len = *len_p;
-  char *keys = *keys_p;
-  mbstate_t mb_state; mbszero (&mb_state);
-  char *new_keys = xnmalloc (len + 1, 2);
-  char *p = new_keys;
-
-  for (ptrdiff_t n; len; keys += n, len -= n)
-    {
-      n = mb_clen (keys, len, &mb_state);
-      switch (n)
-        {
-        case -2:
-          n = len;
-          FALLTHROUGH;
-        default:
-          p = mempcpy (p, keys, n);
-          break;
-
-        case -1:
-          memset (&mb_state, 0, sizeof mb_state);
-          n = 1;
-          FALLTHROUGH;
-        case 1:
-          switch (*keys)
-            {
-            case '$': case '*': case '.': case '[': case '\\': case '^':
-              *p++ = '\\'; break;
-            }
-          *p++ = *keys;
-          break;
-        }
-    }
-
-  *p = '\n';
-  free (*keys_p);
-  *keys_p = new_keys;
-  *len_p = p - new_keys;
-}
-
 /* If it is easy, convert the MATCHER-style patterns KEYS (of size
    *LEN_P) to -F style, update *LEN_P to a possibly-smaller value, and
    return F_MATCHER_INDEX.  If not, leave KEYS and *LEN_P alone and
@@ -2463,6 +3424,409 @@ try_fgrep_pattern (int matcher, char *keys, idx_t *len_p)
   return result;
 }
 
+/* Compile each pattern by itself for --pattern-profile, with MATCHER
+   and OPTS as for all the patterns.  TEXT holds the patterns as given,
+   and KEYS holds them as converted for MATCHER, each terminated by
+   '\n'.  */
+static void
+compile_profiles (char const *text, char const *keys, int matcher,
+                  struct matchopts const *opts)
+{
+  /* Any warnings were given when compiling all the patterns.  */
+  struct matchopts profile_opts = *opts;
+  profile_opts.quiet = true;
+
+  profiles = xinmalloc (n_patterns, sizeof *profiles);
+  for (idx_t i = 0; i < n_patterns; i++)
+    {
+      char const *text_end = rawmemchr (text, '\n');
+      char const *keys_end = rawmemchr (keys, '\n');
+      char *pattern = ximemdup (keys, keys_end - keys + 1);
+      idx_t heap = heap_in_use ();
+      void *compiled = matchers[matcher].compile (pattern, keys_end - keys,
+                                                  matchers[matcher].syntax,
+                                                  false, &profile_opts);
+      idx_t memory = heap < 0 ? -1 : MAX (0, heap_in_use () - heap);
+      profiles[i] = (struct pattern_profile) { .text = text,
+                                               .len = text_end - text,
+                                               .lineno = i,
+                                               .compiled = compiled,
+                                               .memory = memory };
+      text = text_end + 1;
+      keys = keys_end + 1;
+    }
+}
+
+/* Compare the profiles A and B so that the more costly comes first:
+   the one with more calls to the slower matchers, then the one that
+   took more memory to compile, then the one given first.  */
+static int
+compare_profiles (void const *a, void const *b)
+{
+  struct pattern_profile const *p = a;
+  struct pattern_profile const *q = b;
+  intmax_t p_calls = p->regex_calls + p->backref_calls;
+  intmax_t q_calls = q->regex_calls + q->backref_calls;
+  if (p_calls != q_calls)
+    return p_calls < q_calls ? 1 : -1;
+  if (p->memory != q->memory)
+    return p->memory < q->memory ? 1 : -1;
+  return (p->lineno > q->lineno) - (p->lineno < q->lineno);
+}
+
+/* Print the profile of each pattern for --pattern-profile, the most
+   costly first.  */
+static void
+print_pattern_profile (void)
+{
+  /* Flush any output first, leaving errors for close_stdout.  */
+  fflush (stdout);
+
+  struct pattern_cost const *costs;
+  idx_t ncosts = pattern_costs ? pattern_costs (compiled_pattern, &costs) : 0;
+  for (idx_t i = 0; i < ncosts; i++)
+    if (0 <= costs[i].lineno)
+      {
+        profiles[costs[i].lineno].regex_calls = costs[i].regex_calls;
+        profiles[costs[i].lineno].backref_calls = costs[i].backref_calls;
+      }
+    else if (costs[i].regex_calls)
+      fprintf (stderr, _("%s: patterns without back-references together:"
+                         " %jd regex calls\n"),
+               getprogname (), costs[i].regex_calls);
+
+  qsort (profiles, n_patterns, sizeof *profiles, compare_profiles);
+  for (idx_t i = 0; i < n_patterns; i++)
+    {
+      struct pattern_profile const *p = &profiles[i];
+      idx_t fileline;
+      char const *file = pattern_file_name (p->lineno, &fileline);
+      fprintf (stderr, "%s: ", getprogname ());
+      if (*file)
+        fprintf (stderr, "%s:%td: ", file, fileline);
+      fprintf (stderr, _("%jd regex calls, %jd back-reference calls, "),
+               p->regex_calls, p->backref_calls);
+      if (0 <= p->memory)
+        fprintf (stderr, _("%td bytes compiled, "), p->memory);
+      fprintf (stderr, _("%jd matches: "), p->matches);
+      fwrite (p->text, 1, p->len, stderr);
+      putc ('\n', stderr);
+    }
+}
+
+/* Read the --rules file FILE, each of whose lines is a rule name, a
+   colon, and a pattern.  Add each pattern to the rule of that name,
+   creating the rule if need be.  Return the patterns of all the rules,
+   each terminated by '\n', and set *KEYCC to their size.  */
+static char *
+read_rules (char const *file, idx_t *keycc)
+{
+  FILE *fp;
+  if (STREQ (file, "-"))
+    {
+      if (binary)
+        xset_binary_mode (STDIN_FILENO, O_BINARY);
+      fp = stdin;
+    }
+  else
+    {
+      fp = fopen (file, binary ? "rb" : "r");
+      if (!fp)
+        die (EXIT_TROUBLE, errno, "%s", file);
+    }
+  char *buf = nullptr;
+  idx_t size = 0, alloc = 0, cc;
+  for (;; size += cc)
+    {
+      ptrdiff_t shortage = size - alloc + 2;
+      if (0 < shortage)
+        buf = xpalloc (buf, &alloc, shortage, -1, 1);
+      cc = fread (buf + size, 1, alloc - (size + 1), fp);
+      if (cc == 0)
+        break;
+    }
+  int err = errno;
+  if (!ferror (fp))
+    {
+      err = 0;
+      if (fp == stdin)
+        clearerr (fp);
+      else if (fclose (fp) != 0)
+        err = errno;
+    }
+  if (err)
+    die (EXIT_TROUBLE, err, "%s", file);
+  if (size != 0 && buf[size - 1] != '\n')
+    buf[size++] = '\n';
+
+  /* Remove the names, leaving the patterns in BUF.  */
+  char *dst = buf;
+  idx_t lineno = 0;
+  for (char *line = buf; line < buf + size; )
+    {
+      char *eol = rawmemchr (line, '\n');
+      char *colon = memchr (line, ':', eol - line);
+      lineno++;
+      if (!colon || colon == line)
+        die (EXIT_TROUBLE, 0, _("%s:%td: missing rule name"), file, lineno);
+
+      /* Each name is used as a file name for --rules-output, and
+         names are separated by commas on output.  */
+      idx_t namelen = colon - line;
+      for (char const *p = line; p < colon; p++)
+        if (strchr ("/,", *p))
+          die (EXIT_TROUBLE, 0, _("%s:%td: invalid rule name"), file, lineno);
+      if (line[0] == '.' && (namelen == 1 || (namelen == 2 && line[1] == '.')))
+        die (EXIT_TROUBLE, 0, _("%s:%td: invalid rule name"), file, lineno);
+
+      idx_t i;
+      for (i = 0; i < nrules; i++)
+        if (strncmp (rules[i].name, line, namelen) == 0
+            && !rules[i].name[namelen])
+          break;
+      if (i == nrules)
+        {
+          if (nrules == rules_allocated)
+            rules = xpalloc (rules, &rules_allocated, 1, -1, sizeof *rules);
+          rules[nrules++]
+            = (struct rule) { .name = ximemdup0 (line, namelen) };
+        }
+
+      struct rule *r = &rules[i];
+      char const *pat = colon + 1;
+      idx_t patsize = eol + 1 - pat;
+      ptrdiff_t shortage = r->keycc - r->keyalloc + patsize;
+      if (0 < shortage)
+        r->keys = xpalloc (r->keys, &r->keyalloc, shortage, -1, 1);
+      memcpy (r->keys + r->keycc, pat, patsize);
+      r->keycc += patsize;
+
+      memmove (dst, pat, patsize);
+      dst += patsize;
+      line = eol + 1;
+    }
+
+  *keycc = dst - buf;
+  return buf;
+}
+
+/* Compile the patterns of each rule by themselves, with OPTS and
+   EXACT as for all the patterns.  All the patterns were converted from
+   the syntax of the matcher REQUESTED to that of MATCHER, so convert
+   the patterns of each rule likewise.  */
+static void
+compile_rules (int requested, int matcher, bool exact,
+               struct matchopts const *opts)
+{
+  /* Any warnings were given when compiling all the patterns.  */
+  struct matchopts rule_opts = *opts;
+  rule_opts.quiet = true;
+
+  for (idx_t i = 0; i < nrules; i++)
+    {
+      struct rule *r = &rules[i];
+      idx_t keycc = r->keycc - 1;
+      int m = matcher;
+      if (requested == F_MATCHER_INDEX && matcher == G_MATCHER_INDEX)
+        fgrep_to_grep_pattern (&r->keys, &keycc);
+      else if (requested != F_MATCHER_INDEX && matcher == F_MATCHER_INDEX)
+        m = try_fgrep_pattern (requested, r->keys, &keycc);
+      r->execute = matchers[m].execute;
+      r->reset = matchers[m].reset;
+      r->compiled = matchers[m].compile (r->keys, keycc, matchers[m].syntax,
+                                         exact, &rule_opts);
+    }
+}
+
+/* Create the directory DIR if need be, and in it a file named after
+   each rule, for the lines that the rule matches.  */
+static void
+open_rules_output (char const *dir)
+{
+  if (mkdir (dir, S_IRWXU | S_IRWXG | S_IRWXO) != 0 && errno != EEXIST)
+    die (EXIT_TROUBLE, errno, "%s", dir);
+  idx_t dirlen = strlen (dir);
+  for (idx_t i = 0; i < nrules; i++)
+    {
+      struct rule *r = &rules[i];
+      r->out_name = ximalloc (dirlen + sizeof "/" + strlen (r->name));
+      stpcpy (stpcpy (stpcpy (r->out_name, dir), "/"), r->name);
+      r->out = fopen (r->out_name, binary ? "wb" : "w");
+      if (!r->out)
+        die (EXIT_TROUBLE, errno, "%s", r->out_name);
+    }
+}
+
+/* Close the --rules-output files, reporting any write error.  */
+static void
+close_rules_output (void)
+{
+  for (idx_t i = 0; i < nrules; i++)
+    if (close_stream (rules[i].out) != 0)
+      die (EXIT_TROUBLE, errno, "%s: %s", rules[i].out_name,
+           _("write error"));
+}
+
+/* Handle the option OPT, with the argument OPTARG, if it is one of
+   those that affect only the output, which a --client may give.
+   Return true if it is.  */
+static bool
+output_option (int opt)
+{
+  switch (opt)
+    {
+    case 'A':
+      context_length_arg (optarg, &given_output.out_after);
+      break;
+
+    case 'B':
+      context_length_arg (optarg, &given_output.out_before);
+      break;
+
+    case 'C':
+      /* Set output match context, but let any explicit leading or
+         trailing amount specified with -A or -B stand. */
+      context_length_arg (optarg, &given_output.default_context);
+      break;
+
+    case 'H':
+      filename_option = 1;
+      break;
+
+    case 'T':
+      align_tabs = true;
+      break;
+
+    case 'b':
+      out_byte = true;
+      break;
+
+    case 'c':
+      given_output.count_matches = true;
+      break;
+
+    case 'h':
+      filename_option = -1;
+      break;
+
+    case 'L':
+      /* Like -l, except list files that don't contain matches.
+         Inspired by the same option in Hume's gre. */
+      given_output.list_files = LISTFILES_NONMATCHING;
+      break;
+
+    case 'l':
+      given_output.list_files = LISTFILES_MATCHING;
+      break;
+
+    case 'm':
+      switch (xstrtoimax (optarg, nullptr, 10, &max_count, ""))
+        {
+        case LONGINT_OK:
+        case LONGINT_OVERFLOW:
+          break;
+
+        default:
+          die (EXIT_TROUBLE, 0, _("invalid max count"));
+        }
+      break;
+
+    case 'n':
+      out_line = true;
+      break;
+
+    case 'o':
+      only_matching = true;
+      break;
+
+    case 'q':
+      exit_on_match = true;
+      break;
+
+    case 's':
+      suppress_errors = true;
+      break;
+
+    case 'Z':
+      filename_mask = 0;
+      break;
+
+    case COLOR_OPTION:
+      if (optarg)
+        {
+          if (!c_strcasecmp (optarg, "always")
+              || !c_strcasecmp (optarg, "yes")
+              || !c_strcasecmp (optarg, "force"))
+            given_output.color_option = 1;
+          else if (!c_strcasecmp (optarg, "never")
+                   || !c_strcasecmp (optarg, "no")
+                   || !c_strcasecmp (optarg, "none"))
+            given_output.color_option = 0;
+          else if (!c_strcasecmp (optarg, "auto")
+                   || !c_strcasecmp (optarg, "tty")
+                   || !c_strcasecmp (optarg, "if-tty"))
+            given_output.color_option = 2;
+          else
+            show_help = 1;
+        }
+      else
+        given_output.color_option = 2;
+      break;
+
+    case GROUP_SEPARATOR_OPTION:
+      group_separator = optarg;
+      break;
+
+    case LINE_BUFFERED_OPTION:
+      line_buffered = true;
+      break;
+
+    case LABEL_OPTION:
+      label = optarg;
+      break;
+
+    default:
+      return false;
+    }
+  return true;
+}
+
+/* Search the operands of a --serve request, whose standard output
+   is the client's, after applying the NOPTIONS output options
+   OPTIONS of the client as if they followed the server's own.  */
+static int
+serve_search (char *const *options, idx_t noptions,
+              char *const *operands, idx_t num_operands)
+{
+  char **argv = xinmalloc (noptions + 2, sizeof *argv);
+  argv[0] = (char *) getprogname ();
+  memcpy (argv + 1, options, noptions * sizeof *argv);
+  argv[noptions + 1] = nullptr;
+  optind = 0;
+  int opt;
+  while ((opt = get_nondigit_option (noptions + 1, argv,
+                                     &given_output.default_context))
+         != -1)
+    if (opt != CLIENT_OPTION && !output_option (opt))
+      die (EXIT_TROUBLE, 0, _("--client takes only output options"));
+  free (argv);
+
+  setup_output ();
+
+  /* The server's result cache and index hold for its own options
+     only.  */
+  if (use_cache && cache_options () != given_cache_options)
+    use_cache = false;
+  if (count_matches || list_files == LISTFILES_NONMATCHING)
+    trigram_index = nullptr;
+
+  if (max_count == 0 && list_files != LISTFILES_NONMATCHING)
+    return EXIT_FAILURE;
+  count_matching_lines = (count_matches && max_count == INTMAX_MAX
+                          ? matcher_count : nullptr);
+  return search_operands (operands, num_operands);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -2471,24 +3835,25 @@ main (int argc, char **argv)
   int matcher = -1;
   int opt;
   int prev_optind, last_recursive;
-  intmax_t default_context;
+  char const *use_index_dir = nullptr;
+  char const *cache_file = nullptr;
+  char const *serve_socket = nullptr;
+  char const *client_socket = nullptr;
+
+  /* The number of options other than -NUM, and of those that affect
+     only the output, as --client allows no others.  */
+  int noptions = 0;
+  int noutput_options = 0;
   FILE *fp;
   exit_failure = EXIT_TROUBLE;
   initialize_main (&argc, &argv);
 
-  /* Which command-line options have been specified for filename output.
-     -1 for -h, 1 for -H, 0 for neither.  */
-  int filename_option = 0;
-
   eolbyte = '\n';
   filename_mask = ~0;
 
   max_count = INTMAX_MAX;
+  max_line_length = INTMAX_MAX;
 
-  /* The value -1 means to use DEFAULT_CONTEXT. */
-  out_after = out_before = -1;
-  /* Default before/after context: changed by -C/-NUM options */
-  default_context = -1;
   /* Changed by -o option */
   only_matching = false;
 
@@ -2504,6 +3869,7 @@ main (int argc, char **argv)
 
   init_localeinfo (&localeinfo);
 
+  out_stream = stdout;
   atexit (clean_up_stdout);
   c_stack_action (nullptr);
 
@@ -2515,23 +3881,11 @@ main (int argc, char **argv)
     xalloc_die ();
 
   while (prev_optind = optind,
-         (opt = get_nondigit_option (argc, argv, &default_context)) != -1)
+         (opt = get_nondigit_option (argc, argv,
+                                     &given_output.default_context)) != -1
+         && ++noptions)
     switch (opt)
       {
-      case 'A':
-        context_length_arg (optarg, &out_after);
-        break;
-
-      case 'B':
-        context_length_arg (optarg, &out_before);
-        break;
-
-      case 'C':
-        /* Set output match context, but let any explicit leading or
-           trailing amount specified with -A or -B stand. */
-        context_length_arg (optarg, &default_context);
-        break;
-
       case 'D':
         if (STREQ (optarg, "read"))
           devices = READ_DEVICES;
@@ -2561,18 +3915,10 @@ main (int argc, char **argv)
         matcher = setmatcher (optarg, matcher);
         break;
 
-      case 'H':
-        filename_option = 1;
-        break;
-
       case 'I':
         binary_files = WITHOUT_MATCH_BINARY_FILES;
         break;
 
-      case 'T':
-        align_tabs = true;
-        break;
-
       case 'U':
         if (O_BINARY)
           binary = true;
@@ -2586,14 +3932,6 @@ main (int argc, char **argv)
         binary_files = TEXT_BINARY_FILES;
         break;
 
-      case 'b':
-        out_byte = true;
-        break;
-
-      case 'c':
-        count_matches = true;
-        break;
-
       case 'd':
         directories = XARGMATCH ("--directories", optarg,
                                  directories_args, directories_types);
@@ -2656,10 +3994,6 @@ main (int argc, char **argv)
         }
         break;
 
-      case 'h':
-        filename_option = -1;
-        break;
-
       case 'i':
       case 'y':			/* For old-timers . . . */
         match_icase = true;
@@ -2669,38 +4003,32 @@ main (int argc, char **argv)
         match_icase = false;
         break;
 
-      case 'L':
-        /* Like -l, except list files that don't contain matches.
-           Inspired by the same option in Hume's gre. */
-        list_files = LISTFILES_NONMATCHING;
-        break;
-
-      case 'l':
-        list_files = LISTFILES_MATCHING;
-        break;
-
-      case 'm':
-        switch (xstrtoimax (optarg, nullptr, 10, &max_count, ""))
+      case MAX_LINE_LENGTH_OPTION:
+        switch (xstrtoimax (optarg, nullptr, 10, &max_line_length, ""))
           {
           case LONGINT_OK:
           case LONGINT_OVERFLOW:
-            break;
-
+            if (0 <= max_line_length)
+              break;
+            FALLTHROUGH;
           default:
-            die (EXIT_TROUBLE, 0, _("invalid max count"));
+            die (EXIT_TROUBLE, 0, _("invalid maximum line length"));
           }
         break;
 
-      case 'n':
-        out_line = true;
-        break;
-
-      case 'o':
-        only_matching = true;
+      case STATS_OPTION:
+        if (!optarg || STREQ (optarg, "text"))
+          stats_json = false;
+        else if (STREQ (optarg, "json"))
+          stats_json = true;
+        else
+          die (EXIT_TROUBLE, 0, _("unknown stats format"));
+        show_stats = true;
+        stats_start_time = gethrxtime ();
         break;
 
-      case 'q':
-        exit_on_match = true;
+      case USE_INDEX_OPTION:
+        use_index_dir = optarg;
         break;
 
       case 'R':
@@ -2711,10 +4039,6 @@ main (int argc, char **argv)
         last_recursive = prev_optind;
         break;
 
-      case 's':
-        suppress_errors = true;
-        break;
-
       case 'v':
         out_invert = true;
         break;
@@ -2728,14 +4052,26 @@ main (int argc, char **argv)
         match_lines = true;
         break;
 
-      case 'Z':
-        filename_mask = 0;
-        break;
-
       case 'z':
         eolbyte = '\0';
         break;
 
+      case BUILD_INDEX_OPTION:
+        build_index_dir = optarg;
+        break;
+
+      case CACHE_OPTION:
+        cache_file = optarg;
+        break;
+
+      case CLIENT_OPTION:
+        client_socket = optarg;
+        break;
+
+      case SERVE_OPTION:
+        serve_socket = optarg;
+        break;
+
       case BINARY_FILES_OPTION:
         if (STREQ (optarg, "binary"))
           binary_files = BINARY_BINARY_FILES;
@@ -2747,26 +4083,89 @@ main (int argc, char **argv)
           die (EXIT_TROUBLE, 0, _("unknown binary-files type"));
         break;
 
-      case COLOR_OPTION:
-        if (optarg)
-          {
-            if (!c_strcasecmp (optarg, "always")
-                || !c_strcasecmp (optarg, "yes")
-                || !c_strcasecmp (optarg, "force"))
-              color_option = 1;
-            else if (!c_strcasecmp (optarg, "never")
-                     || !c_strcasecmp (optarg, "no")
-                     || !c_strcasecmp (optarg, "none"))
-              color_option = 0;
-            else if (!c_strcasecmp (optarg, "auto")
-                     || !c_strcasecmp (optarg, "tty")
-                     || !c_strcasecmp (optarg, "if-tty"))
-              color_option = 2;
-            else
-              show_help = 1;
-          }
-        else
-          color_option = 2;
+      case DECOMPRESS_OPTION:
+#if !HAVE_DECOMPRESS
+        die (EXIT_TROUBLE, 0,
+             _("--decompress not supported in a --disable-decompress build"));
+#endif
+        decompress = true;
+        break;
+
+      case DECOMPRESS_THREADS_OPTION:
+#if !HAVE_DECOMPRESS
+        die (EXIT_TROUBLE, 0,
+             _("--decompress-threads not supported"
+               " in a --disable-decompress build"));
+#else
+        {
+          intmax_t nthreads;
+          switch (xstrtoimax (optarg, nullptr, 10, &nthreads, ""))
+            {
+            case LONGINT_OK:
+            case LONGINT_OVERFLOW:
+              if (0 <= nthreads)
+                break;
+              FALLTHROUGH;
+            default:
+              die (EXIT_TROUBLE, 0, _("invalid number of threads"));
+            }
+          decompress_threads = MIN (nthreads, IDX_MAX);
+        }
+#endif
+        break;
+
+      case DFA_MEMORY_OPTION:
+        {
+          intmax_t size;
+          switch (xstrtoimax (optarg, nullptr, 10, &size, "kKmMgGtT"))
+            {
+            case LONGINT_OK:
+            case LONGINT_OVERFLOW:
+              if (0 <= size)
+                break;
+              FALLTHROUGH;
+            default:
+              die (EXIT_TROUBLE, 0, _("invalid DFA memory limit"));
+            }
+          dfa_memory = MIN (size, IDX_MAX);
+        }
+        break;
+
+      case MAX_ERRORS_OPTION:
+        {
+          intmax_t n;
+          switch (xstrtoimax (optarg, nullptr, 10, &n, ""))
+            {
+            case LONGINT_OK:
+            case LONGINT_OVERFLOW:
+              if (0 <= n)
+                break;
+              FALLTHROUGH;
+            default:
+              die (EXIT_TROUBLE, 0, _("invalid maximum number of errors"));
+            }
+          max_errors = MIN (n, IDX_MAX);
+        }
+        break;
+
+      case PATTERN_PROFILE_OPTION:
+        pattern_profile = true;
+        break;
+
+      case RULES_OPTION:
+        rules_file = optarg;
+        break;
+
+      case RULES_OUTPUT_OPTION:
+        rules_output_dir = optarg;
+        break;
+
+      case ENGINE_OPTION:
+        engine = XARGMATCH ("--engine", optarg, engine_args, engine_types);
+        break;
+
+      case EXPLAIN_OPTION:
+        explain = true;
         break;
 
       case EXCLUDE_OPTION:
@@ -2803,24 +4202,14 @@ main (int argc, char **argv)
           }
         break;
 
-      case GROUP_SEPARATOR_OPTION:
-        group_separator = optarg;
-        break;
-
-      case LINE_BUFFERED_OPTION:
-        line_buffered = true;
-        break;
-
-      case LABEL_OPTION:
-        label = optarg;
-        break;
-
       case 0:
         /* long options */
         break;
 
       default:
-        usage (EXIT_TROUBLE);
+        if (!output_option (opt))
+          usage (EXIT_TROUBLE);
+        noutput_options++;
         break;
 
       }
@@ -2840,6 +4229,42 @@ main (int argc, char **argv)
   if (show_help)
     usage (EXIT_SUCCESS);
 
+  if (dfa_memory && heap_in_use () < 0)
+    {
+      error (0, 0, _("warning: --dfa-memory is not supported on this system"));
+      dfa_memory = 0;
+    }
+
+  /* A client's options and patterns are those of its server, so its
+     operands are all files.  */
+  if (client_socket)
+    {
+      if (noptions != 1 + noutput_options)
+        die (EXIT_TROUBLE, 0, _("--client takes only output options"));
+      return serve_client (client_socket, argv + 1, optind - 1,
+                           argv + optind, argc - optind);
+    }
+
+  if (build_index_dir)
+    {
+      if (keys)
+        die (EXIT_TROUBLE, 0, _("--build-index does not take patterns"));
+      return build_index (argv + optind, argc - optind);
+    }
+
+  if (rules_file)
+    {
+      if (keys)
+        die (EXIT_TROUBLE, 0, _("--rules cannot be combined with -e or -f"));
+      if (out_invert)
+        die (EXIT_TROUBLE, 0, _("--rules cannot be combined with -v"));
+      pattern_array = keys = read_rules (rules_file, &keycc);
+      keycc = update_patterns (keys, 0, keycc, rules_file);
+      matched_rules = xinmalloc (nrules, sizeof *matched_rules);
+    }
+  else if (rules_output_dir)
+    die (EXIT_TROUBLE, 0, _("--rules-output requires --rules"));
+
   if (keys)
     {
       if (keycc == 0)
@@ -2874,39 +4299,8 @@ main (int argc, char **argv)
 
   hash_free (pattern_table);
 
-  bool possibly_tty = false;
-  struct stat tmp_stat;
-  if (! exit_on_match && fstat (STDOUT_FILENO, &tmp_stat) == 0)
-    {
-      if (S_ISREG (tmp_stat.st_mode))
-        out_stat = tmp_stat;
-      else if (S_ISCHR (tmp_stat.st_mode))
-        {
-          struct stat null_stat;
-          if (stat ("/dev/null", &null_stat) == 0
-              && SAME_INODE (tmp_stat, null_stat))
-            dev_null_output = true;
-          else
-            possibly_tty = true;
-        }
-    }
-
-  /* POSIX says -c, -l and -q are mutually exclusive.  In this
-     implementation, -q overrides -l and -L, which in turn override -c.  */
-  if (exit_on_match | dev_null_output)
-    list_files = LISTFILES_NONE;
-  if ((exit_on_match | dev_null_output) || list_files != LISTFILES_NONE)
-    {
-      count_matches = false;
-      if (max_count == INTMAX_MAX)
-        done_on_match = true;
-    }
-  out_quiet = count_matches | done_on_match | exit_on_match;
-
-  if (out_after < 0)
-    out_after = default_context;
-  if (out_before < 0)
-    out_before = default_context;
+  out_rules = nrules && !rules_output_dir;
+  setup_output ();
 
   /* If it is easy to see that matching cannot succeed (e.g., 'grep -f
      /dev/null'), fail without reading the input.  */
@@ -2915,11 +4309,14 @@ main (int argc, char **argv)
       && list_files != LISTFILES_NONMATCHING)
     return EXIT_FAILURE;
 
-  if (color_option == 2)
-    color_option = possibly_tty && should_colorize () && isatty (STDOUT_FILENO);
+  /* A server colors the output of those clients whose output is a
+     terminal or that ask for color, and its clients may give -o, so
+     it needs the colors and the exact matchers even if its own output
+     needs neither.  */
+  bool may_color = color_option || serve_socket;
   init_colorize ();
 
-  if (color_option)
+  if (may_color)
     {
       /* Legacy.  */
       char *userval = getenv ("GREP_COLOR");
@@ -2946,8 +4343,30 @@ main (int argc, char **argv)
   if (matcher < 0)
     matcher = G_MATCHER_INDEX;
 
-  if (matcher == F_MATCHER_INDEX
-      || matcher == E_MATCHER_INDEX || matcher == G_MATCHER_INDEX)
+  int requested_matcher = matcher;
+  char const *rewrite = nullptr;
+
+  /* Keep the patterns as given, to show in the profile.  */
+  char *profile_text = pattern_profile ? ximemdup (keys, keycc + 1) : nullptr;
+
+  /* Approximate matching has its own matcher, for -F patterns.  */
+  if (max_errors)
+    {
+      if (matcher != F_MATCHER_INDEX)
+        die (EXIT_TROUBLE, 0, _("--max-errors requires -F"));
+      if (match_words)
+        die (EXIT_TROUBLE, 0, _("--max-errors cannot be combined with -w"));
+      if (engine != AUTO_ENGINE)
+        die (EXIT_TROUBLE, 0, _("--engine=%s does not support --max-errors"),
+             engine_args[engine]);
+      if (localeinfo.multibyte && !localeinfo.using_utf8)
+        die (EXIT_TROUBLE, 0,
+             _("--max-errors is not supported in this locale"));
+      matcher = A_MATCHER_INDEX;
+      rewrite = _("as requested by --max-errors");
+    }
+  else if (matcher == F_MATCHER_INDEX
+           || matcher == E_MATCHER_INDEX || matcher == G_MATCHER_INDEX)
     {
       if (match_icase)
         setup_ok_fold ();
@@ -2956,13 +4375,26 @@ main (int argc, char **argv)
          pattern that matches words, where -G is typically faster.  In a
          multibyte locale, switch if the patterns have an encoding error
          (where -F does not work) or if -i and the patterns will not work
-         for -iF.  */
+         for -iF.  Also switch if --engine asks for the DFA or regex.  */
       if (matcher == F_MATCHER_INDEX)
         {
           if (! localeinfo.multibyte
-              ? n_patterns == 1 && match_words
+              ? n_patterns == 1 && match_words && engine == AUTO_ENGINE
               : (contains_encoding_error (keys, keycc)
                  || (match_icase && !fgrep_icase_available (keys, keycc))))
+            {
+              if (engine == FIXED_ENGINE)
+                die (EXIT_TROUBLE, 0,
+                     _("--engine=fixed cannot match these patterns"
+                       " in this locale"));
+              rewrite = (localeinfo.multibyte
+                         ? _("as -F cannot match these patterns"
+                             " in this locale")
+                         : _("as -G is faster for a single -w pattern"));
+            }
+          else if (engine == DFA_ENGINE || engine == REGEX_ENGINE)
+            rewrite = _("as requested by --engine");
+          if (rewrite)
             {
               fgrep_to_grep_pattern (&pattern_array, &keycc);
               keys = pattern_array;
@@ -2971,26 +4403,94 @@ main (int argc, char **argv)
         }
       /* With two or more patterns, if -F works then switch from either -E
          or -G, as -F is probably faster then.  */
-      else if (1 < n_patterns)
-        matcher = try_fgrep_pattern (matcher, keys, &keycc);
+      else if (engine == FIXED_ENGINE || (1 < n_patterns
+                                          && engine == AUTO_ENGINE))
+        {
+          matcher = try_fgrep_pattern (matcher, keys, &keycc);
+          if (matcher == F_MATCHER_INDEX)
+            rewrite = (engine == FIXED_ENGINE
+                       ? _("as requested by --engine")
+                       : _("as all patterns are fixed strings"));
+          else if (engine == FIXED_ENGINE)
+            die (EXIT_TROUBLE, 0,
+                 _("--engine=fixed requires patterns that are fixed strings"));
+        }
+    }
+  else if (engine == FIXED_ENGINE
+           || (engine != AUTO_ENGINE
+               && matchers[matcher].compile != GEAcompile))
+    die (EXIT_TROUBLE, 0, _("--engine=%s does not support the %s matcher"),
+         engine_args[engine], matchers[matcher].name);
+
+  /* Only a count or whether a file matched can be cached.  */
+  if (cache_file)
+    {
+      given_cache_options = cache_options ();
+      if (!out_quiet)
+        error (0, 0, _("warning: --cache has no effect without"
+                       " -c, -l, -L or -q"));
+      else if (result_cache_open (cache_file,
+                                  cache_key (keys, keycc, matcher)))
+        use_cache = true;
+      else
+        error (0, 0, _("warning: --cache is not supported on this system"));
     }
 
   execute = matchers[matcher].execute;
+  reset_matcher = matchers[matcher].reset;
+  if (!out_invert && max_count == INTMAX_MAX && !pattern_profile)
+    matcher_count = matchers[matcher].count;
+  count_matching_lines = count_matches ? matcher_count : nullptr;
+  struct matchopts opts = { .icase = match_icase, .words = match_words,
+                            .lines = match_lines,
+                            .regex_only = engine == REGEX_ENGINE,
+                            .eol = eolbyte, .dfa_memory = dfa_memory,
+                            .max_errors = max_errors };
+  char *profile_keys = pattern_profile ? ximemdup (keys, keycc + 1) : nullptr;
   compiled_pattern =
     matchers[matcher].compile (keys, keycc, matchers[matcher].syntax,
-                               only_matching | color_option);
-  /* We need one byte prior and one after.  */
-  char eolbytes[3] = { 0, eolbyte, 0 };
-  idx_t match_size;
-  skip_empty_lines = (!execute (compiled_pattern, eolbytes + 1, 1,
-                                &match_size, nullptr)
-                      == out_invert);
+                               only_matching | may_color, &opts);
 
-  int num_operands = argc - optind;
-  out_file = (filename_option == 0 && num_operands <= 1
-              ? - (directories == RECURSE_DIRECTORIES)
-              : 0 <= filename_option);
+  if (explain)
+    {
+      explain_plan (requested_matcher, matcher, rewrite);
+      return EXIT_SUCCESS;
+    }
+
+  if (nrules)
+    compile_rules (requested_matcher, matcher, only_matching | may_color,
+                   &opts);
+  if (pattern_profile)
+    {
+      compile_profiles (profile_text, profile_keys, matcher, &opts);
+      pattern_costs = matchers[matcher].costs;
+      atexit (print_pattern_profile);
+    }
+  if (rules_output_dir)
+    open_rules_output (rules_output_dir);
 
+  /* A file without a string that every match contains cannot match;
+     but then -v selects its lines, and -c and -L report it.  */
+  if (use_index_dir)
+    {
+      if (out_invert || count_matches || list_files == LISTFILES_NONMATCHING
+          || decompress)
+        error (0, 0, _("warning: --use-index has no effect with"
+                       " -c, -L, -v or --decompress"));
+      else
+        {
+          trigram_index = trigram_index_open (use_index_dir);
+          if (matcher == F_MATCHER_INDEX)
+            trigram_index_require (trigram_index, keys, keycc, match_icase);
+          else if (matchers[matcher].compile == GEAcompile)
+            {
+              char const *must = GEAmust (compiled_pattern);
+              if (must)
+                trigram_index_require (trigram_index, must, strlen (must),
+                                       match_icase);
+            }
+        }
+    }
   if (binary)
     xset_binary_mode (STDOUT_FILENO, O_BINARY);
 
@@ -3004,33 +4504,33 @@ main (int argc, char **argv)
     abort ();
   pagesize = psize;
   good_readsize = ALIGN_TO (GOOD_READSIZE_MIN, pagesize);
-  bufalloc = good_readsize + pagesize + uword_size;
-  buffer = ximalloc (bufalloc);
+  initial_bufalloc = bufalloc = good_readsize + pagesize + uword_size;
+  buffer = xalignalloc (pagesize, bufalloc);
+
+  /* Try the empty line only now, as the search starts measuring the
+     heap for --dfa-memory, which is not to count the buffer.
+     We need one byte prior and one after.  */
+  char eolbytes[3] = { 0, eolbyte, 0 };
+  idx_t match_size;
+  skip_empty_lines = (!execute (compiled_pattern, eolbytes + 1, 1,
+                                &match_size, nullptr)
+                      == out_invert);
 
   if (fts_options & FTS_LOGICAL && devices == READ_COMMAND_LINE_DEVICES)
     devices = READ_DEVICES;
 
-  char *const *files;
-  if (0 < num_operands)
-    {
-      files = argv + optind;
-    }
-  else if (directories == RECURSE_DIRECTORIES && 0 < last_recursive)
-    {
-      static char *const cwd_only[] = { (char *) ".", nullptr };
-      files = cwd_only;
-      omit_dot_slash = true;
-    }
-  else
+  search_cwd_by_default = (directories == RECURSE_DIRECTORIES
+                           && 0 < last_recursive);
+
+  if (serve_socket)
     {
-      static char *const stdin_only[] = { (char *) "-", nullptr };
-      files = stdin_only;
+      if (optind < argc)
+        die (EXIT_TROUBLE, 0, _("--serve takes no file operands"));
+      serve (serve_socket, serve_search);
     }
 
-  bool status = true;
-  do
-    status &= grep_command_line_arg (*files++);
-  while (*files);
-
-  return errseen ? EXIT_TROUBLE : status;
+  int status = search_operands (argv + optind, argc - optind);
+  if (rules_output_dir)
+    close_rules_output ();
+  return status;
 }
@@ -19,14 +19,73 @@
 #define GREP_GREP_H 1
 
 #include <idx.h>
+#include <stdint.h>
+#include "xtime.h"
 
-/* The following flags are exported from grep for the matchers
-   to look at. */
-extern bool match_icase;	/* -i */
-extern bool match_words;	/* -w */
-extern bool match_lines;	/* -x */
-extern char eolbyte;		/* -z */
+/* The matchers get their options from struct matchopts; this flag is
+   exported from grep for them to look at too.  */
+extern bool show_stats;		/* --stats */
 
 extern char const *pattern_file_name (idx_t, idx_t *);
+extern void input_data_error (char const *, char const *);
+
+/* Phases of the search timed by --stats.  */
+enum stats_phase
+  {
+    PHASE_TRAVERSE,		/* Opening files and walking directories.  */
+    PHASE_READ,			/* Reading and decompressing input.  */
+    PHASE_BINARY,		/* Deciding whether input is binary.  */
+    PHASE_KWSET,		/* Searching for fixed strings.  */
+    PHASE_DFA,			/* Running DFAs.  */
+    PHASE_REGEX,		/* Running the regex fallback.  */
+    PHASE_PCRE,			/* Running PCRE.  */
+    PHASE_OUTPUT,		/* Printing lines.  */
+    PHASES
+  };
+
+/* How the DFA matcher finds candidate lines.  */
+enum strategy
+  {
+    STRATEGY_KWSET,		/* Search for fixed strings first.  */
+    STRATEGY_DFA,		/* Run the DFA over everything.  */
+    STRATEGY_SUPERSET,		/* Run the superset DFA, then the DFA.  */
+    STRATEGIES
+  };
+
+/* Statistics reported by --stats.  */
+struct grep_stats
+{
+  intmax_t reads;		/* Successful calls to read.  */
+  intmax_t bytes_read;		/* Bytes read, after any decompression.  */
+  idx_t readsize_max;		/* Largest read size chosen.  */
+  intmax_t buffers;		/* Large buffers allocated.  */
+  intmax_t advised_buffers;	/* Of these, those advised to use huge
+				   pages, which the kernel may not grant.  */
+  intmax_t files_opened;	/* Input files opened.  */
+  intmax_t files_skipped;	/* Files skipped without being searched.  */
+  intmax_t lines;		/* Input lines scanned.  */
+  intmax_t kwset_candidates;	/* Fixed-string matches found.  */
+  intmax_t kwset_matches;	/* Of these, those confirmed as matches.  */
+  intmax_t inner_checks;	/* Candidates checked around the hit.  */
+  intmax_t approx_checks;	/* Lines checked for approximate matches.  */
+  intmax_t rule_checks;		/* Lines checked against a --rules rule.  */
+  intmax_t dfaexec_calls;	/* Calls to dfaexec.  */
+  intmax_t strategy_windows[STRATEGIES]; /* Windows searched with each.  */
+  intmax_t strategy_switches;	/* Times the DFA matcher changed strategy.  */
+  intmax_t dfa_memory_peak;	/* Most heap the DFA was seen to grow by.  */
+  intmax_t dfa_flushes;		/* Times the DFA was rebuilt to free memory.  */
+  intmax_t dfa_fallbacks;	/* Times regex replaced a thrashing DFA.  */
+  intmax_t backref_searches;	/* Calls to the back-reference matcher.  */
+  intmax_t backref_fallbacks;	/* Of these, those left to regex.  */
+  intmax_t re_search_calls;	/* Calls to re_search.  */
+  intmax_t jit_stack_growths;	/* Times the PCRE JIT stack was enlarged.  */
+  xtime_t phase_time[PHASES];	/* Nanoseconds spent in each phase.  */
+};
+#ifdef LIBGREP
+/* Each thread using the library counts its own.  */
+extern _Thread_local struct grep_stats stats;
+#else
+extern struct grep_stats stats;
+#endif
 
 #endif
@@ -0,0 +1,555 @@
+/* inner.c - check matches around a fixed string inside a pattern.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* When every match of a pattern contains a fixed string, grep searches
+   for the string and then runs the DFA from the start of the line
+   containing it, which in long lines scans much text far from the hit.
+   Many such patterns are the string between two sequences of single
+   characters, each perhaps repeated, like "[a-z0-9._%+-]+@example\.com"
+   or "[0-9]{3}-[0-9]{4}".  A line matches such a pattern if and only
+   if, at some hit, the text just before the string ends with a match
+   of the prefix and the text just after it starts with a match of the
+   suffix, so this checks each hit in place: it matches the prefix
+   backward from the hit and the suffix forward from the end of the
+   string, each with a small automaton whose states are the bits of a
+   word, and stops as soon as the answer is known.
+
+   Anything else, such as groups, alternation, anchors, -i, and in
+   UTF-8 any construct that can match a non-ASCII character other than
+   a literal one, makes inner_compile decline the pattern.  */
+
+#include <config.h>
+
+#include <search.h>
+
+#include "c-ctype.h"
+
+/* The most elements on one side of the string, so that a side's
+   states fit in a word, with one bit to spare for having matched.  */
+enum { ELEMS_MAX = 63 };
+
+/* One side of the string: N elements, in the order they are matched,
+   each matching one byte of a set.  Bit K of a set of states means
+   that the first K elements have matched.  */
+struct side
+{
+  int n;
+
+  /* The elements that may match nothing, and of these, those that may
+     match any number of times.  */
+  uint_least64_t skip;
+  uint_least64_t loop;
+
+  /* For each byte, the elements that match it.  */
+  uint_least64_t accepts[UCHAR_MAX + 1];
+};
+
+struct inner
+{
+  /* The length of the string, and what must precede and follow it.  */
+  idx_t len;
+  struct side before;
+  struct side after;
+};
+
+/* An atom of the pattern, matching one byte of SET, repeated MIN to
+   MAX times, or without limit if MAX is negative.  BYTE is the only
+   byte in SET if the atom is a literal byte, and -1 otherwise.  */
+struct piece
+{
+  uint64_t set[4];
+  int byte;
+  idx_t min;
+  idx_t max;
+};
+
+struct parser
+{
+  /* The rest of the pattern, and how to read it.  */
+  char const *p;
+  char const *lim;
+  reg_syntax_t syntax_bits;
+  bool utf8;
+
+  /* The pieces parsed so far.  */
+  struct piece *v;
+  idx_t n;
+  idx_t alloc;
+
+  bool fail;
+};
+
+/* The operators of a pattern, apart from brackets, anchors and
+   escapes.  */
+enum op
+  {
+    OP_NONE,			/* Not an operator.  */
+    OP_OTHER,			/* Grouping or alternation.  */
+    OP_STAR,
+    OP_PLUS,
+    OP_QMARK,
+    OP_INTERVAL
+  };
+
+/* Return the operator at PS's input and set *LEN to its length.  */
+static enum op
+op_at (struct parser const *ps, int *len)
+{
+  reg_syntax_t bits = ps->syntax_bits;
+  char const *p = ps->p;
+  bool bk = *p == '\\' && p + 1 < ps->lim;
+  char c = p[bk];
+  *len = 1 + bk;
+
+  if (c == '*' && !bk)
+    return OP_STAR;
+  if ((c == '+' || c == '?') && bk == !!(bits & RE_BK_PLUS_QM)
+      && ! (bits & RE_LIMITED_OPS))
+    return c == '+' ? OP_PLUS : OP_QMARK;
+  if (((c == '(' || c == ')') && bk == ! (bits & RE_NO_BK_PARENS))
+      || (c == '|' && bk == ! (bits & RE_NO_BK_VBAR))
+      || (c == '\n' && !bk))
+    return OP_OTHER;
+  if (c == '{' && bk == ! (bits & RE_NO_BK_BRACES) && bits & RE_INTERVALS)
+    return OP_INTERVAL;
+  return OP_NONE;
+}
+
+/* Append to PS a piece that matches one of no bytes yet.  */
+static struct piece *
+new_piece (struct parser *ps)
+{
+  if (ps->n == ps->alloc)
+    ps->v = xpalloc (ps->v, &ps->alloc, 1, -1, sizeof *ps->v);
+  struct piece *piece = &ps->v[ps->n++];
+  *piece = (struct piece) { .byte = -1, .min = 1, .max = 1 };
+  return piece;
+}
+
+static void
+set_bit (uint64_t *set, unsigned char b)
+{
+  set[b >> 6] |= (uint64_t) 1 << (b & 63);
+}
+
+/* Add to SET of PS the bytes in the class NAME.  In UTF-8, only
+   classes without non-ASCII characters will do.  */
+static void
+add_class (struct parser *ps, uint64_t *set, char const *name)
+{
+  c32_type_test_t test = c32_get_type_test (name);
+  if (!test
+      || (ps->utf8 && strcmp (name, "digit") != 0
+          && strcmp (name, "xdigit") != 0))
+    {
+      ps->fail = true;
+      return;
+    }
+  for (int b = 0; b <= UCHAR_MAX; b++)
+    {
+      wint_t wc = ps->utf8 ? (b < 0x80 ? b : WEOF) : localeinfo.sbctowc[b];
+      if (wc != WEOF && c32_apply_type_test (wc, test))
+        set_bit (set, b);
+    }
+}
+
+/* Invert SET of PS, as for [^...], '.', \W and \S.  In UTF-8 these
+   match non-ASCII characters, so fail.  */
+static void
+invert (struct parser *ps, uint64_t *set, bool newline)
+{
+  if (ps->utf8)
+    {
+      ps->fail = true;
+      return;
+    }
+  for (int i = 0; i < 4; i++)
+    set[i] = ~set[i];
+  if (!newline)
+    set[0] &= ~((uint64_t) 1 << '\n');
+}
+
+/* Parse the bracket expression whose contents start at PS's input,
+   into SET.  */
+static void
+parse_bracket (struct parser *ps, uint64_t *set)
+{
+  char const *p = ps->p;
+  bool inverted = p < ps->lim && *p == '^';
+  p += inverted;
+
+  for (bool first = true; ; first = false)
+    {
+      if (p == ps->lim)
+        {
+          ps->fail = true;
+          return;
+        }
+      if (*p == ']' && !first)
+        break;
+      if (*p == '[' && p + 1 < ps->lim
+          && (p[1] == '.' || p[1] == '=' || p[1] == ':'))
+        {
+          char const *name = p + 2;
+          char const *end = name;
+          while (end + 1 < ps->lim && ! (end[0] == ':' && end[1] == ']'))
+            end++;
+          if (p[1] != ':' || ps->lim <= end + 1 || 32 <= end - name
+              || ! (ps->syntax_bits & RE_CHAR_CLASSES))
+            {
+              ps->fail = true;
+              return;
+            }
+          char buf[32];
+          memcpy (buf, name, end - name);
+          buf[end - name] = '\0';
+          add_class (ps, set, buf);
+          if (ps->fail)
+            return;
+          p = end + 2;
+          continue;
+        }
+
+      /* Only single bytes, and in UTF-8 only ASCII ones, and ranges
+         only where they do not depend on LC_COLLATE.  */
+      unsigned char c = *p++;
+      if ((ps->utf8 && 0x80 <= c)
+          || (c == '-' && !first && p < ps->lim && *p != ']'))
+        {
+          ps->fail = true;
+          return;
+        }
+      unsigned char c2 = c;
+      if (p + 1 < ps->lim && *p == '-' && p[1] != ']')
+        {
+          c2 = p[1];
+          if (c2 == '[' || (ps->utf8 && 0x80 <= c2) || c2 < c
+              || ! (localeinfo.simple || (c_isdigit (c) && c_isdigit (c2))))
+            {
+              ps->fail = true;
+              return;
+            }
+          p += 2;
+        }
+      for (int b = c; b <= c2; b++)
+        set_bit (set, b);
+    }
+
+  ps->p = p + 1;
+  if (inverted)
+    invert (ps, set, ! (ps->syntax_bits & RE_HAT_LISTS_NOT_NEWLINE));
+}
+
+/* Parse an atom at PS's input into one piece, or for a multibyte
+   character, one piece for each byte.  */
+static void
+parse_atom (struct parser *ps)
+{
+  int len;
+  if (op_at (ps, &len) != OP_NONE)
+    {
+      ps->fail = true;
+      return;
+    }
+
+  char const *p = ps->p++;
+  struct piece *piece;
+  switch (*p)
+    {
+    case '[':
+      parse_bracket (ps, new_piece (ps)->set);
+      return;
+
+    case '.':
+      piece = new_piece (ps);
+      if (ps->syntax_bits & RE_DOT_NOT_NULL)
+        set_bit (piece->set, '\0');
+      invert (ps, piece->set, ps->syntax_bits & RE_DOT_NEWLINE);
+      return;
+
+    case '^': case '$':
+      ps->fail = true;
+      return;
+
+    case '\\':
+      if (ps->p == ps->lim || ps->syntax_bits & RE_NO_GNU_OPS)
+        {
+          ps->fail = true;
+          return;
+        }
+      p = ps->p++;
+      switch (*p)
+        {
+        case 'w': case 'W':
+          piece = new_piece (ps);
+          add_class (ps, piece->set, "alnum");
+          set_bit (piece->set, '_');
+          if (*p == 'W')
+            invert (ps, piece->set, true);
+          return;
+
+        case 's': case 'S':
+          piece = new_piece (ps);
+          add_class (ps, piece->set, "space");
+          if (*p == 'S')
+            invert (ps, piece->set, true);
+          return;
+
+        case '1': case '2': case '3': case '4': case '5':
+        case '6': case '7': case '8': case '9':
+        case 'b': case 'B': case '<': case '>': case '`': case '\'':
+          ps->fail = true;
+          return;
+        }
+      break;
+    }
+
+  /* An ordinary character, possibly escaped.  */
+  int n = 1;
+  if (ps->utf8 && 0x80 <= to_uchar (*p))
+    {
+      char32_t c;
+      mbstate_t mbs; mbszero (&mbs);
+      size_t r = mbrtoc32 (&c, p, ps->lim - p, &mbs);
+      if (! (r <= MB_LEN_MAX))
+        {
+          ps->fail = true;
+          return;
+        }
+      n = r;
+    }
+  ps->p = p + n;
+  for (int i = 0; i < n; i++)
+    {
+      piece = new_piece (ps);
+      piece->byte = to_uchar (p[i]);
+      set_bit (piece->set, p[i]);
+    }
+}
+
+/* Parse the interval whose contents start at PS's input, and set
+   *MIN and *MAX to its bounds, with *MAX negative if there is no upper
+   bound.  */
+static void
+parse_interval (struct parser *ps, idx_t *min, idx_t *max)
+{
+  bool bk = ! (ps->syntax_bits & RE_NO_BK_BRACES);
+  char const *p = ps->p;
+  idx_t n[2] = { -1, -1 };
+  for (int i = 0; i < 2; i++)
+    {
+      for (; p < ps->lim && c_isdigit (*p); p++)
+        n[i] = (n[i] < 0 ? 0 : n[i]) * 10 + (*p - '0');
+      if (RE_DUP_MAX < n[i])
+        break;
+      if (i == 0)
+        {
+          if (! (p < ps->lim && *p == ','))
+            {
+              n[1] = n[0];
+              break;
+            }
+          p++;
+        }
+    }
+  if (bk)
+    {
+      if (! (p < ps->lim && *p == '\\'))
+        p = ps->lim;
+      p++;
+    }
+  if (! (p < ps->lim && *p == '}' && n[0] <= RE_DUP_MAX && n[1] <= RE_DUP_MAX
+         && (n[1] < 0 || MAX (n[0], 0) <= n[1])))
+    {
+      ps->fail = true;
+      return;
+    }
+  ps->p = p + 1;
+  *min = MAX (n[0], 0);
+  *max = n[1];
+}
+
+/* Parse a piece at PS's input: an atom and at most one repetition
+   operator.  */
+static void
+parse_piece (struct parser *ps)
+{
+  idx_t first = ps->n;
+  parse_atom (ps);
+  if (ps->fail || ps->p == ps->lim)
+    return;
+
+  int len;
+  idx_t min, max;
+  switch (op_at (ps, &len))
+    {
+    case OP_STAR:
+      min = 0, max = -1;
+      break;
+    case OP_PLUS:
+      min = 1, max = -1;
+      break;
+    case OP_QMARK:
+      min = 0, max = 1;
+      break;
+    case OP_INTERVAL:
+      ps->p += len;
+      parse_interval (ps, &min, &max);
+      len = 0;
+      break;
+    default:
+      return;
+    }
+  ps->p += len;
+
+  /* A repeated multibyte character would be several pieces repeated
+     together, and repetitions of repetitions are rare.  */
+  if (ps->fail || ps->n - first != 1
+      || (ps->p < ps->lim && op_at (ps, &len) != OP_NONE))
+    {
+      ps->fail = true;
+      return;
+    }
+  ps->v[first].min = min;
+  ps->v[first].max = max;
+}
+
+/* Set SIDE to match the N pieces of V, in order if DIR is 1 or
+   backward if it is -1.  Return false if they need too many
+   elements.  */
+static bool
+make_side (struct side *side, struct piece const *v, idx_t n, int dir)
+{
+  *side = (struct side) { 0 };
+  for (idx_t i = 0; i < n; i++)
+    {
+      struct piece const *piece = &v[dir < 0 ? n - 1 - i : i];
+      idx_t copies = piece->max < 0 ? piece->min + 1 : piece->max;
+      if (ELEMS_MAX - side->n < copies)
+        return false;
+      for (idx_t j = 0; j < copies; j++)
+        {
+          uint_least64_t bit = (uint_least64_t) 1 << side->n++;
+          if (piece->min <= j)
+            side->skip |= bit;
+          if (piece->max < 0 && piece->min <= j)
+            side->loop |= bit;
+          for (int b = 0; b <= UCHAR_MAX; b++)
+            if ((piece->set[b >> 6] >> (b & 63)) & 1)
+              side->accepts[b] |= bit;
+        }
+    }
+  return true;
+}
+
+/* Return a checker for the SIZE bytes of PATTERN, in the syntax
+   SYNTAX_BITS, around hits of MUST, which every match contains; or
+   null if the pattern is not MUST between sequences of single
+   characters.  */
+struct inner *
+inner_compile (char const *pattern, idx_t size, reg_syntax_t syntax_bits,
+               char const *must)
+{
+  if ((localeinfo.multibyte && !localeinfo.using_utf8)
+      || syntax_bits & (RE_ICASE | RE_BACKSLASH_ESCAPE_IN_LISTS))
+    return nullptr;
+
+  struct parser ps = { .p = pattern, .lim = pattern + size,
+                       .syntax_bits = syntax_bits,
+                       .utf8 = localeinfo.using_utf8 };
+  while (!ps.fail && ps.p < ps.lim)
+    parse_piece (&ps);
+
+  /* Look for MUST among the pieces that match a byte exactly once.  */
+  struct inner *in = nullptr;
+  idx_t len = strlen (must);
+  for (idx_t i = 0; !ps.fail && 0 < len && i + len <= ps.n; i++)
+    {
+      idx_t j = 0;
+      while (j < len && ps.v[i + j].byte == to_uchar (must[j])
+             && ps.v[i + j].min == 1 && ps.v[i + j].max == 1)
+        j++;
+      if (j == len)
+        {
+          in = xmalloc (sizeof *in);
+          in->len = len;
+          if (! (make_side (&in->before, ps.v, i, -1)
+                 && make_side (&in->after, ps.v + i + len,
+                               ps.n - (i + len), 1)))
+            {
+              free (in);
+              in = nullptr;
+            }
+          break;
+        }
+    }
+
+  free (ps.v);
+  return in;
+}
+
+/* Return STATES of SIDE along with the states reachable from them by
+   skipping elements.  */
+static uint_least64_t
+closure (struct side const *side, uint_least64_t states)
+{
+  for (uint_least64_t s;
+       (s = states | (states & side->skip) << 1) != states; )
+    states = s;
+  return states;
+}
+
+/* Return the states of SIDE after matching the byte B in STATES.  */
+static uint_least64_t
+step (struct side const *side, uint_least64_t states, unsigned char b)
+{
+  uint_least64_t m = states & side->accepts[b];
+  return closure (side, (m & ~side->loop) << 1 | (m & side->loop));
+}
+
+/* Return true if IN matches a line from BEG to LIM, not counting the
+   line terminator, at a hit of its string at HIT.  */
+bool
+inner_match (struct inner const *in, char const *beg, char const *hit,
+             char const *lim)
+{
+  struct side const *side = &in->before;
+  uint_least64_t done = (uint_least64_t) 1 << side->n;
+  uint_least64_t states = closure (side, 1);
+  for (char const *p = hit; ! (states & done); )
+    {
+      if (!states || p == beg)
+        return false;
+      states = step (side, states, *--p);
+    }
+
+  side = &in->after;
+  done = (uint_least64_t) 1 << side->n;
+  states = closure (side, 1);
+  for (char const *p = hit + in->len; ! (states & done); p++)
+    {
+      if (!states || p == lim)
+        return false;
+      states = step (side, states, *p);
+    }
+  return true;
+}
+
+void
+inner_free (struct inner *in)
+{
+  free (in);
+}
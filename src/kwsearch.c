@@ -18,11 +18,16 @@
 
 #include <config.h>
 #include <search.h>
+#include "die.h"
+#include "probes.h"
 
 /* A compiled -F pattern list.  */
 
 struct kwsearch
 {
+  /* The options the pattern list was compiled with.  */
+  struct matchopts opts;
+
   /* The kwset for this pattern list.  */
   kwset_t kwset;
 
@@ -39,19 +44,36 @@ struct kwsearch
   /* The user's pattern compiled as a regular expression,
      or null if it has not been compiled.  */
   void *re;
+
+  /* The character boundaries in the buffer being searched.  */
+  struct mb_bounds bounds;
 };
 
+/* Compile the user's pattern of KWSEARCH as a regular expression,
+   for Fexecute to check -w matches with.  */
+static void
+compile_regex (struct kwsearch *kwsearch)
+{
+  fgrep_to_grep_pattern (&kwsearch->pattern, &kwsearch->size);
+  kwsearch->re = GEAcompile (kwsearch->pattern, kwsearch->size,
+                             RE_SYNTAX_GREP, false, &kwsearch->opts);
+}
+
 /* Compile the -F style PATTERN, containing SIZE bytes that are
-   followed by '\n'.  Return a description of the compiled pattern.  */
+   followed by '\n', to match with the options OPTS.  Return a
+   description of the compiled pattern, which takes over PATTERN.  */
 
 void *
-Fcompile (char *pattern, idx_t size, reg_syntax_t ignored, bool exact)
+Fcompile (char *pattern, idx_t size, reg_syntax_t ignored, bool exact,
+          struct matchopts const *opts)
 {
   kwset_t kwset;
   char *buf = nullptr;
   idx_t bufalloc = 0;
+  bool match_lines = opts->lines;
+  char eol = opts->eol;
 
-  kwset = kwsinit (true);
+  kwset = kwsinit (true, opts->icase);
 
   char const *p = pattern;
   do
@@ -61,7 +83,7 @@ Fcompile (char *pattern, idx_t size, reg_syntax_t ignored, bool exact)
 
       if (match_lines)
         {
-          if (eolbyte == '\n' && pattern < p)
+          if (eol == '\n' && pattern < p)
             p--;
           else
             {
@@ -70,10 +92,10 @@ Fcompile (char *pattern, idx_t size, reg_syntax_t ignored, bool exact)
                   free (buf);
                   bufalloc = len;
                   buf = xpalloc (nullptr, &bufalloc, 2, -1, 1);
-                  buf[0] = eolbyte;
+                  buf[0] = eol;
                 }
               memcpy (buf + 1, p, len);
-              buf[len + 1] = eolbyte;
+              buf[len + 1] = eol;
               p = buf;
             }
           len += 2;
@@ -90,11 +112,26 @@ Fcompile (char *pattern, idx_t size, reg_syntax_t ignored, bool exact)
   kwsprep (kwset);
 
   struct kwsearch *kwsearch = xmalloc (sizeof *kwsearch);
+  kwsearch->opts = *opts;
   kwsearch->kwset = kwset;
   kwsearch->words = words;
   kwsearch->pattern = pattern;
   kwsearch->size = size;
   kwsearch->re = nullptr;
+  kwsearch->bounds.bits = nullptr;
+  kwsearch->bounds.alloc = 0;
+
+  /* Fexecute compiles the regular expression only if it needs it, but
+     compiling uses global state that the library's threads share.  */
+#ifdef LIBGREP
+  if (opts->words && !localeinfo.multibyte)
+    {
+      libgrep_compiling (kwsearch, Ffree);
+      compile_regex (kwsearch);
+      libgrep_compiled (kwsearch);
+    }
+#endif
+
   return kwsearch;
 }
 
@@ -108,25 +145,36 @@ Fexecute (void *vcp, char const *buf, idx_t size, idx_t *match_size,
 {
   char const *beg, *end, *mb_start;
   idx_t len;
-  char eol = eolbyte;
   struct kwsearch *kwsearch = vcp;
+  char eol = kwsearch->opts.eol;
+  bool match_lines = kwsearch->opts.lines;
+  bool match_words = kwsearch->opts.words;
   kwset_t kwset = kwsearch->kwset;
   bool mb_check = localeinfo.multibyte & !localeinfo.using_utf8 & !match_lines;
   bool longest = (mb_check | !!start_ptr | match_words) & !match_lines;
 
-  for (mb_start = beg = start_ptr ? start_ptr : buf; beg <= buf + size; beg++)
+  mb_start = beg = start_ptr ? start_ptr : buf;
+  if (localeinfo.multibyte & !localeinfo.using_utf8)
+    mb_bounds_reset (&kwsearch->bounds, mb_start, buf + size);
+
+  for (; beg <= buf + size; beg++)
     {
       struct kwsmatch kwsmatch;
+      xtime_t start_time = stats_clock ();
       ptrdiff_t offset = kwsexec (kwset, beg - match_lines,
                                   buf + size - beg + match_lines, &kwsmatch,
                                   longest);
+      stats_charge (PHASE_KWSET, start_time);
       if (offset < 0)
         break;
+      stats.kwset_candidates++;
+      PROBE2 (kwset__hit, beg + offset - buf, kwsmatch.size);
       len = kwsmatch.size - 2 * match_lines;
 
       idx_t mbclen = 0;
       if (mb_check
-          && mb_goback (&mb_start, &mbclen, beg + offset, buf + size) != 0)
+          && mb_goback (&mb_start, &mbclen, beg + offset, buf + size,
+                        &kwsearch->bounds) != 0)
         {
           /* We have matched a single byte that is not at the beginning of a
              multibyte character.  mb_goback has advanced MB_START past that
@@ -169,7 +217,7 @@ Fexecute (void *vcp, char const *buf, idx_t size, idx_t *match_size,
          character IS a word constituent, keep trying with shorter matches.  */
       if (mbclen > 0
           ? ! wordchar_next (beg - mbclen, buf + size)
-          : ! wordchar_prev (mb_start, beg, buf + size))
+          : ! wordchar_prev (mb_start, beg, buf + size, &kwsearch->bounds))
         for (;;)
           {
             if (! wordchar_next (beg + len, buf + size))
@@ -182,12 +230,7 @@ Fexecute (void *vcp, char const *buf, idx_t size, idx_t *match_size,
             if (!start_ptr && !localeinfo.multibyte)
               {
                 if (! kwsearch->re)
-                  {
-                    fgrep_to_grep_pattern (&kwsearch->pattern, &kwsearch->size);
-                    kwsearch->re = GEAcompile (kwsearch->pattern,
-                                               kwsearch->size,
-                                               RE_SYNTAX_GREP, !!start_ptr);
-                  }
+                  compile_regex (kwsearch);
                 if (beg + len < buf + size)
                   {
                     end = rawmemchr (beg + len, eol);
@@ -233,6 +276,91 @@ Fexecute (void *vcp, char const *buf, idx_t size, idx_t *match_size,
   beg = beg ? beg + 1 : buf;
   len = end - beg;
  success_in_beg_and_len:;
+  stats.kwset_matches++;
   *match_size = len;
   return beg - buf;
 }
+
+/* Return the number of lines in the buffer BUF of size SIZE that
+   match the compiled pattern VCP, or -1 if this cannot be counted
+   faster than by calling Fexecute for each line.  BUF must end in a
+   line terminator.  */
+ptrdiff_t
+Fcount (void *vcp, char const *buf, idx_t size)
+{
+  struct kwsearch *kwsearch = vcp;
+  bool match_lines = kwsearch->opts.lines;
+  if (kwsearch->opts.words
+      || (localeinfo.multibyte & !localeinfo.using_utf8))
+    return -1;
+
+  /* Each hit is a matching line, so skip to the next line without
+     locating the start of this one.  With -x, a hit starts with the
+     line terminator before the line.  */
+  char eol = kwsearch->opts.eol;
+  char const *lim = buf + size;
+  ptrdiff_t count = 0;
+  xtime_t start_time = stats_clock ();
+  for (char const *beg = buf; beg < lim; count++)
+    {
+      struct kwsmatch kwsmatch;
+      ptrdiff_t offset = kwsexec (kwsearch->kwset, beg - match_lines,
+                                  lim - beg + match_lines, &kwsmatch, false);
+      if (offset < 0)
+        break;
+      beg = rawmemchr (beg + offset, eol) + 1;
+    }
+  stats_charge (PHASE_KWSET, start_time);
+  stats.kwset_candidates += count;
+  stats.kwset_matches += count;
+  return count;
+}
+
+/* Describe how the compiled pattern VCP will be matched, for --explain.  */
+void
+Fexplain (void *vcp, explain_printf_t print)
+{
+  struct kwsearch *kwsearch = vcp;
+  idx_t extra = kwswords (kwsearch->kwset) - kwsearch->words;
+
+  print (_("fixed strings: %td\n"), kwsearch->words);
+  if (extra)
+    print (_("extra one-character strings needing a DFA check: %td\n"),
+           extra);
+  if (kwsearch->opts.words && !localeinfo.multibyte)
+    print (_("regex: for -w, when a match is followed by a"
+             " word character\n"));
+}
+
+/* Set *COSTS to the calls to the slower matchers made for the patterns
+   of the compiled pattern VCP, and return how many entries it has.
+   Only -w matches followed by a word character make any such calls,
+   for all the patterns together.  */
+idx_t
+Fcosts (void *vcp, struct pattern_cost const **costs)
+{
+  struct kwsearch *kwsearch = vcp;
+  return kwsearch->re ? GEAcosts (kwsearch->re, costs) : 0;
+}
+
+/* Prepare the compiled pattern VCP for searching another file.  */
+void
+Freset (void *vcp)
+{
+  struct kwsearch *kwsearch = vcp;
+  if (kwsearch->re)
+    GEAreset (kwsearch->re);
+}
+
+/* Free the compiled pattern VCP, and the pattern it was compiled from.  */
+void
+Ffree (void *vcp)
+{
+  struct kwsearch *kwsearch = vcp;
+  if (kwsearch->re)
+    GEAfree (kwsearch->re);
+  kwsfree (kwsearch->kwset);
+  mb_bounds_free (&kwsearch->bounds);
+  free (kwsearch->pattern);
+  free (kwsearch);
+}
@@ -0,0 +1,300 @@
+/* libgrep.c - search buffers with grep's matchers.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* The matchers are compiled into libgrep.a with LIBGREP defined.  They
+   take their options from the struct matchopts they compile patterns
+   with, so searching depends on no global state other than the locale
+   tables set up before the first compilation, and statistics, which
+   each thread counts separately.  Compiling patterns sets regex's
+   global syntax, so compilations are serialized.  Errors that would
+   make grep exit jump back to the function the caller called, with
+   the messages grep would output, after freeing what the matchers
+   registered with libgrep_compiling.  */
+
+#include <config.h>
+
+#include "libgrep.h"
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+
+#include "search.h"
+#include "die.h"
+
+/* Define what the matchers expect of grep.c.  */
+struct localeinfo localeinfo;
+bool show_stats;
+_Thread_local struct grep_stats stats;
+
+struct grep_pattern
+{
+  /* The matcher's compiled pattern, and its functions to search with
+     it and free it.  */
+  void *compiled;
+  ptrdiff_t (*execute) (void *, char const *, idx_t, idx_t *, char const *);
+  void (*free) (void *);
+
+  /* The patterns it was compiled from, or null if the matcher frees
+     them itself.  */
+  char *keys;
+
+  /* The message for the latest error when searching, or null.  */
+  char *error;
+};
+
+/* A lock held while compiling, and whether the locale tables have
+   been set up.  */
+static pthread_mutex_t compile_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool initialized;
+
+/* Where libgrep_die returns to in this thread, and its message.  */
+static _Thread_local jmp_buf *die_env;
+static _Thread_local char die_message[1024];
+
+/* What the compilation under way in this thread has allocated, to be
+   freed if it fails, with the functions that free it.  */
+enum { COMPILING_MAX = 8 };
+static _Thread_local struct
+{
+  void *p;
+  void (*free) (void *);
+} compiling[COMPILING_MAX];
+static _Thread_local int ncompiling;
+
+/* Append to die_message, on a line of its own, the message that
+   FORMAT and ARGS format, and the description of ERRNUM if nonzero.  */
+static void
+add_die_message (int errnum, char const *format, va_list args)
+{
+  int size = sizeof die_message;
+  int len = strlen (die_message);
+  if (len && len < size - 1)
+    {
+      die_message[len++] = '\n';
+      die_message[len] = '\0';
+    }
+  int n = vsnprintf (die_message + len, size - len, format, args);
+  if (errnum && 0 <= n && n < size - len)
+    snprintf (die_message + len + n, size - len - n, ": %s",
+              strerror (errnum));
+}
+
+static _Noreturn void
+die_return (void)
+{
+  if (!die_env)
+    abort ();
+  longjmp (*die_env, 1);
+}
+
+void
+libgrep_die (int errnum, char const *format, ...)
+{
+  va_list args;
+  va_start (args, format);
+  add_die_message (errnum, format, args);
+  va_end (args);
+  die_return ();
+}
+
+void
+libgrep_die_report (char const *format, ...)
+{
+  va_list args;
+  va_start (args, format);
+  add_die_message (0, format, args);
+  va_end (args);
+}
+
+void
+libgrep_die_reported (void)
+{
+  if (!*die_message)
+    libgrep_die (0, "%s", _("invalid regular expression"));
+  die_return ();
+}
+
+void
+libgrep_compiling (void *p, void (*free) (void *))
+{
+  if (!p)
+    return;
+  if (ncompiling == COMPILING_MAX)
+    abort ();
+  compiling[ncompiling].p = p;
+  compiling[ncompiling].free = free;
+  ncompiling++;
+}
+
+void
+libgrep_compiled (void const *p)
+{
+  for (int i = ncompiling; 0 < i--; )
+    if (compiling[i].p == p)
+      {
+        ncompiling = i;
+        return;
+      }
+}
+
+/* The library's patterns do not come from files.  */
+char const *
+pattern_file_name (idx_t lineno, idx_t *new_lineno)
+{
+  *new_lineno = lineno;
+  return "";
+}
+
+char const *
+input_filename (void)
+{
+  return _("(buffer)");
+}
+
+struct grep_pattern *
+grep_compile (char const *patterns, size_t size,
+              struct grep_options const *options, char **errmsg)
+{
+  if (IDX_MAX <= size)
+    xalloc_die ();
+  idx_t keycc = size;
+  char *keys = ximalloc (keycc + 1);
+  memcpy (keys, patterns, keycc);
+  keys[keycc] = '\n';
+
+  struct grep_pattern *pat = xmalloc (sizeof *pat);
+  pat->keys = keys;
+  pat->error = nullptr;
+
+  struct matchopts opts = { .icase = options->ignore_case,
+                            .words = options->match_words,
+                            .lines = options->match_lines,
+                            .eol = options->null_data ? '\0' : '\n' };
+
+  pthread_mutex_lock (&compile_lock);
+  jmp_buf env;
+  die_env = &env;
+  *die_message = '\0';
+  if (setjmp (env))
+    {
+      die_env = nullptr;
+      while (ncompiling)
+        {
+          ncompiling--;
+          compiling[ncompiling].free (compiling[ncompiling].p);
+        }
+      pthread_mutex_unlock (&compile_lock);
+      *errmsg = xstrdup (die_message);
+      free (pat->keys);
+      free (pat);
+      return nullptr;
+    }
+
+  if (!initialized)
+    {
+      init_localeinfo (&localeinfo);
+      wordinit ();
+      initialized = true;
+    }
+
+  switch (options->syntax)
+    {
+    case GREP_SYNTAX_FIXED:
+      /* -F does not work with encoding errors in multibyte locales,
+         and not always with -i; grep then uses -G, as here.  */
+      if (! (localeinfo.multibyte
+             && (opts.icase || contains_encoding_error (keys, keycc))))
+        {
+          /* Fcompile takes over KEYS, and frees it if it fails.  */
+          pat->keys = nullptr;
+          pat->compiled = Fcompile (keys, keycc, 0, false, &opts);
+          pat->execute = Fexecute;
+          pat->free = Ffree;
+          break;
+        }
+      fgrep_to_grep_pattern (&pat->keys, &keycc);
+      keys = pat->keys;
+      FALLTHROUGH;
+    case GREP_SYNTAX_BASIC:
+    case GREP_SYNTAX_EXTENDED:
+      pat->compiled = GEAcompile (keys, keycc,
+                                  (options->syntax == GREP_SYNTAX_EXTENDED
+                                   ? RE_SYNTAX_EGREP : RE_SYNTAX_GREP),
+                                  false, &opts);
+      pat->execute = EGexecute;
+      pat->free = GEAfree;
+      break;
+
+    case GREP_SYNTAX_PERL:
+#if HAVE_LIBPCRE
+      pat->compiled = Pcompile (keys, keycc, 0, false, &opts);
+      pat->execute = Pexecute;
+      pat->free = Pfree;
+      break;
+#else
+      die (EXIT_TROUBLE, 0,
+           _("Perl matching not supported in a --disable-perl-regexp build"));
+#endif
+
+    default:
+      die (EXIT_TROUBLE, 0, _("invalid matcher %d"), options->syntax);
+    }
+
+  die_env = nullptr;
+  pthread_mutex_unlock (&compile_lock);
+  return pat;
+}
+
+ptrdiff_t
+grep_execute (struct grep_pattern *pat, char *buf, size_t size,
+              size_t *match_size)
+{
+  jmp_buf env;
+  die_env = &env;
+  *die_message = '\0';
+  if (setjmp (env))
+    {
+      die_env = nullptr;
+      free (pat->error);
+      pat->error = xstrdup (die_message);
+      return -2;
+    }
+
+  if (IDX_MAX < size)
+    die (EXIT_TROUBLE, 0, _("buffer too large"));
+  idx_t len;
+  ptrdiff_t offset = pat->execute (pat->compiled, buf, size, &len, nullptr);
+  die_env = nullptr;
+  if (0 <= offset)
+    *match_size = len;
+  return offset;
+}
+
+char const *
+grep_error (struct grep_pattern const *pat)
+{
+  return pat->error;
+}
+
+void
+grep_free (struct grep_pattern *pat)
+{
+  pat->free (pat->compiled);
+  free (pat->keys);
+  free (pat->error);
+  free (pat);
+}
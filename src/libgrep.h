@@ -0,0 +1,93 @@
+/* libgrep.h - search buffers with grep's matchers.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* libgrep.a lets other programs search with grep's matchers.
+
+   Set the locale with setlocale before compiling the first pattern.
+   The matchers use the LC_CTYPE locale in effect then, for all
+   patterns.
+
+   Any thread may compile patterns; compilations wait for each other.
+   A compiled pattern caches what it learns while searching, so only
+   one thread at a time may search with it.  Threads that search
+   concurrently should each compile their own patterns.
+
+   Warnings are output to standard error as grep does.  If memory is
+   exhausted, the program exits as grep does.  */
+
+#ifndef LIBGREP_H
+#define LIBGREP_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The syntax of patterns, as with grep -G, -E, -F and -P.  */
+enum grep_syntax
+  {
+    GREP_SYNTAX_BASIC,
+    GREP_SYNTAX_EXTENDED,
+    GREP_SYNTAX_FIXED,
+    GREP_SYNTAX_PERL
+  };
+
+/* How to match.  Initialize this to zero before setting the members
+   wanted, so that any members added later get their defaults.  */
+struct grep_options
+{
+  enum grep_syntax syntax;
+  bool ignore_case;		/* Like -i.  */
+  bool match_words;		/* Like -w.  */
+  bool match_lines;		/* Like -x.  */
+  bool null_data;		/* Like -z: lines end in a null byte.  */
+};
+
+/* A compiled list of patterns.  */
+struct grep_pattern;
+
+/* Compile the SIZE bytes of PATTERNS, a list of patterns separated by
+   newlines, to match as OPTIONS say.  Return the compiled patterns.
+   On error, return a null pointer and set *ERROR to the messages grep
+   would output, one per line, which the caller should free.  */
+extern struct grep_pattern *grep_compile (char const *patterns, size_t size,
+                                          struct grep_options const *options,
+                                          char **error);
+
+/* Search the SIZE bytes of BUF, which hold whole lines, each ending in
+   the line terminator, with PATTERN.  The byte before BUF must be a
+   line terminator, and BUF[SIZE] must be writable, as searching may
+   store a line terminator there temporarily.  Return the offset of
+   the first selected line and set *MATCH_SIZE to its size, including
+   its terminator.  Return -1 if no line is selected, and -2 on error,
+   whose message grep_error then returns.  */
+extern ptrdiff_t grep_execute (struct grep_pattern *pattern,
+                               char *buf, size_t size, size_t *match_size);
+
+/* Return the message for the latest error when searching with
+   PATTERN, or a null pointer if there was none.  */
+extern char const *grep_error (struct grep_pattern const *pattern);
+
+/* Free PATTERN.  */
+extern void grep_free (struct grep_pattern *pattern);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,602 @@
+/* literals.c - find strings that every match of a pattern contains.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* The DFA finds at most one string that every match must contain, so
+   for patterns like "(connect|accept) timeout" it may find " timeout",
+   but for "connect|accept" or for a list of unrelated patterns it
+   finds nothing, and grep runs the DFA over every byte.  Such patterns
+   often still have a set of strings one of which every match contains,
+   here {"connect", "accept"}, which the fixed-string matcher can search
+   for all at once.
+
+   The set is computed bottom up over the parsed pattern.  Each
+   subexpression either matches exactly the strings of a small set, as
+   "(a|b)c" matches "ac" and "bc", or has a set one of which each match
+   contains, or has no such set.  A concatenation multiplies out exact
+   sets while they stay small, and otherwise keeps the best of the sets
+   its parts require: the one whose shortest string is longest, as it
+   lets the search skip furthest and has the fewest false hits.  An
+   alternation unites the sets of its branches.  Parts of a pattern
+   whose meaning is not plain, such as back-references, anchors and
+   repetitions that may match nothing, require nothing, so the result
+   errs only toward finding fewer strings.  */
+
+#include <config.h>
+
+#include <search.h>
+
+#include <stdckdint.h>
+
+#include "c-ctype.h"
+
+/* The most strings in a set matched exactly, so that "[ab][cd][ef]"
+   yields eight strings but "[0-9]" none.  */
+enum { EXACT_MAX = 16 };
+
+/* The most characters that a bracket expression may match and still
+   be multiplied out.  */
+enum { BRACKET_MAX = 4 };
+
+/* The shortest string worth searching for instead of running the DFA.  */
+enum { LITERAL_MIN = 3 };
+
+/* The strings found for a subexpression.  If EXACT, the subexpression
+   matches exactly the N strings in V.  Otherwise every match contains
+   at least one of them, or nothing is known if N is zero.  */
+struct lits
+{
+  bool exact;
+  struct literal *v;
+  idx_t n;
+  idx_t alloc;
+};
+
+/* A pattern being parsed.  */
+struct parser
+{
+  char const *p;
+  char const *lim;
+  reg_syntax_t syntax_bits;
+  mbstate_t mbs;
+
+  /* Nesting depth of groups, and whether the pattern cannot be
+     parsed.  */
+  idx_t depth;
+  bool fail;
+};
+
+/* The operators of a pattern, apart from brackets and escapes.  */
+enum op
+  {
+    OP_NONE,			/* Not an operator.  */
+    OP_OR,
+    OP_LPAREN,
+    OP_RPAREN,
+    OP_STAR,
+    OP_PLUS,
+    OP_QMARK,
+    OP_INTERVAL
+  };
+
+/* Return the length of the character at P in PS's input, or a
+   negative number if it is not a valid character.  */
+static ptrdiff_t
+char_len (struct parser *ps, char const *p)
+{
+  return localeinfo.multibyte ? mb_clen (p, ps->lim - p, &ps->mbs) : 1;
+}
+
+static void
+lits_add (struct lits *l, char const *str, idx_t len)
+{
+  if (l->n == l->alloc)
+    l->v = xpalloc (l->v, &l->alloc, 1, -1, sizeof *l->v);
+  l->v[l->n].str = ximemdup0 (str, len);
+  l->v[l->n].len = len;
+  l->n++;
+}
+
+/* Make L match exactly STR, of length LEN.  */
+static void
+lits_init (struct lits *l, char const *str, idx_t len)
+{
+  *l = (struct lits) { .exact = true };
+  lits_add (l, str, len);
+}
+
+/* Make L know nothing.  */
+static void
+lits_clear (struct lits *l)
+{
+  for (idx_t i = 0; i < l->n; i++)
+    free (l->v[i].str);
+  l->n = 0;
+  l->exact = false;
+}
+
+static void
+lits_free (struct lits *l)
+{
+  lits_clear (l);
+  free (l->v);
+}
+
+/* Turn L into a set of strings one of which each match contains.  */
+static void
+lits_inexact (struct lits *l)
+{
+  if (l->exact)
+    {
+      for (idx_t i = 0; i < l->n; i++)
+        if (l->v[i].len == 0)
+          {
+            lits_clear (l);
+            break;
+          }
+      l->exact = false;
+    }
+}
+
+/* Return the length of the shortest string in L, which is not empty.  */
+static idx_t
+lits_minlen (struct lits const *l)
+{
+  idx_t min = l->v[0].len;
+  for (idx_t i = 1; i < l->n; i++)
+    min = MIN (min, l->v[i].len);
+  return min;
+}
+
+/* Replace *BEST by CAND, made inexact, if CAND filters better, and
+   free the other one.  */
+static void
+lits_keep_better (struct lits *best, struct lits *cand)
+{
+  lits_inexact (cand);
+  if (cand->n
+      && (!best->n || lits_minlen (best) < lits_minlen (cand)
+          || (lits_minlen (best) == lits_minlen (cand) && cand->n < best->n)))
+    {
+      struct lits t = *best;
+      *best = *cand;
+      *cand = t;
+    }
+  lits_free (cand);
+}
+
+/* Set *A to the concatenation of A and B, which are both exact, and
+   free B.  */
+static void
+lits_concat (struct lits *a, struct lits *b)
+{
+  struct lits r = { .exact = true };
+  for (idx_t i = 0; i < a->n; i++)
+    for (idx_t j = 0; j < b->n; j++)
+      {
+        char *s = ximalloc (a->v[i].len + b->v[j].len);
+        memcpy (s, a->v[i].str, a->v[i].len);
+        memcpy (s + a->v[i].len, b->v[j].str, b->v[j].len);
+        lits_add (&r, s, a->v[i].len + b->v[j].len);
+        free (s);
+      }
+  lits_free (a);
+  lits_free (b);
+  *a = r;
+}
+
+/* Set *A to the alternation of A and B, and free B.  */
+static void
+lits_union (struct lits *a, struct lits *b)
+{
+  if (! (a->exact && b->exact && a->n + b->n <= EXACT_MAX))
+    {
+      lits_inexact (a);
+      lits_inexact (b);
+      if (!a->n || !b->n)
+        {
+          lits_clear (a);
+          lits_free (b);
+          return;
+        }
+    }
+  for (idx_t i = 0; i < b->n; i++)
+    {
+      if (a->n == a->alloc)
+        a->v = xpalloc (a->v, &a->alloc, 1, -1, sizeof *a->v);
+      a->v[a->n++] = b->v[i];
+    }
+  free (b->v);
+}
+
+/* Return the operator at the start of PS's input, and set *LEN to its
+   length.  */
+static enum op
+op_at (struct parser const *ps, int *len)
+{
+  reg_syntax_t bits = ps->syntax_bits;
+  char const *p = ps->p;
+  bool bk = *p == '\\' && p + 1 < ps->lim;
+  char c = p[bk];
+  *len = 1 + bk;
+
+  if (c == '*' && !bk)
+    return OP_STAR;
+  if ((c == '+' || c == '?') && bk == !!(bits & RE_BK_PLUS_QM)
+      && ! (bits & RE_LIMITED_OPS))
+    return c == '+' ? OP_PLUS : OP_QMARK;
+  if ((c == '(' || c == ')') && bk == ! (bits & RE_NO_BK_PARENS))
+    return c == '(' ? OP_LPAREN : OP_RPAREN;
+  if (c == '|' && bk == ! (bits & RE_NO_BK_VBAR) && ! (bits & RE_LIMITED_OPS))
+    return OP_OR;
+  if (c == '{' && bk == ! (bits & RE_NO_BK_BRACES) && bits & RE_INTERVALS)
+    return OP_INTERVAL;
+  return OP_NONE;
+}
+
+/* Parse the interval whose contents start at PS's input, and return
+   its minimum count, or -1 if it cannot be parsed.  */
+static idx_t
+parse_interval (struct parser *ps)
+{
+  bool bk = ! (ps->syntax_bits & RE_NO_BK_BRACES);
+  idx_t min = 0;
+  char const *p = ps->p;
+  for (; p < ps->lim && c_isdigit (*p); p++)
+    if (ckd_mul (&min, min, 10) || ckd_add (&min, min, *p - '0'))
+      return -1;
+  if (p < ps->lim && *p == ',')
+    for (p++; p < ps->lim && c_isdigit (*p); p++)
+      continue;
+  if (bk)
+    {
+      if (! (p < ps->lim && *p == '\\'))
+        return -1;
+      p++;
+    }
+  if (! (p < ps->lim && *p == '}'))
+    return -1;
+  ps->p = p + 1;
+  return min;
+}
+
+/* Parse the bracket expression whose contents start at PS's input,
+   and set *L to what it matches.  */
+static void
+parse_bracket (struct parser *ps, struct lits *l)
+{
+  char const *p = ps->p;
+  bool plain = !(p < ps->lim && *p == '^');
+  p += !plain;
+  char members[BRACKET_MAX];
+  int nmembers = 0;
+
+  for (bool first = true; ; first = false)
+    {
+      if (p == ps->lim)
+        {
+          ps->fail = true;
+          return;
+        }
+      if (*p == ']' && !first)
+        break;
+      if (*p == '[' && p + 1 < ps->lim
+          && (p[1] == ':' || p[1] == '.' || p[1] == '='))
+        {
+          char delim = p[1];
+          for (p += 2; ! (p + 1 < ps->lim && p[0] == delim && p[1] == ']');
+               p++)
+            if (p + 1 >= ps->lim)
+              {
+                ps->fail = true;
+                return;
+              }
+          p += 2;
+          plain = false;
+          continue;
+        }
+      ptrdiff_t n = char_len (ps, p);
+      if (n != 1)
+        {
+          if (n < 0)
+            {
+              ps->fail = true;
+              return;
+            }
+          plain = false;
+        }
+      else if (p + 2 < ps->lim && p[1] == '-' && p[2] != ']')
+        plain = false;
+      else if (nmembers < BRACKET_MAX)
+        members[nmembers++] = *p;
+      else
+        plain = false;
+      p += n;
+    }
+  ps->p = p + 1;
+
+  *l = (struct lits) { .exact = plain };
+  if (plain)
+    for (int i = 0; i < nmembers; i++)
+      lits_add (l, &members[i], 1);
+}
+
+static void parse_regexp (struct parser *, struct lits *);
+
+/* Parse an atom at PS's input, and set *L to what it matches.  */
+static void
+parse_atom (struct parser *ps, struct lits *l)
+{
+  int len;
+  enum op op = op_at (ps, &len);
+  char const *p = ps->p;
+  *l = (struct lits) { 0 };
+
+  if (op == OP_LPAREN)
+    {
+      ps->p += len;
+      ps->depth++;
+      parse_regexp (ps, l);
+      ps->depth--;
+      if (ps->fail || ps->p == ps->lim || op_at (ps, &len) != OP_RPAREN)
+        ps->fail = true;
+      else
+        ps->p += len;
+      return;
+    }
+  if (op != OP_NONE)
+    {
+      /* A repetition with nothing to repeat, or a stray parenthesis,
+         means something different in each syntax.  */
+      ps->fail = true;
+      return;
+    }
+
+  if (*p == '[')
+    {
+      ps->p++;
+      parse_bracket (ps, l);
+      return;
+    }
+  if (*p == '.' || *p == '^' || *p == '$')
+    {
+      /* Any character, or an anchor or a literal '^' or '$'
+         depending on where it is.  */
+      ps->p++;
+      return;
+    }
+  if (*p == '\\')
+    {
+      if (p + 1 == ps->lim)
+        {
+          ps->fail = true;
+          return;
+        }
+      p++;
+      switch (*p)
+        {
+        case 'b': case 'B': case '<': case '>': case '`': case '\'':
+          /* An assertion that matches the empty string.  */
+          ps->p = p + 1;
+          lits_init (l, "", 0);
+          return;
+        }
+      if (c_isalnum (*p))
+        {
+          /* A back-reference, a character class like \w, or a stray
+             backslash whose meaning may change.  */
+          ps->p = p + 1;
+          return;
+        }
+    }
+
+  ptrdiff_t n = char_len (ps, p);
+  if (n < 0)
+    {
+      ps->fail = true;
+      return;
+    }
+  ps->p = p + n;
+  lits_init (l, p, n);
+}
+
+/* Parse a piece at PS's input: an atom and any repetitions of it.
+   Set *L to what it matches.  */
+static void
+parse_piece (struct parser *ps, struct lits *l)
+{
+  parse_atom (ps, l);
+  while (!ps->fail && ps->p < ps->lim)
+    {
+      int len;
+      enum op op = op_at (ps, &len);
+      if (op == OP_STAR)
+        lits_clear (l);
+      else if (op == OP_PLUS)
+        lits_inexact (l);
+      else if (op == OP_QMARK)
+        {
+          if (l->exact && l->n < EXACT_MAX)
+            lits_add (l, "", 0);
+          else
+            lits_clear (l);
+        }
+      else if (op == OP_INTERVAL)
+        {
+          ps->p += len;
+          idx_t min = parse_interval (ps);
+          if (min < 0)
+            ps->fail = true;
+          else if (min == 0)
+            lits_clear (l);
+          else
+            lits_inexact (l);
+          continue;
+        }
+      else
+        break;
+      ps->p += len;
+    }
+}
+
+/* Parse a branch at PS's input: a concatenation of pieces.  Set *L to
+   what it matches.  */
+static void
+parse_branch (struct parser *ps, struct lits *l)
+{
+  struct lits best = { 0 };
+  struct lits run;
+  lits_init (&run, "", 0);
+  bool exact = true;
+
+  while (!ps->fail && ps->p < ps->lim)
+    {
+      int len;
+      enum op op = op_at (ps, &len);
+      if (op == OP_OR || (op == OP_RPAREN && ps->depth))
+        break;
+
+      struct lits piece;
+      parse_piece (ps, &piece);
+      if (piece.exact && run.n * piece.n <= EXACT_MAX)
+        lits_concat (&run, &piece);
+      else
+        {
+          exact = false;
+          if (piece.exact)
+            {
+              lits_keep_better (&best, &run);
+              run = piece;
+            }
+          else
+            {
+              lits_keep_better (&best, &piece);
+              lits_keep_better (&best, &run);
+              lits_init (&run, "", 0);
+            }
+        }
+    }
+
+  if (exact)
+    {
+      *l = run;
+      lits_free (&best);
+    }
+  else
+    {
+      lits_keep_better (&best, &run);
+      *l = best;
+    }
+}
+
+/* Parse a regular expression at PS's input: alternated branches.  Set
+   *L to what it matches.  */
+static void
+parse_regexp (struct parser *ps, struct lits *l)
+{
+  parse_branch (ps, l);
+  while (!ps->fail && ps->p < ps->lim)
+    {
+      int len;
+      if (op_at (ps, &len) != OP_OR)
+        break;
+      ps->p += len;
+      struct lits b;
+      parse_branch (ps, &b);
+      lits_union (l, &b);
+    }
+}
+
+static int
+literal_cmp (void const *a, void const *b)
+{
+  struct literal const *x = a, *y = b;
+  int cmp = memcmp (x->str, y->str, MIN (x->len, y->len));
+  return cmp ? cmp : (x->len > y->len) - (x->len < y->len);
+}
+
+/* Return an array of strings one of which every match of the SIZE
+   bytes of PATTERN contains, and set *NLITERALS to their number.
+   PATTERN is a list of patterns separated by newlines, in the syntax
+   SYNTAX_BITS.  Return null if there are no such strings, or none long
+   enough to be worth searching for.  */
+struct literal *
+required_literals (char const *pattern, idx_t size, reg_syntax_t syntax_bits,
+                   idx_t *nliterals)
+{
+  /* Leave encodings where a byte like '\' may end a character, and
+     case folding that may turn ASCII letters into other characters, to
+     the DFA.  */
+  if ((localeinfo.multibyte
+       && (!localeinfo.using_utf8 || syntax_bits & RE_ICASE))
+      || (syntax_bits & (RE_BACKSLASH_ESCAPE_IN_LISTS | RE_NO_GNU_OPS)))
+    return nullptr;
+
+  struct parser ps = { .syntax_bits = syntax_bits };
+  struct lits all = { 0 };
+  char const *patlim = pattern + size;
+
+  for (char const *p = pattern; p <= patlim; )
+    {
+      char const *sep = memchr (p, '\n', patlim - p);
+      ps.p = p;
+      ps.lim = sep ? sep : patlim;
+      mbszero (&ps.mbs);
+
+      struct lits l;
+      parse_regexp (&ps, &l);
+      if (ps.fail || ps.p < ps.lim)
+        {
+          lits_free (&l);
+          lits_free (&all);
+          return nullptr;
+        }
+      if (p == pattern)
+        all = l;
+      else
+        lits_union (&all, &l);
+      if (!sep)
+        break;
+      p = sep + 1;
+    }
+
+  lits_inexact (&all);
+  if (!all.n || lits_minlen (&all) < LITERAL_MIN)
+    {
+      lits_free (&all);
+      return nullptr;
+    }
+
+  /* Drop duplicates.  */
+  qsort (all.v, all.n, sizeof *all.v, literal_cmp);
+  idx_t n = 1;
+  for (idx_t i = 1; i < all.n; i++)
+    if (literal_cmp (&all.v[n - 1], &all.v[i]) == 0)
+      free (all.v[i].str);
+    else
+      all.v[n++] = all.v[i];
+
+  *nliterals = n;
+  return all.v;
+}
+
+/* Free the N strings of LITERALS, and the array.  */
+void
+free_literals (struct literal *literals, idx_t n)
+{
+  for (idx_t i = 0; i < n; i++)
+    free (literals[i].str);
+  free (literals);
+}
@@ -18,6 +18,7 @@
 
 #include <search.h>
 #include "die.h"
+#include "probes.h"
 
 #include <stdckdint.h>
 
@@ -46,8 +47,160 @@ enum { MATCH_INVALID_UTF = PCRE2_MATCH_INVALID_UTF };
 enum { MATCH_INVALID_UTF = 0 };
 #endif
 
+#if PCRE_DLOPEN
+/* PCRE2 is loaded with dlopen when a -P pattern is compiled or the
+   version is printed, so that other searches neither pay to link it
+   nor need it installed.  Each function is called through a pointer
+   named after it, which the macros below substitute for it.  */
+
+# include <dlfcn.h>
+
+# ifdef PCRE2_EXTRA_MATCH_LINE
+#  define PCRE2_EXTRA_FUNCTIONS \
+  PCRE2_FUNCTION (pcre2_set_compile_extra_options)
+# else
+#  define PCRE2_EXTRA_FUNCTIONS
+# endif
+# define PCRE2_FUNCTIONS \
+  PCRE2_FUNCTION (pcre2_code_free) \
+  PCRE2_FUNCTION (pcre2_compile) \
+  PCRE2_FUNCTION (pcre2_compile_context_create) \
+  PCRE2_FUNCTION (pcre2_compile_context_free) \
+  PCRE2_FUNCTION (pcre2_config) \
+  PCRE2_FUNCTION (pcre2_general_context_create) \
+  PCRE2_FUNCTION (pcre2_general_context_free) \
+  PCRE2_FUNCTION (pcre2_get_error_message) \
+  PCRE2_FUNCTION (pcre2_get_ovector_pointer) \
+  PCRE2_FUNCTION (pcre2_get_startchar) \
+  PCRE2_FUNCTION (pcre2_jit_compile) \
+  PCRE2_FUNCTION (pcre2_jit_stack_assign) \
+  PCRE2_FUNCTION (pcre2_jit_stack_create) \
+  PCRE2_FUNCTION (pcre2_jit_stack_free) \
+  PCRE2_FUNCTION (pcre2_maketables) \
+  PCRE2_FUNCTION (pcre2_match) \
+  PCRE2_FUNCTION (pcre2_match_context_create) \
+  PCRE2_FUNCTION (pcre2_match_context_free) \
+  PCRE2_FUNCTION (pcre2_match_data_create_from_pattern) \
+  PCRE2_FUNCTION (pcre2_match_data_free) \
+  PCRE2_FUNCTION (pcre2_pattern_info) \
+  PCRE2_FUNCTION (pcre2_set_character_tables) \
+  PCRE2_FUNCTION (pcre2_set_depth_limit) \
+  PCRE2_EXTRA_FUNCTIONS
+
+/* The names of the library to try, in order.  */
+static char const *const pcre2_libraries[] =
+  { "libpcre2-8.so.0", "libpcre2-8.0.dylib", "libpcre2-8.so", nullptr };
+
+/* The name of F after macro expansion, as a string.  */
+# define PCRE2_NAME(f) PCRE2_STRING (f)
+# define PCRE2_STRING(f) #f
+
+# define PCRE2_FUNCTION(f) static typeof (f) *f##_ptr;
+PCRE2_FUNCTIONS
+# undef PCRE2_FUNCTION
+
+/* Load PCRE2 if it is not loaded already.  Return true if successful,
+   and otherwise set *ERR to the reason.  */
+static bool
+load_pcre (char const **err)
+{
+  static void *handle;
+  if (handle)
+    return true;
+  for (char const *const *lib = pcre2_libraries; !handle && *lib; lib++)
+    handle = dlopen (*lib, RTLD_LAZY | RTLD_LOCAL);
+  if (!handle)
+    {
+      *err = dlerror ();
+      return false;
+    }
+
+# define PCRE2_FUNCTION(f) \
+  if (! (f##_ptr = dlsym (handle, PCRE2_NAME (f)))) \
+    { \
+      *err = dlerror (); \
+      dlclose (handle); \
+      handle = nullptr; \
+      return false; \
+    }
+  PCRE2_FUNCTIONS
+# undef PCRE2_FUNCTION
+
+  return true;
+}
+
+# undef pcre2_code_free
+# define pcre2_code_free pcre2_code_free_ptr
+# undef pcre2_compile
+# define pcre2_compile pcre2_compile_ptr
+# undef pcre2_compile_context_create
+# define pcre2_compile_context_create pcre2_compile_context_create_ptr
+# undef pcre2_compile_context_free
+# define pcre2_compile_context_free pcre2_compile_context_free_ptr
+# undef pcre2_config
+# define pcre2_config pcre2_config_ptr
+# undef pcre2_general_context_create
+# define pcre2_general_context_create pcre2_general_context_create_ptr
+# undef pcre2_general_context_free
+# define pcre2_general_context_free pcre2_general_context_free_ptr
+# undef pcre2_get_error_message
+# define pcre2_get_error_message pcre2_get_error_message_ptr
+# undef pcre2_get_ovector_pointer
+# define pcre2_get_ovector_pointer pcre2_get_ovector_pointer_ptr
+# undef pcre2_get_startchar
+# define pcre2_get_startchar pcre2_get_startchar_ptr
+# undef pcre2_jit_compile
+# define pcre2_jit_compile pcre2_jit_compile_ptr
+# undef pcre2_jit_stack_assign
+# define pcre2_jit_stack_assign pcre2_jit_stack_assign_ptr
+# undef pcre2_jit_stack_create
+# define pcre2_jit_stack_create pcre2_jit_stack_create_ptr
+# undef pcre2_jit_stack_free
+# define pcre2_jit_stack_free pcre2_jit_stack_free_ptr
+# undef pcre2_maketables
+# define pcre2_maketables pcre2_maketables_ptr
+# undef pcre2_match
+# define pcre2_match pcre2_match_ptr
+# undef pcre2_match_context_create
+# define pcre2_match_context_create pcre2_match_context_create_ptr
+# undef pcre2_match_context_free
+# define pcre2_match_context_free pcre2_match_context_free_ptr
+# undef pcre2_match_data_create_from_pattern
+# define pcre2_match_data_create_from_pattern pcre2_match_data_create_from_pattern_ptr
+# undef pcre2_match_data_free
+# define pcre2_match_data_free pcre2_match_data_free_ptr
+# undef pcre2_pattern_info
+# define pcre2_pattern_info pcre2_pattern_info_ptr
+# undef pcre2_set_character_tables
+# define pcre2_set_character_tables pcre2_set_character_tables_ptr
+# undef pcre2_set_depth_limit
+# define pcre2_set_depth_limit pcre2_set_depth_limit_ptr
+# ifdef PCRE2_EXTRA_MATCH_LINE
+#  undef pcre2_set_compile_extra_options
+#  define pcre2_set_compile_extra_options pcre2_set_compile_extra_options_ptr
+# endif
+#else
+static bool
+load_pcre (_GL_UNUSED char const **err)
+{
+  return true;
+}
+#endif
+
+/* Load PCRE2, or report an error and exit if it cannot be loaded.  */
+static void
+require_pcre (void)
+{
+  char const *err;
+  if (!load_pcre (&err))
+    die (EXIT_TROUBLE, 0, _("-P needs the PCRE2 library: %s"), err);
+}
+
 struct pcre_comp
 {
+  /* The options the pattern was compiled with.  */
+  struct matchopts opts;
+
   /* General context for PCRE operations.  */
   pcre2_general_context *gcontext;
 
@@ -84,6 +237,12 @@ private_free (void *ptr, _GL_UNUSED void *unused)
 void
 Pprint_version (void)
 {
+  char const *err;
+  if (!load_pcre (&err))
+    {
+      printf (_("\ngrep -P needs PCRE2, which cannot be loaded: %s\n"), err);
+      return;
+    }
   char *buf = ximalloc (pcre2_config (PCRE2_CONFIG_VERSION, nullptr));
   pcre2_config (PCRE2_CONFIG_VERSION, buf);
   printf (_("\ngrep -P uses PCRE2 %s\n"), buf);
@@ -106,13 +265,17 @@ jit_exec (struct pcre_comp *pc, char const *subject, idx_t search_bytes,
       int STACK_GROWTH_RATE = 8192;
       idx_t jitstack_max = MIN (IDX_MAX, SIZE_MAX - (STACK_GROWTH_RATE - 1));
 
+      xtime_t start_time = stats_clock ();
       int e = pcre2_match (pc->cre, (PCRE2_SPTR) subject, search_bytes,
                            search_offset, options, pc->data, pc->mcontext);
+      stats_charge (PHASE_PCRE, start_time);
+      PROBE3 (pcre__exec, search_bytes, search_offset, e);
       if (e == PCRE2_ERROR_JIT_STACKLIMIT
           && pc->jit_stack_size <= jitstack_max / 2)
         {
           idx_t old_size = pc->jit_stack_size;
           idx_t new_size = pc->jit_stack_size = old_size * 2;
+          stats.jit_stack_growths++;
           pcre2_jit_stack_free (pc->jit_stack);
           pc->jit_stack = pcre2_jit_stack_create (old_size, new_size,
                                                   pc->gcontext);
@@ -145,19 +308,18 @@ bad_utf8_from_pcre2 (int e)
 }
 
 /* Compile the -P style PATTERN, containing SIZE bytes that are
-   followed by '\n'.  Return a description of the compiled pattern.  */
+   followed by '\n', to match with the options OPTS.  Return a
+   description of the compiled pattern.  */
 
 void *
-Pcompile (char *pattern, idx_t size, reg_syntax_t ignored, bool exact)
+Pcompile (char *pattern, idx_t size, reg_syntax_t ignored, bool exact,
+          struct matchopts const *opts)
 {
   PCRE2_SIZE e;
   int ec;
-  int flags = PCRE2_DOLLAR_ENDONLY | (match_icase ? PCRE2_CASELESS : 0);
+  require_pcre ();
+  int flags = PCRE2_DOLLAR_ENDONLY | (opts->icase ? PCRE2_CASELESS : 0);
   char *patlim = pattern + size;
-  struct pcre_comp *pc = ximalloc (sizeof *pc);
-  pcre2_general_context *gcontext = pc->gcontext
-    = pcre2_general_context_create (private_malloc, private_free, nullptr);
-  pcre2_compile_context *ccontext = pcre2_compile_context_create (gcontext);
 
   if (localeinfo.multibyte)
     {
@@ -191,14 +353,20 @@ Pcompile (char *pattern, idx_t size, reg_syntax_t ignored, bool exact)
   if (rawmemchr (pattern, '\n') != patlim)
     die (EXIT_TROUBLE, 0, _("the -P option only supports a single pattern"));
 
+  struct pcre_comp *pc = ximalloc (sizeof *pc);
+  pc->opts = *opts;
+  pcre2_general_context *gcontext = pc->gcontext
+    = pcre2_general_context_create (private_malloc, private_free, nullptr);
+  pcre2_compile_context *ccontext = pcre2_compile_context_create (gcontext);
+
 #ifdef PCRE2_EXTRA_MATCH_LINE
   uint32_t extra_options = (PCRE2_EXTRA_ASCII_BSD
-                            | (match_lines ? PCRE2_EXTRA_MATCH_LINE : 0));
+                            | (opts->lines ? PCRE2_EXTRA_MATCH_LINE : 0));
   pcre2_set_compile_extra_options (ccontext, extra_options);
 #endif
 
   void *re_storage = nullptr;
-  if (match_lines)
+  if (opts->lines)
     {
 #ifndef PCRE2_EXTRA_MATCH_LINE
       static char const *const xprefix = "^(?:";
@@ -212,7 +380,7 @@ Pcompile (char *pattern, idx_t size, reg_syntax_t ignored, bool exact)
       size = re_size;
 #endif
     }
-  else if (match_words)
+  else if (opts->words)
     {
       /* PCRE2_EXTRA_MATCH_WORD is incompatible with grep -w;
          do things the grep way.  */
@@ -227,8 +395,12 @@ Pcompile (char *pattern, idx_t size, reg_syntax_t ignored, bool exact)
       size = re_size;
     }
 
+  uint8_t const *tables = nullptr;
   if (!localeinfo.multibyte)
-    pcre2_set_character_tables (ccontext, pcre2_maketables (gcontext));
+    {
+      tables = pcre2_maketables (gcontext);
+      pcre2_set_character_tables (ccontext, tables);
+    }
 
   pc->cre = pcre2_compile ((PCRE2_SPTR) pattern, size, flags,
                            &ec, &e, ccontext);
@@ -237,6 +409,11 @@ Pcompile (char *pattern, idx_t size, reg_syntax_t ignored, bool exact)
       enum { ERRBUFSIZ = 256 }; /* Taken from pcre2grep.c ERRBUFSIZ.  */
       PCRE2_UCHAR8 ep[ERRBUFSIZ];
       pcre2_get_error_message (ec, ep, sizeof ep);
+      free (re_storage);
+      private_free ((void *) tables, nullptr);
+      pcre2_compile_context_free (ccontext);
+      pcre2_general_context_free (gcontext);
+      free (pc);
       die (EXIT_TROUBLE, 0, "%s", ep);
     }
 
@@ -264,12 +441,13 @@ ptrdiff_t
 Pexecute (void *vcp, char const *buf, idx_t size, idx_t *match_size,
           char const *start_ptr)
 {
+  struct pcre_comp *pc = vcp;
+  char eol = pc->opts.eol;
   char const *p = start_ptr ? start_ptr : buf;
-  bool bol = p[-1] == eolbyte;
+  bool bol = p[-1] == eol;
   char const *line_start = buf;
   int e = PCRE2_ERROR_NOMATCH;
   char const *line_end;
-  struct pcre_comp *pc = vcp;
   PCRE2_SIZE *sub = pcre2_get_ovector_pointer (pc->data);
 
   /* The search address to pass to PCRE.  This is the start of
@@ -283,7 +461,7 @@ Pexecute (void *vcp, char const *buf, idx_t size, idx_t *match_size,
          PCRE2_MULTILINE for performance, the performance wasn't always
          better and the correctness issues were too puzzling.  See
          Bug#22655.  */
-      line_end = rawmemchr (p, eolbyte);
+      line_end = rawmemchr (p, eol);
       if (PCRE2_SIZE_MAX < line_end - p)
         die (EXIT_TROUBLE, 0, _("exceeded PCRE's line length limit"));
 
@@ -419,3 +597,28 @@ Pexecute (void *vcp, char const *buf, idx_t size, idx_t *match_size,
       return beg - buf;
     }
 }
+
+/* Describe how the compiled pattern VCP will be matched, for --explain.  */
+void
+Pexplain (void *vcp, explain_printf_t print)
+{
+  struct pcre_comp *pc = vcp;
+  size_t jitsize;
+  bool jit = (pcre2_pattern_info (pc->cre, PCRE2_INFO_JITSIZE, &jitsize) == 0
+              && jitsize != 0);
+
+  print (_("PCRE2 JIT: %s\n"), jit ? _("yes") : _("no"));
+}
+
+/* Free the compiled pattern VCP.  */
+void
+Pfree (void *vcp)
+{
+  struct pcre_comp *pc = vcp;
+  pcre2_jit_stack_free (pc->jit_stack);
+  pcre2_match_context_free (pc->mcontext);
+  pcre2_match_data_free (pc->data);
+  pcre2_code_free (pc->cre);
+  pcre2_general_context_free (pc->gcontext);
+  free (pc);
+}
@@ -0,0 +1,38 @@
+/* probes.h - static tracepoints in grep.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef GREP_PROBES_H
+#define GREP_PROBES_H 1
+
+/* PROBEn (NAME, ...) marks a statically defined tracepoint named
+   NAME in the provider "grep", with N integer or pointer arguments.
+   Tools like bpftrace, perf and SystemTap can attach to it as
+   usdt:grep:NAME, where a double underscore in NAME is shown as "-"
+   by some tools.  An untraced probe costs a single no-op instruction;
+   without <sys/sdt.h>, probes expand to nothing.  */
+
+#if HAVE_SYS_SDT_H
+# include <sys/sdt.h>
+# define PROBE1(name, a) DTRACE_PROBE1 (grep, name, a)
+# define PROBE2(name, a, b) DTRACE_PROBE2 (grep, name, a, b)
+# define PROBE3(name, a, b, c) DTRACE_PROBE3 (grep, name, a, b, c)
+#else
+# define PROBE1(name, a) ((void) 0)
+# define PROBE2(name, a, b) ((void) 0)
+# define PROBE3(name, a, b, c) ((void) 0)
+#endif
+
+#endif
@@ -27,6 +27,7 @@
 #include "system.h"
 #include "grep.h"
 #include "dfa.h"
+#include "gethrxtime.h"
 #include "kwset.h"
 #include "xalloc.h"
 #include "localeinfo.h"
@@ -42,31 +43,139 @@ _GL_INLINE_HEADER_BEGIN
    technically, two bits may be sufficient.  */
 typedef signed char mb_len_map_t;
 
+/* Options that affect how patterns match.  A matcher copies them when
+   compiling, so that searching with the compiled pattern depends on
+   no global state other than the locale.  */
+struct matchopts
+{
+  bool icase;			/* -i */
+  bool words;			/* -w */
+  bool lines;			/* -x */
+  bool regex_only;		/* --engine=regex */
+  char eol;			/* -z */
+  idx_t dfa_memory;		/* --dfa-memory, or 0 for no limit */
+  idx_t max_errors;		/* --max-errors */
+  bool quiet;			/* No pattern warnings, for --rules */
+};
+
+/* The calls to the slower matchers made for one pattern of a compiled
+   pattern list, for --pattern-profile.  LINENO is the origin-0 number
+   of the pattern in the list, or -1 for calls made for all the
+   patterns without back-references together.  */
+struct pattern_cost
+{
+  idx_t lineno;
+  intmax_t regex_calls;
+  intmax_t backref_calls;
+};
+
+/* A printf-like function through which the matchers write --explain
+   output, so that the caller can check for write errors.  */
+typedef void (*explain_printf_t) (char const *, ...);
+
+/* The character boundaries found so far in a buffer, in a multibyte
+   locale other than UTF-8, where whether a byte starts a character can
+   be found only by scanning forward from a byte known to start one.
+   BUF starts a character, and the buffer ends at END.  For each byte
+   before SCANNED, which starts a character, the bit numbered by its
+   offset from BUF in BITS says whether it starts a character.  */
+struct mb_bounds
+{
+  char const *buf;
+  char const *end;
+  char const *scanned;
+  mbstate_t mbs;
+  uint64_t *bits;
+  idx_t nwords;			/* Words of BITS in use.  */
+  idx_t alloc;			/* Words allocated for BITS.  */
+};
+
 /* searchutils.c */
 extern void wordinit (void);
-extern kwset_t kwsinit (bool);
+extern kwset_t kwsinit (bool, bool);
 extern idx_t wordchars_size (char const *, char const *) _GL_ATTRIBUTE_PURE;
 extern idx_t wordchar_next (char const *, char const *) _GL_ATTRIBUTE_PURE;
-extern idx_t wordchar_prev (char const *, char const *, char const *)
-  _GL_ATTRIBUTE_PURE;
-extern ptrdiff_t mb_goback (char const **, idx_t *, char const *, char const *);
+extern idx_t wordchar_prev (char const *, char const *, char const *,
+                            struct mb_bounds *);
+extern void mb_bounds_reset (struct mb_bounds *, char const *, char const *);
+extern void mb_bounds_free (struct mb_bounds *);
+extern ptrdiff_t mb_goback (char const **, idx_t *, char const *, char const *,
+                            struct mb_bounds *);
+extern bool contains_encoding_error (char const *, idx_t) _GL_ATTRIBUTE_PURE;
+extern void fgrep_to_grep_pattern (char **, idx_t *);
+
+/* literals.c */
+struct literal
+{
+  char *str;
+  idx_t len;
+};
+extern struct literal *required_literals (char const *, idx_t, reg_syntax_t,
+                                          idx_t *);
+extern void free_literals (struct literal *, idx_t);
+
+/* backref.c */
+struct backref;
+enum { BACKREF_GAVE_UP = -2 };
+extern struct backref *backref_compile (char const *, idx_t, reg_syntax_t);
+extern ptrdiff_t backref_search (struct backref *, char const *, idx_t,
+                                 idx_t, idx_t, bool,
+                                 bool (*) (void *, idx_t, idx_t), void *,
+                                 idx_t *);
+extern void backref_free (struct backref *);
+
+/* inner.c */
+struct inner;
+extern struct inner *inner_compile (char const *, idx_t, reg_syntax_t,
+                                    char const *);
+extern bool inner_match (struct inner const *, char const *, char const *,
+                         char const *) _GL_ATTRIBUTE_PURE;
+extern void inner_free (struct inner *);
+
+/* utf8dfa.c */
+extern char *utf8_byte_pattern (char const *, idx_t, reg_syntax_t, idx_t *);
+extern struct localeinfo const *utf8_byte_localeinfo (void);
 
 /* dfasearch.c */
-extern void *GEAcompile (char *, idx_t, reg_syntax_t, bool);
+extern void *GEAcompile (char *, idx_t, reg_syntax_t, bool,
+                         struct matchopts const *);
 extern ptrdiff_t EGexecute (void *, char const *, idx_t, idx_t *, char const *);
+extern ptrdiff_t GEAcount (void *, char const *, idx_t);
+extern void GEAexplain (void *, explain_printf_t);
+extern void GEAreset (void *);
+extern void GEAfree (void *);
+extern char const *GEAmust (void *) _GL_ATTRIBUTE_PURE;
+extern idx_t GEAcosts (void *, struct pattern_cost const **);
+extern idx_t heap_in_use (void);
 
 /* kwsearch.c */
-extern void *Fcompile (char *, idx_t, reg_syntax_t, bool);
+extern void *Fcompile (char *, idx_t, reg_syntax_t, bool,
+                       struct matchopts const *);
 extern ptrdiff_t Fexecute (void *, char const *, idx_t, idx_t *, char const *);
+extern ptrdiff_t Fcount (void *, char const *, idx_t);
+extern void Fexplain (void *, explain_printf_t);
+extern idx_t Fcosts (void *, struct pattern_cost const **);
+extern void Freset (void *);
+extern void Ffree (void *);
+
+/* approx.c */
+extern void *Acompile (char *, idx_t, reg_syntax_t, bool,
+                       struct matchopts const *);
+extern ptrdiff_t Aexecute (void *, char const *, idx_t, idx_t *, char const *);
+extern ptrdiff_t Acount (void *, char const *, idx_t);
+extern void Aexplain (void *, explain_printf_t);
+extern void Afree (void *);
 
 /* pcresearch.c */
-extern void *Pcompile (char *, idx_t, reg_syntax_t, bool);
+extern void *Pcompile (char *, idx_t, reg_syntax_t, bool,
+                       struct matchopts const *);
 extern ptrdiff_t Pexecute (void *, char const *, idx_t, idx_t *, char const *);
+extern void Pexplain (void *, explain_printf_t);
+extern void Pfree (void *);
 extern void Pprint_version (void);
 
-/* grep.c */
+/* grep.c or libgrep.c */
 extern struct localeinfo localeinfo;
-extern void fgrep_to_grep_pattern (char **, idx_t *);
 
 /* Return the number of bytes in the character at the start of S, which
    is of size N.  N must be positive.  MBS is the conversion state.
@@ -97,6 +206,22 @@ mb_clen (char const *s, idx_t n, mbstate_t *mbs)
   return len == -2 ? imbrlen (s, n, mbs) : len;
 }
 
+/* Return the current time if --stats needs it, and 0 otherwise.  */
+SEARCH_INLINE xtime_t
+stats_clock (void)
+{
+  return show_stats ? gethrxtime () : 0;
+}
+
+/* Charge the time since START, a value returned by stats_clock,
+   to PHASE.  */
+SEARCH_INLINE void
+stats_charge (enum stats_phase phase, xtime_t start)
+{
+  if (show_stats)
+    stats.phase_time[phase] += gethrxtime () - start;
+}
+
 extern char const *input_filename (void);
 
 _GL_INLINE_HEADER_END
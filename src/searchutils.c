@@ -41,11 +41,11 @@ wordinit (void)
 }
 
 kwset_t
-kwsinit (bool mb_trans)
+kwsinit (bool mb_trans, bool icase)
 {
   char *trans = nullptr;
 
-  if (match_icase && (MB_CUR_MAX == 1 || mb_trans))
+  if (icase && (MB_CUR_MAX == 1 || mb_trans))
     {
       trans = ximalloc (NCHAR);
       /* If I is a single-byte character that becomes a different
@@ -58,6 +58,73 @@ kwsinit (bool mb_trans)
   return kwsalloc (trans);
 }
 
+/* Start finding the character boundaries in B of the buffer that
+   starts at BUF and ends at END.  BUF must start a character.  */
+void
+mb_bounds_reset (struct mb_bounds *b, char const *buf, char const *end)
+{
+  b->buf = buf;
+  b->end = end;
+  b->scanned = buf;
+  mbszero (&b->mbs);
+  b->nwords = 0;
+}
+
+void
+mb_bounds_free (struct mb_bounds *b)
+{
+  free (b->bits);
+}
+
+/* Find the boundaries in B through the character containing CUR,
+   continuing the single forward scan of the buffer.  */
+static void
+mb_bounds_scan (struct mb_bounds *b, char const *cur)
+{
+  idx_t off = b->scanned - b->buf;
+  idx_t lim = cur - b->buf;
+  if (lim < off)
+    return;
+
+  /* The character containing CUR may extend MB_LEN_MAX - 1 bytes
+     past it.  */
+  idx_t nwords = (lim + MB_LEN_MAX) / 64 + 1;
+  if (b->nwords < nwords)
+    {
+      if (b->alloc < nwords)
+        b->bits = xpalloc (b->bits, &b->alloc, nwords - b->alloc, -1,
+                           sizeof *b->bits);
+      memset (b->bits + b->nwords, 0,
+              (nwords - b->nwords) * sizeof *b->bits);
+      b->nwords = nwords;
+    }
+
+  do
+    {
+      b->bits[off / 64] |= (uint64_t) 1 << off % 64;
+      ptrdiff_t clen = mb_clen (b->buf + off, b->end - b->buf - off,
+                                &b->mbs);
+      if (clen < 0)
+        {
+          /* Treat an encoding error as a single byte character.  */
+          clen = 1;
+          mbszero (&b->mbs);
+        }
+      off += clen;
+    }
+  while (off <= lim);
+
+  b->scanned = b->buf + off;
+}
+
+/* Return true if P, which B has scanned, starts a character.  */
+static bool
+mb_bounds_start (struct mb_bounds const *b, char const *p)
+{
+  idx_t off = p - b->buf;
+  return b->bits[off / 64] >> off % 64 & 1;
+}
+
 /* Return the number of bytes needed to go back to the start of a
    multibyte character in a buffer.  The buffer starts at *MB_START.
    (See below for MBCLEN's role.)  The multibyte character contains
@@ -86,10 +153,14 @@ kwsinit (bool mb_trans)
    similarly it is OK to scan forwards from CUR (without checking END)
    so long as the scan stops at a sentinel byte.
 
-   Treat encoding errors as if they were single-byte characters.  */
+   Treat encoding errors as if they were single-byte characters.
+
+   If BOUNDS is nonnull and has been reset to a buffer containing
+   *MB_START through CUR, look up the boundaries it records instead of
+   scanning forward from *MB_START each time.  */
 ptrdiff_t
 mb_goback (char const **mb_start, idx_t *mbclen, char const *cur,
-           char const *end)
+           char const *end, struct mb_bounds *bounds)
 {
   const char *p = *mb_start;
   const char *p0 = p;
@@ -125,6 +196,23 @@ mb_goback (char const **mb_start, idx_t *mbclen, char const *cur,
               break;
             }
     }
+  else if (bounds && bounds->buf <= p && cur < bounds->end)
+    {
+      mb_bounds_scan (bounds, cur);
+
+      /* Q is in the last character that starts before CUR, P0 is its
+         start and P its end.  Characters are at most MB_LEN_MAX bytes
+         long, so these loops are short.  */
+      char const *q = cur - mb_bounds_start (bounds, cur);
+      for (p0 = q; !mb_bounds_start (bounds, p0); p0--)
+        continue;
+      for (p = q + 1; p < bounds->scanned && !mb_bounds_start (bounds, p);
+           p++)
+        continue;
+
+      if (mbclen)
+        *mbclen = p - p0;
+    }
   else
     {
       /* In non-UTF-8 encodings, to find character boundaries one must
@@ -204,9 +292,10 @@ wordchar_next (char const *buf, char const *end)
 
 /* In the buffer BUF, return nonzero if the character whose encoding
    contains the byte before CUR is a word constituent.  The buffer
-   ends at END.  */
+   ends at END.  BOUNDS is as for mb_goback.  */
 idx_t
-wordchar_prev (char const *buf, char const *cur, char const *end)
+wordchar_prev (char const *buf, char const *cur, char const *end,
+               struct mb_bounds *bounds)
 {
   if (buf == cur)
     return 0;
@@ -214,6 +303,66 @@ wordchar_prev (char const *buf, char const *cur, char const *end)
   if (! localeinfo.multibyte || localeinfo.using_utf8 & ~(b >> 7))
     return sbwordchar[b];
   char const *p = buf;
-  cur -= mb_goback (&p, nullptr, cur, end);
+  cur -= mb_goback (&p, nullptr, cur, end, bounds);
   return wordchar_next (cur, end);
 }
+
+/* Return true if PAT (of length PATLEN) contains an encoding error.  */
+bool
+contains_encoding_error (char const *pat, idx_t patlen)
+{
+  mbstate_t mbs; mbszero (&mbs);
+  ptrdiff_t charlen;
+
+  for (idx_t i = 0; i < patlen; i += charlen)
+    {
+      charlen = mb_clen (pat + i, patlen - i, &mbs);
+      if (charlen < 0)
+        return true;
+    }
+  return false;
+}
+
+/* Change the pattern *KEYS_P, of size *LEN_P, from fgrep to grep style.  */
+
+void
+fgrep_to_grep_pattern (char **keys_p, idx_t *len_p)
+{
+  idx_t len = *len_p;
+  char *keys = *keys_p;
+  mbstate_t mb_state; mbszero (&mb_state);
+  char *new_keys = xnmalloc (len + 1, 2);
+  char *p = new_keys;
+
+  for (ptrdiff_t n; len; keys += n, len -= n)
+    {
+      n = mb_clen (keys, len, &mb_state);
+      switch (n)
+        {
+        case -2:
+          n = len;
+          FALLTHROUGH;
+        default:
+          p = mempcpy (p, keys, n);
+          break;
+
+        case -1:
+          memset (&mb_state, 0, sizeof mb_state);
+          n = 1;
+          FALLTHROUGH;
+        case 1:
+          switch (*keys)
+            {
+            case '$': case '*': case '.': case '[': case '\\': case '^':
+              *p++ = '\\'; break;
+            }
+          *p++ = *keys;
+          break;
+        }
+    }
+
+  *p = '\n';
+  free (*keys_p);
+  *keys_p = new_keys;
+  *len_p = p - new_keys;
+}
@@ -0,0 +1,356 @@
+/* serve.c - answer searches over a socket, for grep --serve.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* A server has already initialized the locale and compiled its
+   patterns when it starts listening on a Unix-domain socket.  For
+   each connection it forks a process that receives the client's output
+   options, file operands, standard input, output and error, and
+   working directory,
+   and that forks again to search with them exactly as grep would, so
+   that the output goes straight to the client's standard output.  When
+   the search is over, the exit status is sent back to the client,
+   which exits with it.  The forked processes share the server's
+   compiled patterns and buffers, and start without running the
+   dynamic linker or parsing options.  */
+
+#include <config.h>
+
+#include "serve.h"
+
+#include <stdint.h>
+#if HAVE_SYS_UN_H
+# include <signal.h>
+# include <sys/socket.h>
+# include <sys/un.h>
+# include <sys/wait.h>
+#endif
+
+#include "system.h"
+#include "die.h"
+#include "safe-read.h"
+#include "xalloc.h"
+
+#if HAVE_SYS_UN_H
+
+/* A request is a struct serve_request, sent with the client's
+   standard input, output and error and its working directory as
+   SCM_RIGHTS ancillary data, and followed by SIZE bytes holding
+   NOPTIONS null-terminated options and then NOPERANDS null-terminated
+   operands.  The reply is the exit status, as an int32_t.  */
+struct serve_request
+{
+  uint32_t magic;
+  uint32_t noptions;
+  uint32_t noperands;
+  uint32_t reserved;
+  uint64_t size;
+};
+enum { SERVE_MAGIC = 0x67726571 };
+enum { SERVE_FDS = 4 };
+
+/* Limit on the size of the operands of a request, to reject bogus
+   requests before allocating memory for them.  */
+enum { SERVE_SIZE_MAX = 1 << 30 };
+
+/* Set *ADDR to the address of the socket named NAME.  */
+static void
+socket_address (struct sockaddr_un *addr, char const *name)
+{
+  memset (addr, 0, sizeof *addr);
+  addr->sun_family = AF_UNIX;
+  if (sizeof addr->sun_path <= strlen (name))
+    die (EXIT_TROUBLE, 0, _("%s: socket name too long"), name);
+  strcpy (addr->sun_path, name);
+}
+
+/* Read SIZE bytes from FD into BUF.  Return true if successful.  */
+static bool
+read_all (int fd, void *buf, idx_t size)
+{
+  for (char *p = buf; 0 < size; )
+    {
+      ptrdiff_t n = safe_read (fd, p, size);
+      if (n <= 0)
+        return false;
+      p += n;
+      size -= n;
+    }
+  return true;
+}
+
+/* Write SIZE bytes from BUF to FD.  Return true if successful.  */
+static bool
+write_all (int fd, void const *buf, idx_t size)
+{
+  for (char const *p = buf; 0 < size; )
+    {
+      ssize_t n = write (fd, p, size);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return false;
+        }
+      p += n;
+      size -= n;
+    }
+  return true;
+}
+
+/* Ancillary data holding the file descriptors of a request.  */
+union serve_control
+{
+  char buf[CMSG_SPACE (SERVE_FDS * sizeof (int))];
+  struct cmsghdr align;
+};
+
+/* Return true if the process at the other end of the connection CONN
+   runs as the same user as this one.  Searches run with this process's
+   permissions, so other users must not be answered even if the
+   socket's permissions let them connect.  Where the peer's user
+   cannot be found out, rely on those permissions alone.  */
+static bool
+same_user (int conn)
+{
+#if HAVE_GETPEEREID
+  uid_t uid;
+  gid_t gid;
+  return getpeereid (conn, &uid, &gid) == 0 && uid == geteuid ();
+#elif defined SO_PEERCRED
+  struct ucred cred;
+  socklen_t len = sizeof cred;
+  return (getsockopt (conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0
+          && cred.uid == geteuid ());
+#else
+  return true;
+#endif
+}
+
+/* Answer the request on the connection CONN, searching with SEARCH in
+   a child process.  Return the exit status of the process answering.  */
+static int
+answer (int conn, search_fp_t search)
+{
+  if (!same_user (conn))
+    return EXIT_TROUBLE;
+
+  struct serve_request req;
+  union serve_control control;
+  struct iovec iov = { .iov_base = &req, .iov_len = sizeof req };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                        .msg_control = control.buf,
+                        .msg_controllen = sizeof control.buf };
+  ssize_t n;
+  do
+    n = recvmsg (conn, &msg, 0);
+  while (n < 0 && errno == EINTR);
+
+  struct cmsghdr *cmsg = 0 < n ? CMSG_FIRSTHDR (&msg) : nullptr;
+  idx_t nargs = (idx_t) req.noptions + req.noperands;
+  if (! (n == sizeof req && req.magic == SERVE_MAGIC
+         && req.size <= SERVE_SIZE_MAX && nargs <= req.size
+         && cmsg && cmsg->cmsg_level == SOL_SOCKET
+         && cmsg->cmsg_type == SCM_RIGHTS
+         && cmsg->cmsg_len == CMSG_LEN (SERVE_FDS * sizeof (int))))
+    return EXIT_TROUBLE;
+  int fds[SERVE_FDS];
+  memcpy (fds, CMSG_DATA (cmsg), sizeof fds);
+
+  char *args = ximalloc (req.size + 1);
+  if (!read_all (conn, args, req.size))
+    return EXIT_TROUBLE;
+  args[req.size] = '\0';
+  char **argv = xinmalloc (nargs + 1, sizeof *argv);
+  char *p = args;
+  for (idx_t i = 0; i < nargs; i++)
+    {
+      argv[i] = p;
+      p = rawmemchr (p, '\0') + 1;
+      if (args + req.size < p)
+        return EXIT_TROUBLE;
+    }
+  argv[nargs] = nullptr;
+
+  pid_t pid = fork ();
+  if (pid == 0)
+    {
+      close (conn);
+      if (dup2 (fds[0], STDIN_FILENO) < 0
+          || dup2 (fds[1], STDOUT_FILENO) < 0
+          || dup2 (fds[2], STDERR_FILENO) < 0
+          || fchdir (fds[3]) != 0)
+        _exit (EXIT_TROUBLE);
+      for (int i = 0; i < SERVE_FDS; i++)
+        if (STDERR_FILENO < fds[i])
+          close (fds[i]);
+      exit (search (argv, req.noptions, argv + req.noptions,
+                    req.noperands));
+    }
+
+  int32_t status = EXIT_TROUBLE;
+  if (0 < pid)
+    {
+      int wstatus = 0;
+      pid_t w;
+      do
+        w = waitpid (pid, &wstatus, 0);
+      while (w < 0 && errno == EINTR);
+      if (w == pid && WIFEXITED (wstatus))
+        status = WEXITSTATUS (wstatus);
+    }
+  return write_all (conn, &status, sizeof status) ? EXIT_SUCCESS : EXIT_TROUBLE;
+}
+
+/* Return true if the socket at ADDR refuses connections, as one left
+   by a server that has exited does.  */
+static bool
+stale_socket (struct sockaddr_un const *addr)
+{
+  int sock = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0)
+    return false;
+  bool refused = (connect (sock, (struct sockaddr const *) addr,
+                           sizeof *addr) != 0
+                  && errno == ECONNREFUSED);
+  close (sock);
+  return refused;
+}
+
+/* Listen on the socket named NAME, and answer each request by
+   searching with SEARCH.  Replace any socket already named NAME that
+   was left by an earlier server, but not one that a server is still
+   listening on, nor any other kind of file.  */
+void
+serve (char const *name, search_fp_t search)
+{
+  struct sockaddr_un addr;
+  socket_address (&addr, name);
+  int sock = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0)
+    die (EXIT_TROUBLE, errno, "%s", name);
+  struct stat st;
+  if (lstat (name, &st) == 0 && S_ISSOCK (st.st_mode) && stale_socket (&addr))
+    unlink (name);
+  if (bind (sock, (struct sockaddr *) &addr, sizeof addr) != 0
+      || listen (sock, SOMAXCONN) != 0)
+    die (EXIT_TROUBLE, errno, "%s", name);
+
+  /* Let the system reap the processes that answer requests.  */
+  signal (SIGCHLD, SIG_IGN);
+
+  while (true)
+    {
+      int conn = accept (sock, nullptr, nullptr);
+      if (conn < 0)
+        {
+          if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+          die (EXIT_TROUBLE, errno, "%s", name);
+        }
+
+      pid_t pid = fork ();
+      if (pid == 0)
+        {
+          close (sock);
+          signal (SIGCHLD, SIG_DFL);
+          _exit (answer (conn, search));
+        }
+      if (pid < 0)
+        error (0, errno, "%s", name);
+      close (conn);
+    }
+}
+
+/* Ask the server listening on the socket named NAME to search the
+   files named by the NOPERANDS OPERANDS, or standard input or the
+   working directory as the server's options say if there are none,
+   with the NOPTIONS output options OPTIONS as well as its own.
+   Return the exit status of the search.  */
+int
+serve_client (char const *name, char *const *options, idx_t noptions,
+              char *const *operands, idx_t noperands)
+{
+  struct sockaddr_un addr;
+  socket_address (&addr, name);
+  int sock = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0
+      || connect (sock, (struct sockaddr *) &addr, sizeof addr) != 0)
+    die (EXIT_TROUBLE, errno, "%s", name);
+  int cwd = open (".", O_RDONLY | O_DIRECTORY | O_NOCTTY);
+  if (cwd < 0)
+    die (EXIT_TROUBLE, errno, ".");
+
+  idx_t size = 0;
+  for (idx_t i = 0; i < noptions; i++)
+    size += strlen (options[i]) + 1;
+  for (idx_t i = 0; i < noperands; i++)
+    size += strlen (operands[i]) + 1;
+  if (SERVE_SIZE_MAX < size)
+    die (EXIT_TROUBLE, 0, _("%s: argument list too long"), name);
+  char *args = ximalloc (size);
+  char *p = args;
+  for (idx_t i = 0; i < noptions; i++)
+    p = stpcpy (p, options[i]) + 1;
+  for (idx_t i = 0; i < noperands; i++)
+    p = stpcpy (p, operands[i]) + 1;
+
+  struct serve_request req = { .magic = SERVE_MAGIC, .noptions = noptions,
+                               .noperands = noperands, .size = size };
+  int fds[SERVE_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, cwd };
+  union serve_control control;
+  memset (&control, 0, sizeof control);
+  struct iovec iov = { .iov_base = &req, .iov_len = sizeof req };
+  struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                        .msg_control = control.buf,
+                        .msg_controllen = sizeof control.buf };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof fds);
+  memcpy (CMSG_DATA (cmsg), fds, sizeof fds);
+
+  ssize_t n;
+  do
+    n = sendmsg (sock, &msg, 0);
+  while (n < 0 && errno == EINTR);
+  if (n != sizeof req || !write_all (sock, args, size))
+    die (EXIT_TROUBLE, n < 0 ? errno : 0, "%s", name);
+
+  int32_t status;
+  if (!read_all (sock, &status, sizeof status))
+    die (EXIT_TROUBLE, 0, _("%s: no reply from server"), name);
+  free (args);
+  close (cwd);
+  close (sock);
+  return status;
+}
+
+#else
+
+void
+serve (char const *name, search_fp_t search)
+{
+  die (EXIT_TROUBLE, 0, _("--serve is not supported on this system"));
+}
+
+int
+serve_client (char const *name, char *const *options, idx_t noptions,
+              char *const *operands, idx_t noperands)
+{
+  die (EXIT_TROUBLE, 0, _("--client is not supported on this system"));
+}
+
+#endif
@@ -0,0 +1,30 @@
+/* serve.h - answer searches over a socket, for grep --serve.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef GREP_SERVE_H
+#define GREP_SERVE_H 1
+
+#include <idx.h>
+
+/* A function that searches the files named by its operands, with the
+   output options given before them, and returns grep's exit status.  */
+typedef int (*search_fp_t) (char *const *, idx_t, char *const *, idx_t);
+
+extern _Noreturn void serve (char const *, search_fp_t);
+extern int serve_client (char const *, char *const *, idx_t,
+                         char *const *, idx_t);
+
+#endif
@@ -42,6 +42,10 @@ enum { NCHAR = UCHAR_MAX + 1 };
 
 #include <locale.h>
 
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
 #ifndef initialize_main
 # define initialize_main(argcp, argvp)
 #endif
@@ -64,6 +68,24 @@ to_uchar (char ch)
   return ch;
 }
 
+/* The size of a transparent huge page on typical platforms.  Buffers
+   at least this large are aligned to it, so that the kernel can back
+   them with huge pages and cut TLB misses.  */
+enum { HUGE_PAGE_SIZE = 2 * 1024 * 1024 };
+
+/* Advise the kernel to back the SIZE bytes at P, which must be aligned
+   to HUGE_PAGE_SIZE, with huge pages.  Return true if it accepted the
+   advice; the kernel can still fall back on ordinary pages.  */
+SYSTEM_INLINE bool
+advise_huge_pages (void *p, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+  return madvise (p, size, MADV_HUGEPAGE) == 0;
+#else
+  return false;
+#endif
+}
+
 _GL_INLINE_HEADER_END
 
 #ifndef __has_feature
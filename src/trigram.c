@@ -0,0 +1,578 @@
+/* trigram.c - trigram index of files, for grep --build-index.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* An index records, for each regular file searched when it was built,
+   the file's name, size and modification time, and for each sequence
+   of three bytes (a trigram) the sorted list of files containing it.
+   A file that lacks any trigram of a string cannot contain the string,
+   so a search for a pattern that requires one of several strings need
+   only read the files that contain every trigram of some string, and
+   the files that are not in the index or have changed since.
+
+   Letters are indexed as if they were ASCII lowercase, so that the
+   same index serves searches with and without -i.  */
+
+#include <config.h>
+
+#include "trigram.h"
+
+#include <stdckdint.h>
+#include <stdint.h>
+
+#include "system.h"
+#include "die.h"
+#include "safe-read.h"
+#include "stat-time.h"
+#include "xalloc.h"
+
+/* Name of the index file within the index directory.  */
+static char const index_base[] = "trigrams";
+
+/* The layout of an index file is a header, then NFILES struct
+   index_file, then NGRAMS struct index_gram sorted by trigram, then
+   NFILES uint32_t file numbers sorted by file name, then NPOSTINGS
+   uint32_t file numbers, then NAMES_SIZE bytes of null-terminated
+   file names.  Numbers are in host byte order; an index written on
+   a host with a different byte order is rejected.  */
+
+static char const index_magic[] = "GREPTRI1";
+enum { INDEX_BYTE_ORDER = 0x01020304 };
+
+struct index_header
+{
+  char magic[8];
+  uint32_t byte_order;
+  uint32_t unused;
+  uint64_t nfiles;
+  uint64_t ngrams;
+  uint64_t npostings;
+  uint64_t names_size;
+};
+
+struct index_file
+{
+  uint64_t name;		/* Offset of the file's name.  */
+  int64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+};
+
+struct index_gram
+{
+  uint32_t gram;
+  uint32_t count;		/* Number of files containing GRAM.  */
+  uint64_t start;		/* Index of the first of their postings.  */
+};
+
+/* Number of possible trigrams.  */
+enum { NGRAMS = 1 << 24 };
+
+/* Size of the buffer for reading files to be indexed.  */
+enum { INDEX_BUFSIZE = 96 * 1024 };
+
+/* Return the byte C as it is indexed.  */
+static unsigned char
+index_byte (unsigned char c)
+{
+  return 'A' <= c && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+/* Return true if the byte C, as indexed, might not match itself when
+   ignoring case in some locale.  Besides non-ASCII bytes, these are
+   the letters that are case variants of non-ASCII characters, e.g.,
+   U+212A KELVIN SIGN, U+017F LATIN SMALL LETTER LONG S, and the
+   Turkish dotted and dotless I.  */
+static bool
+index_byte_folds (unsigned char c)
+{
+  return 0x80 <= c || c == 'i' || c == 'k' || c == 's';
+}
+
+/* The index being built: the files added so far, their names, and
+   the distinct trigrams of each file in turn, those of file number F
+   being GRAMS[FILE_GRAMS[F]] through GRAMS[FILE_GRAMS[F + 1] - 1].  */
+static struct index_file *files;
+static idx_t nfiles, files_alloc;
+static idx_t *file_grams;
+static char *names;
+static idx_t names_size, names_alloc;
+static uint32_t *grams;
+static idx_t ngrams, grams_alloc;
+
+/* Bit G of SEEN is set if trigram G has been seen in the current file.  */
+static uint64_t *seen;
+
+/* Add to the index being built the file NAME, open for reading on FD
+   and with status ST.  Return true if successful, false (setting
+   errno) if the file could not be read.  */
+bool
+trigram_index_add (char const *name, int fd, struct stat const *st)
+{
+  static char *buf;
+  if (!buf)
+    {
+      buf = ximalloc (INDEX_BUFSIZE);
+      seen = xicalloc (NGRAMS / 64, sizeof *seen);
+      file_grams = xinmalloc (1, sizeof *file_grams);
+      file_grams[0] = 0;
+    }
+
+  if (nfiles == UINT32_MAX)
+    {
+      errno = EOVERFLOW;
+      return false;
+    }
+
+  idx_t first = ngrams;
+  uint32_t gram = 0;
+  int len = 0;
+  bool ok = true;
+
+  for (ptrdiff_t nread; (nread = safe_read (fd, buf, INDEX_BUFSIZE)) != 0; )
+    {
+      if (nread < 0)
+        {
+          ok = false;
+          break;
+        }
+      for (ptrdiff_t i = 0; i < nread; i++)
+        {
+          gram = ((gram << 8) | index_byte (buf[i])) & (NGRAMS - 1);
+          if (len < 2)
+            len++;
+          else if (! (seen[gram / 64] & ((uint64_t) 1 << gram % 64)))
+            {
+              seen[gram / 64] |= (uint64_t) 1 << gram % 64;
+              if (ngrams == grams_alloc)
+                grams = xpalloc (grams, &grams_alloc, 1, -1, sizeof *grams);
+              grams[ngrams++] = gram;
+            }
+        }
+    }
+
+  for (idx_t i = first; i < ngrams; i++)
+    seen[grams[i] / 64] = 0;
+  if (!ok)
+    {
+      ngrams = first;
+      return false;
+    }
+
+  idx_t namelen = strlen (name) + 1;
+  if (names_alloc - names_size < namelen)
+    names = xpalloc (names, &names_alloc, namelen - (names_alloc - names_size),
+                     -1, 1);
+  if (nfiles == files_alloc)
+    {
+      files = xpalloc (files, &files_alloc, 1, -1, sizeof *files);
+      file_grams = xireallocarray (file_grams, files_alloc + 1,
+                                   sizeof *file_grams);
+    }
+
+  struct timespec mtime = get_stat_mtime (st);
+  files[nfiles] = (struct index_file) { .name = names_size,
+                                        .size = st->st_size,
+                                        .mtime_sec = mtime.tv_sec,
+                                        .mtime_nsec = mtime.tv_nsec };
+  memcpy (names + names_size, name, namelen);
+  names_size += namelen;
+  file_grams[++nfiles] = ngrams;
+  return true;
+}
+
+static int
+compare_file_names (void const *a, void const *b)
+{
+  uint32_t const *fa = a, *fb = b;
+  return strcmp (names + files[*fa].name, names + files[*fb].name);
+}
+
+/* Write to FP the SIZE bytes at P, returning true if successful.  */
+static bool
+write_part (FILE *fp, void const *p, idx_t size)
+{
+  return size == 0 || fwrite (p, size, 1, fp) == 1;
+}
+
+/* Write the index built so far into the directory DIR, creating DIR
+   if need be.  Return true if successful, false (setting errno)
+   otherwise.  */
+bool
+trigram_index_write (char const *dir)
+{
+  /* Count the files containing each trigram, then distribute each
+     file's trigrams in file order, so that every posting list is
+     sorted.  Afterwards COUNT[G] is G's index in TABLE.  */
+  uint32_t *count = xicalloc (NGRAMS, sizeof *count);
+  for (idx_t i = 0; i < ngrams; i++)
+    count[grams[i]]++;
+  idx_t ntable = 0;
+  for (idx_t g = 0; g < NGRAMS; g++)
+    ntable += !!count[g];
+  struct index_gram *table = xinmalloc (ntable, sizeof *table);
+  uint64_t start = 0;
+  for (idx_t g = 0, t = 0; g < NGRAMS; g++)
+    if (count[g])
+      {
+        table[t] = (struct index_gram) { .gram = g, .start = start };
+        start += count[g];
+        count[g] = t++;
+      }
+  uint32_t *postings = xinmalloc (ngrams, sizeof *postings);
+  for (idx_t f = 0; f < nfiles; f++)
+    for (idx_t i = file_grams[f]; i < file_grams[f + 1]; i++)
+      {
+        struct index_gram *e = &table[count[grams[i]]];
+        postings[e->start + e->count++] = f;
+      }
+  free (count);
+
+  uint32_t *by_name = xinmalloc (nfiles, sizeof *by_name);
+  for (idx_t f = 0; f < nfiles; f++)
+    by_name[f] = f;
+  qsort (by_name, nfiles, sizeof *by_name, compare_file_names);
+
+  struct index_header header = { .byte_order = INDEX_BYTE_ORDER,
+                                 .nfiles = nfiles, .ngrams = ntable,
+                                 .npostings = ngrams,
+                                 .names_size = names_size };
+  memcpy (header.magic, index_magic, sizeof header.magic);
+
+  idx_t dirlen = strlen (dir);
+  char *file = ximalloc (dirlen + sizeof "/" + sizeof index_base
+                         + sizeof ".tmp");
+  char *tmp = stpcpy (stpcpy (stpcpy (file, dir), "/"), index_base);
+  strcpy (tmp, ".tmp");
+
+  bool ok = false;
+  int err = 0;
+  if (mkdir (dir, S_IRWXU | S_IRWXG | S_IRWXO) != 0 && errno != EEXIST)
+    err = errno;
+  else
+    {
+      FILE *fp = fopen (file, "wb");
+      if (!fp)
+        err = errno;
+      else
+        {
+          ok = (write_part (fp, &header, sizeof header)
+                && write_part (fp, files, nfiles * sizeof *files)
+                && write_part (fp, table, ntable * sizeof *table)
+                && write_part (fp, by_name, nfiles * sizeof *by_name)
+                && write_part (fp, postings, ngrams * sizeof *postings)
+                && write_part (fp, names, names_size));
+          err = errno;
+          if (fclose (fp) != 0 && ok)
+            {
+              ok = false;
+              err = errno;
+            }
+          if (ok)
+            {
+              char *dest = ximemdup0 (file, tmp - file);
+              ok = rename (file, dest) == 0;
+              err = errno;
+              free (dest);
+            }
+          if (!ok)
+            unlink (file);
+        }
+    }
+
+  free (file);
+  free (by_name);
+  free (postings);
+  free (table);
+  errno = err;
+  return ok;
+}
+
+struct trigram_index
+{
+  /* The contents of the index file, and whether they are mapped.  */
+  char *base;
+  idx_t size;
+  bool mapped;
+
+  struct index_file const *files;
+  struct index_gram const *grams;
+  uint32_t const *by_name;
+  uint32_t const *postings;
+  char const *names;
+  idx_t nfiles, ngrams, npostings, names_size;
+
+  /* For each file, nonzero if it might match; null if any file might.  */
+  unsigned char *candidates;
+};
+
+/* Open the index in the directory DIR, reporting an error and exiting
+   if this fails.  */
+struct trigram_index *
+trigram_index_open (char const *dir)
+{
+  char *file = ximalloc (strlen (dir) + sizeof "/" + sizeof index_base);
+  stpcpy (stpcpy (stpcpy (file, dir), "/"), index_base);
+
+  int fd = open (file, O_RDONLY | O_NOCTTY);
+  struct stat st;
+  if (fd < 0 || fstat (fd, &st) != 0)
+    die (EXIT_TROUBLE, errno, "%s", file);
+
+  struct trigram_index *ti = xzalloc (sizeof *ti);
+  if (! (0 <= st.st_size && st.st_size <= IDX_MAX))
+    die (EXIT_TROUBLE, 0, _("%s: not a valid grep index"), file);
+  ti->size = st.st_size;
+
+#if HAVE_SYS_MMAN_H
+  if (ti->size)
+    {
+      void *p = mmap (nullptr, ti->size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED)
+        {
+          ti->base = p;
+          ti->mapped = true;
+        }
+    }
+#endif
+  if (!ti->mapped)
+    {
+      ti->base = ximalloc (ti->size + 1);
+      for (idx_t got = 0; got < ti->size; )
+        {
+          ptrdiff_t nread = safe_read (fd, ti->base + got, ti->size - got);
+          if (nread <= 0)
+            die (EXIT_TROUBLE, nread < 0 ? errno : 0,
+                 _("%s: not a valid grep index"), file);
+          got += nread;
+        }
+    }
+  if (close (fd) != 0)
+    die (EXIT_TROUBLE, errno, "%s", file);
+
+  /* Check the header and sizes, so that later lookups need not.  */
+  struct index_header h;
+  idx_t size = sizeof h, part;
+  bool ok = sizeof h <= ti->size;
+  if (ok)
+    {
+      memcpy (&h, ti->base, sizeof h);
+      ok = (memcmp (h.magic, index_magic, sizeof h.magic) == 0
+            && h.byte_order == INDEX_BYTE_ORDER
+            && h.nfiles <= UINT32_MAX && h.ngrams <= NGRAMS
+            && h.npostings <= IDX_MAX && h.names_size <= IDX_MAX);
+    }
+  if (ok)
+    {
+      ti->nfiles = h.nfiles;
+      ti->ngrams = h.ngrams;
+      ti->npostings = h.npostings;
+      ti->names_size = h.names_size;
+      ti->files = (struct index_file const *) (ti->base + size);
+      ok = (!ckd_mul (&part, ti->nfiles, sizeof *ti->files)
+            && !ckd_add (&size, size, part));
+      ti->grams = (struct index_gram const *) (ti->base + size);
+      ok &= (!ckd_mul (&part, ti->ngrams, sizeof *ti->grams)
+             && !ckd_add (&size, size, part));
+      ti->by_name = (uint32_t const *) (ti->base + size);
+      ok &= (!ckd_mul (&part, ti->nfiles, sizeof *ti->by_name)
+             && !ckd_add (&size, size, part));
+      ti->postings = (uint32_t const *) (ti->base + size);
+      ok &= (!ckd_mul (&part, ti->npostings, sizeof *ti->postings)
+             && !ckd_add (&size, size, part));
+      ti->names = ti->base + size;
+      ok &= (!ckd_add (&size, size, ti->names_size)
+             && size == ti->size
+             && (ti->names_size == 0
+                 ? ti->nfiles == 0
+                 : ti->names[ti->names_size - 1] == '\0'));
+    }
+  for (idx_t f = 0; ok && f < ti->nfiles; f++)
+    ok = ti->files[f].name < ti->names_size && ti->by_name[f] < ti->nfiles;
+  for (idx_t t = 0; ok && t < ti->ngrams; t++)
+    ok = (ti->grams[t].count <= ti->npostings
+          && ti->grams[t].start <= ti->npostings - ti->grams[t].count
+          && (t == 0 || ti->grams[t - 1].gram < ti->grams[t].gram));
+  if (!ok)
+    die (EXIT_TROUBLE, 0, _("%s: not a valid grep index"), file);
+
+  free (file);
+  return ti;
+}
+
+/* Return the entry for trigram G in TI, or null if no file has G.  */
+static struct index_gram const *
+find_gram (struct trigram_index const *ti, uint32_t g)
+{
+  idx_t lo = 0, hi = ti->ngrams;
+  while (lo < hi)
+    {
+      idx_t mid = lo + (hi - lo) / 2;
+      if (ti->grams[mid].gram < g)
+        lo = mid + 1;
+      else if (g < ti->grams[mid].gram)
+        hi = mid;
+      else
+        return &ti->grams[mid];
+    }
+  return nullptr;
+}
+
+static int
+compare_uint32 (void const *a, void const *b)
+{
+  uint32_t const *ua = a, *ub = b;
+  return (*ub < *ua) - (*ua < *ub);
+}
+
+static int
+compare_gram_counts (void const *a, void const *b)
+{
+  struct index_gram const *const *ga = a, *const *gb = b;
+  return ((*gb)->count < (*ga)->count) - ((*ga)->count < (*gb)->count);
+}
+
+/* Restrict the candidates of TI to the files that might contain one
+   of the newline-separated strings LITS, of total size SIZE.  IGNORE_CASE
+   says whether the strings match without regard to case.  A string
+   with no usable trigram might be anywhere, so then every file
+   remains a candidate.  */
+void
+trigram_index_require (struct trigram_index *ti, char const *lits,
+                       idx_t size, bool ignore_case)
+{
+  unsigned char *candidates = xicalloc (ti->nfiles + 1, 1);
+  uint32_t *lit_grams = nullptr;
+  struct index_gram const **entries = nullptr;
+  uint32_t *hits = nullptr;
+  idx_t lit_grams_alloc = 0;
+
+  for (char const *lit = lits, *lim = lits + size; lit <= lim; )
+    {
+      char const *end = memchr (lit, '\n', lim - lit);
+      if (!end)
+        end = lim;
+
+      /* Collect the distinct usable trigrams of the string.  */
+      idx_t n = 0;
+      if (lit_grams_alloc < end - lit)
+        {
+          lit_grams_alloc = end - lit;
+          lit_grams = xireallocarray (lit_grams, lit_grams_alloc,
+                                      sizeof *lit_grams);
+          entries = xireallocarray (entries, lit_grams_alloc,
+                                    sizeof *entries);
+        }
+      for (char const *p = lit; p + 2 < end; p++)
+        {
+          unsigned char b0 = index_byte (p[0]), b1 = index_byte (p[1]),
+            b2 = index_byte (p[2]);
+          if (! (ignore_case && (index_byte_folds (b0) || index_byte_folds (b1)
+                                 || index_byte_folds (b2))))
+            lit_grams[n++] = (b0 << 16) | (b1 << 8) | b2;
+        }
+      if (n == 0)
+        {
+          free (candidates);
+          candidates = nullptr;
+          break;
+        }
+      qsort (lit_grams, n, sizeof *lit_grams, compare_uint32);
+
+      /* Intersect the posting lists, starting with the shortest.  */
+      idx_t nentries = 0;
+      bool missing = false;
+      for (idx_t i = 0; i < n && !missing; i++)
+        if (i == 0 || lit_grams[i - 1] != lit_grams[i])
+          {
+            entries[nentries] = find_gram (ti, lit_grams[i]);
+            missing = !entries[nentries++];
+          }
+      if (!missing)
+        {
+          qsort (entries, nentries, sizeof *entries, compare_gram_counts);
+          idx_t nhits = entries[0]->count;
+          hits = xireallocarray (hits, nhits + 1, sizeof *hits);
+          memcpy (hits, ti->postings + entries[0]->start,
+                  nhits * sizeof *hits);
+          for (idx_t e = 1; e < nentries && nhits; e++)
+            {
+              uint32_t const *p = ti->postings + entries[e]->start;
+              uint32_t const *plim = p + entries[e]->count;
+              idx_t kept = 0;
+              for (idx_t i = 0; i < nhits; i++)
+                {
+                  while (p < plim && *p < hits[i])
+                    p++;
+                  if (p == plim)
+                    break;
+                  if (*p == hits[i])
+                    hits[kept++] = hits[i];
+                }
+              nhits = kept;
+            }
+          for (idx_t i = 0; i < nhits; i++)
+            if (hits[i] < ti->nfiles)
+              candidates[hits[i]] = 1;
+        }
+
+      lit = end + 1;
+    }
+
+  free (hits);
+  free (entries);
+  free (lit_grams);
+  free (ti->candidates);
+  ti->candidates = candidates;
+}
+
+/* Return the number of the file named NAME in TI, or -1 if none.  */
+idx_t
+trigram_index_find (struct trigram_index const *ti, char const *name)
+{
+  idx_t lo = 0, hi = ti->nfiles;
+  while (lo < hi)
+    {
+      idx_t mid = lo + (hi - lo) / 2;
+      uint32_t f = ti->by_name[mid];
+      int cmp = strcmp (ti->names + ti->files[f].name, name);
+      if (cmp < 0)
+        lo = mid + 1;
+      else if (0 < cmp)
+        hi = mid;
+      else
+        return f;
+    }
+  return -1;
+}
+
+/* Return true if the file numbered F in TI might match.  */
+bool
+trigram_index_candidate (struct trigram_index const *ti, idx_t f)
+{
+  return !ti->candidates || ti->candidates[f];
+}
+
+/* Return true if the file numbered F in TI has the status ST that it
+   had when indexed.  */
+bool
+trigram_index_unchanged (struct trigram_index const *ti, idx_t f,
+                         struct stat const *st)
+{
+  struct timespec mtime = get_stat_mtime (st);
+  return (ti->files[f].size == st->st_size
+          && ti->files[f].mtime_sec == mtime.tv_sec
+          && ti->files[f].mtime_nsec == mtime.tv_nsec);
+}
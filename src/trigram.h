@@ -0,0 +1,40 @@
+/* trigram.h - trigram index of files, for grep --build-index.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+#ifndef GREP_TRIGRAM_H
+#define GREP_TRIGRAM_H 1
+
+#include <sys/stat.h>
+#include <idx.h>
+
+/* Building an index.  */
+extern bool trigram_index_add (char const *, int, struct stat const *);
+extern bool trigram_index_write (char const *);
+
+/* Using an index.  */
+struct trigram_index;
+extern struct trigram_index *trigram_index_open (char const *);
+extern void trigram_index_require (struct trigram_index *,
+                                   char const *, idx_t, bool);
+extern idx_t trigram_index_find (struct trigram_index const *, char const *)
+  _GL_ATTRIBUTE_PURE;
+extern bool trigram_index_candidate (struct trigram_index const *, idx_t)
+  _GL_ATTRIBUTE_PURE;
+extern bool trigram_index_unchanged (struct trigram_index const *, idx_t,
+                                     struct stat const *)
+  _GL_ATTRIBUTE_PURE;
+
+#endif
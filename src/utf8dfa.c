@@ -0,0 +1,682 @@
+/* utf8dfa.c - translate patterns to match the bytes of UTF-8 text.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* In a UTF-8 locale the DFA matches a bracket expression that can
+   match a non-ASCII character with its slow multibyte code, and leaves
+   character classes like [[:alpha:]] to regex.  A pattern can instead
+   be rewritten so that each such set of characters is an alternation
+   of the byte sequences that encode them, split into ranges of bytes
+   as in "\xC3[\x80-\xBF]", and then be compiled by a DFA that treats
+   each byte as a character.  Since UTF-8 is self-synchronizing, and
+   these sequences match only valid characters, the byte DFA selects
+   the same lines as the multibyte one.  This is not so for the -w
+   motif, whose non-word set must match encoding errors too, so the
+   caller does not translate it.  */
+
+#include <config.h>
+
+#include <search.h>
+
+#include <uchar.h>
+
+#include "c-ctype.h"
+
+/* A set of characters, as ranges of code points.  Once normalized,
+   the ranges are sorted, and neither overlap nor touch.  */
+struct charset
+{
+  char32_t (*r)[2];
+  idx_t n;
+  idx_t alloc;
+};
+
+static void
+charset_add (struct charset *s, char32_t lo, char32_t hi)
+{
+  if (s->n == s->alloc)
+    s->r = xpalloc (s->r, &s->alloc, 1, -1, sizeof *s->r);
+  s->r[s->n][0] = lo;
+  s->r[s->n][1] = hi;
+  s->n++;
+}
+
+static void
+charset_add_all (struct charset *s, struct charset const *t)
+{
+  for (idx_t i = 0; i < t->n; i++)
+    charset_add (s, t->r[i][0], t->r[i][1]);
+}
+
+static int
+range_cmp (void const *a, void const *b)
+{
+  char32_t const *ra = a, *rb = b;
+  return (ra[0] > rb[0]) - (ra[0] < rb[0]);
+}
+
+static void
+charset_normalize (struct charset *s)
+{
+  if (s->n == 0)
+    return;
+  qsort (s->r, s->n, sizeof *s->r, range_cmp);
+  idx_t n = 0;
+  for (idx_t i = 1; i < s->n; i++)
+    if (s->r[n][1] + 1 < s->r[i][0])
+      {
+        n++;
+        s->r[n][0] = s->r[i][0];
+        s->r[n][1] = s->r[i][1];
+      }
+    else if (s->r[n][1] < s->r[i][1])
+      s->r[n][1] = s->r[i][1];
+  s->n = n + 1;
+}
+
+/* Replace the normalized set S by the characters not in it.
+   Surrogates are not characters.  */
+static void
+charset_invert (struct charset *s)
+{
+  struct charset t = { nullptr, 0, 0 };
+  char32_t next = 0;
+  for (idx_t i = 0; i < s->n; i++)
+    {
+      if (next < s->r[i][0])
+        charset_add (&t, next, s->r[i][0] - 1);
+      next = s->r[i][1] + 1;
+    }
+  if (next <= 0xD7FF)
+    charset_add (&t, next, 0xD7FF);
+  charset_add (&t, MAX (next, 0xE000), 0x10FFFF);
+  free (s->r);
+  *s = t;
+}
+
+/* Add to S the characters that -i treats as the same as C, and C.  */
+static void
+charset_add_folded (struct charset *s, char32_t c, bool icase)
+{
+  charset_add (s, c, c);
+  if (icase)
+    {
+      char32_t folded[CASE_FOLDED_BUFSIZE];
+      int n = case_folded_counterparts (c, folded);
+      for (int i = 0; i < n; i++)
+        charset_add (s, folded[i], folded[i]);
+    }
+}
+
+/* The character classes looked up so far, as normalized sets.  */
+static struct class_cache
+{
+  char const *name;
+  struct charset set;
+} class_cache[16];
+static int class_cache_used;
+
+/* Planes 4 through 13 have no characters assigned, and planes 15 and
+   16 only private-use ones.  Return the last code point of the run
+   starting at WC that class_set takes to be alike: the rest of such a
+   plane but its last two code points, which are noncharacters, if WC
+   starts it, and WC itself otherwise.  */
+static char32_t
+class_run_end (char32_t wc)
+{
+  int plane = wc >> 16;
+  return ((4 <= plane && plane <= 13) || 15 <= plane) && !(wc & 0xFFFF)
+         ? wc + 0xFFFD : wc;
+}
+
+/* Return the normalized set of characters in the class NAME, or null
+   if there is no such class.  */
+static struct charset const *
+class_set (char const *name)
+{
+  for (int i = 0; i < class_cache_used; i++)
+    if (strcmp (class_cache[i].name, name) == 0)
+      return &class_cache[i].set;
+
+  c32_type_test_t test = c32_get_type_test (name);
+  if (!test || class_cache_used == sizeof class_cache / sizeof *class_cache)
+    return nullptr;
+
+  struct class_cache *c = &class_cache[class_cache_used++];
+  c->name = xstrdup (name);
+  c->set = (struct charset) { nullptr, 0, 0 };
+  bool in = false;
+  for (char32_t wc = 0; wc <= 0x10FFFF; wc++)
+    {
+      /* Surrogates are not characters, and must not join the runs
+         on either side of them.  */
+      if (wc == 0xD800)
+        {
+          wc = 0xE000;
+          in = false;
+        }
+      char32_t end = class_run_end (wc);
+      bool member = !!c32_apply_type_test (wc, test);
+      if (member && !in)
+        charset_add (&c->set, wc, end);
+      else if (member)
+        c->set.r[c->set.n - 1][1] = end;
+      in = member;
+      wc = end;
+    }
+  return &c->set;
+}
+
+/* The translated pattern, as it grows.  */
+struct out
+{
+  char *buf;
+  idx_t len;
+  idx_t alloc;
+
+  /* How the pattern syntax writes a group and an alternation.  */
+  char const *open;
+  char const *close;
+  char const *alt;
+};
+
+static void
+out_mem (struct out *o, char const *p, idx_t n)
+{
+  ptrdiff_t shortage = o->len + n - o->alloc;
+  if (0 < shortage)
+    o->buf = xpalloc (o->buf, &o->alloc, shortage, -1, 1);
+  memcpy (o->buf + o->len, p, n);
+  o->len += n;
+}
+
+static void
+out_byte (struct out *o, unsigned char b)
+{
+  char c = b;
+  out_mem (o, &c, 1);
+}
+
+static void
+out_str (struct out *o, char const *s)
+{
+  out_mem (o, s, strlen (s));
+}
+
+/* Output the bytes from LO through HI, which are not ASCII.  */
+static void
+out_byte_range (struct out *o, unsigned char lo, unsigned char hi)
+{
+  if (lo == hi)
+    out_byte (o, lo);
+  else
+    {
+      out_byte (o, '[');
+      out_byte (o, lo);
+      out_byte (o, '-');
+      out_byte (o, hi);
+      out_byte (o, ']');
+    }
+}
+
+/* A sequence of N ranges of bytes, LO[I] through HI[I] for each I,
+   that matches the UTF-8 encodings of a range of characters.  */
+struct utf8_seq
+{
+  unsigned char lo[4];
+  unsigned char hi[4];
+  int n;
+};
+
+struct utf8_seqs
+{
+  struct utf8_seq *seq;
+  idx_t n;
+  idx_t alloc;
+};
+
+static int
+utf8_encode (char32_t c, unsigned char *b)
+{
+  if (c < 0x800)
+    {
+      b[0] = 0xC0 | c >> 6;
+      b[1] = 0x80 | (c & 0x3F);
+      return 2;
+    }
+  if (c < 0x10000)
+    {
+      b[0] = 0xE0 | c >> 12;
+      b[1] = 0x80 | (c >> 6 & 0x3F);
+      b[2] = 0x80 | (c & 0x3F);
+      return 3;
+    }
+  b[0] = 0xF0 | c >> 18;
+  b[1] = 0x80 | (c >> 12 & 0x3F);
+  b[2] = 0x80 | (c >> 6 & 0x3F);
+  b[3] = 0x80 | (c & 0x3F);
+  return 4;
+}
+
+/* Append to SEQS the sequences for the non-ASCII characters LO
+   through HI, splitting the range where the encodings change length
+   and wherever a trailing byte would not span all its values.  */
+static void
+utf8_split (struct utf8_seqs *seqs, char32_t lo, char32_t hi)
+{
+  static char32_t const lens[] = { 0x7FF, 0xFFFF };
+  for (int i = 0; i < sizeof lens / sizeof *lens; i++)
+    if (lo <= lens[i] && lens[i] < hi)
+      {
+        utf8_split (seqs, lo, lens[i]);
+        utf8_split (seqs, lens[i] + 1, hi);
+        return;
+      }
+
+  for (int i = 1; i < 4; i++)
+    {
+      char32_t m = ((char32_t) 1 << 6 * i) - 1;
+      if ((lo & ~m) != (hi & ~m))
+        {
+          if ((lo & m) != 0)
+            {
+              utf8_split (seqs, lo, lo | m);
+              utf8_split (seqs, (lo | m) + 1, hi);
+              return;
+            }
+          if ((hi & m) != m)
+            {
+              utf8_split (seqs, lo, (hi & ~m) - 1);
+              utf8_split (seqs, hi & ~m, hi);
+              return;
+            }
+        }
+    }
+
+  if (seqs->n == seqs->alloc)
+    seqs->seq = xpalloc (seqs->seq, &seqs->alloc, 1, -1, sizeof *seqs->seq);
+  struct utf8_seq *s = &seqs->seq[seqs->n++];
+  s->n = utf8_encode (lo, s->lo);
+  utf8_encode (hi, s->hi);
+}
+
+/* Output as an alternation the N sequences SEQ, all of which have
+   the same first D byte ranges, factoring out any further ranges
+   that adjacent sequences share.  */
+static void
+out_seqs (struct out *o, struct utf8_seq const *seq, idx_t n, int d)
+{
+  for (idx_t i = 0; i < n; )
+    {
+      idx_t j = i + 1;
+      if (d + 1 < seq[i].n)
+        while (j < n && seq[j].n == seq[i].n
+               && seq[j].lo[d] == seq[i].lo[d]
+               && seq[j].hi[d] == seq[i].hi[d])
+          j++;
+      if (0 < i)
+        out_str (o, o->alt);
+      out_byte_range (o, seq[i].lo[d], seq[i].hi[d]);
+      if (d + 1 < seq[i].n)
+        {
+          if (j - i == 1)
+            for (int k = d + 1; k < seq[i].n; k++)
+              out_byte_range (o, seq[i].lo[k], seq[i].hi[k]);
+          else
+            {
+              out_str (o, o->open);
+              out_seqs (o, seq + i, j - i, d + 1);
+              out_str (o, o->close);
+            }
+        }
+      i = j;
+    }
+}
+
+/* Output the members of the ASCII set IN as the contents of a
+   bracket expression, followed by all the non-ASCII bytes if HIGH.
+   IN must not consist of just '^'.  Place ']', '[', '^' and '-' where
+   they cannot be mistaken for anything but themselves.  */
+static void
+out_bracket_members (struct out *o, bool const in[128], bool high)
+{
+  static char const special[] = "][^-";
+  idx_t start = o->len;
+  if (in[']'])
+    out_byte (o, ']');
+  for (int c = 0; c < 128; )
+    {
+      if (!in[c] || strchr (special, c))
+        {
+          c++;
+          continue;
+        }
+      int e = c;
+      while (e + 1 < 128 && in[e + 1] && !strchr (special, e + 1))
+        e++;
+      out_byte (o, c);
+      if (c + 1 < e)
+        out_byte (o, '-');
+      if (c < e)
+        out_byte (o, e);
+      c = e + 1;
+    }
+  if (high)
+    {
+      out_byte (o, 0x80);
+      out_byte (o, '-');
+      out_byte (o, 0xFF);
+    }
+  if (in['['])
+    out_byte (o, '[');
+  bool minus = in['-'];
+  if (in['^'])
+    {
+      /* A leading '^' would negate the expression.  */
+      if (o->len == start && minus)
+        {
+          out_byte (o, '-');
+          minus = false;
+        }
+      out_byte (o, '^');
+    }
+  if (minus)
+    out_byte (o, '-');
+}
+
+/* Output a pattern matching exactly the characters in the normalized
+   set S, which is not empty.  */
+static void
+out_charset (struct out *o, struct charset const *s)
+{
+  bool in[128] = { false };
+  int nascii = 0;
+  struct utf8_seqs seqs = { nullptr, 0, 0 };
+  for (idx_t i = 0; i < s->n; i++)
+    {
+      for (char32_t c = s->r[i][0]; c <= s->r[i][1] && c < 128; c++, nascii++)
+        in[c] = true;
+      if (128 <= s->r[i][1])
+        utf8_split (&seqs, MAX (s->r[i][0], 128), s->r[i][1]);
+    }
+
+  if (seqs.n)
+    out_str (o, o->open);
+  if (nascii == 1 && in['^'])
+    out_str (o, "\\^");
+  else if (nascii)
+    {
+      /* Never write a newline, which would separate patterns.  If the
+         set has one, write the ASCII characters it lacks instead.  */
+      out_byte (o, '[');
+      if (in['\n'])
+        {
+          out_byte (o, '^');
+          for (int c = 0; c < 128; c++)
+            in[c] = !in[c];
+          out_bracket_members (o, in, true);
+        }
+      else
+        out_bracket_members (o, in, false);
+      out_byte (o, ']');
+    }
+  if (seqs.n)
+    {
+      if (nascii)
+        out_str (o, o->alt);
+      out_seqs (o, seqs.seq, seqs.n, 0);
+      out_str (o, o->close);
+    }
+  free (seqs.seq);
+}
+
+/* Decode the UTF-8 character at P, before LIM, into *C.  Return its
+   length, or 0 if P starts an encoding error.  */
+static int
+utf8_decode (char const *p, char const *lim, char32_t *c)
+{
+  unsigned char b = *p;
+  int n = b < 0x80 ? 1 : b < 0xC2 ? 0 : b < 0xE0 ? 2 : b < 0xF0 ? 3
+          : b < 0xF5 ? 4 : 0;
+  if (n == 0 || lim - p < n)
+    return 0;
+  char32_t wc = n == 1 ? b : b & (0x7F >> n);
+  for (int i = 1; i < n; i++)
+    {
+      unsigned char t = p[i];
+      if ((t & 0xC0) != 0x80)
+        return 0;
+      wc = wc << 6 | (t & 0x3F);
+    }
+  static char32_t const least[] = { 0, 0, 0x80, 0x800, 0x10000 };
+  if (wc < least[n] || (0xD800 <= wc && wc <= 0xDFFF) || 0x10FFFF < wc)
+    return 0;
+  *c = wc;
+  return n;
+}
+
+/* Add to S the bracket expression whose contents start at *PP, before
+   LIM, and set *PP to just after it.  Return false if the expression
+   cannot be translated.  */
+static bool
+parse_bracket (struct charset *s, char const **pp, char const *lim,
+               bool icase)
+{
+  char const *p = *pp;
+  bool invert = p < lim && *p == '^';
+  p += invert;
+  bool first = true;
+
+  while (true)
+    {
+      if (p == lim)
+        return false;
+      if (*p == ']' && !first)
+        break;
+      first = false;
+
+      if (*p == '[' && p + 1 < lim && (p[1] == '.' || p[1] == '='))
+        return false;
+      if (*p == '[' && p + 1 < lim && p[1] == ':')
+        {
+          char const *name = p + 2;
+          char const *end = name;
+          while (end + 1 < lim && ! (end[0] == ':' && end[1] == ']'))
+            end++;
+          if (lim <= end + 1 || 16 <= end - name)
+            return false;
+          char buf[16];
+          memcpy (buf, name, end - name);
+          buf[end - name] = '\0';
+          if (icase && (strcmp (buf, "upper") == 0
+                        || strcmp (buf, "lower") == 0))
+            strcpy (buf, "alpha");
+          struct charset const *class = class_set (buf);
+          if (!class)
+            return false;
+          charset_add_all (s, class);
+          p = end + 2;
+          continue;
+        }
+
+      char32_t c;
+      int n = utf8_decode (p, lim, &c);
+      if (!n)
+        return false;
+      p += n;
+
+      if (p + 1 < lim && *p == '-' && p[1] != ']')
+        {
+          /* What other ranges mean depends on LC_COLLATE, so leave
+             them to the multibyte DFA and regex.  */
+          char32_t c2;
+          if (! (c_isdigit (c) && c_isdigit (p[1]) && c <= p[1]))
+            return false;
+          c2 = p[1];
+          charset_add (s, c, c2);
+          p += 2;
+          continue;
+        }
+
+      charset_add_folded (s, c, icase);
+    }
+
+  charset_normalize (s);
+  if (invert)
+    charset_invert (s);
+  *pp = p + 1;
+  return true;
+}
+
+/* Return true if the normalized set S has a non-ASCII character.  */
+static bool
+charset_multibyte (struct charset const *s)
+{
+  return s->n && 128 <= s->r[s->n - 1][1];
+}
+
+/* Return the translation of the SIZE bytes of PATTERN, a list of
+   patterns separated by newlines in the syntax SYNTAX_BITS, to be
+   matched by a DFA that treats bytes as characters, with RE_ICASE
+   still set if it is set in SYNTAX_BITS.  Set *NEWSIZE to the size
+   of the translation.  Return null if the pattern cannot be
+   translated, or if the multibyte DFA should match it just as fast
+   because it has no set of characters other than '.' that can
+   match a non-ASCII character.  */
+char *
+utf8_byte_pattern (char const *pattern, idx_t size, reg_syntax_t syntax_bits,
+                   idx_t *newsize)
+{
+  if (! (syntax_bits & RE_CHAR_CLASSES) || ! (syntax_bits & RE_DOT_NEWLINE)
+      || (syntax_bits & (RE_BACKSLASH_ESCAPE_IN_LISTS | RE_DOT_NOT_NULL
+                         | RE_HAT_LISTS_NOT_NEWLINE | RE_LIMITED_OPS
+                         | RE_NO_GNU_OPS)))
+    return nullptr;
+
+  bool icase = !!(syntax_bits & RE_ICASE);
+  bool needed = false;
+  struct out o = { .open = syntax_bits & RE_NO_BK_PARENS ? "(" : "\\(",
+                   .close = syntax_bits & RE_NO_BK_PARENS ? ")" : "\\)",
+                   .alt = syntax_bits & RE_NO_BK_VBAR ? "|" : "\\|" };
+  struct charset s = { nullptr, 0, 0 };
+  char const *lim = pattern + size;
+
+  for (char const *p = pattern; p < lim; )
+    {
+      s.n = 0;
+      unsigned char c = *p;
+      if (c == '\n')
+        {
+          out_byte (&o, c);
+          p++;
+          continue;
+        }
+      if (c == '\\' && p + 1 < lim && to_uchar (p[1]) < 0x80)
+        {
+          switch (p[1])
+            {
+            case '1': case '2': case '3': case '4': case '5':
+            case '6': case '7': case '8': case '9':
+            case 'b': case 'B': case '<': case '>':
+              goto fail;
+
+            case 'w': case 'W':
+              charset_add_all (&s, class_set ("alnum"));
+              charset_add (&s, '_', '_');
+              break;
+
+            case 's': case 'S':
+              charset_add_all (&s, class_set ("space"));
+              break;
+
+            default:
+              out_mem (&o, p, 2);
+              p += 2;
+              continue;
+            }
+          charset_normalize (&s);
+          if (c_isupper (p[1]))
+            charset_invert (&s);
+          needed = true;
+          p += 2;
+        }
+      else if (c == '[')
+        {
+          p++;
+          if (!parse_bracket (&s, &p, lim, icase))
+            goto fail;
+          needed |= charset_multibyte (&s);
+        }
+      else if (c == '.')
+        {
+          charset_add (&s, 0, 0xD7FF);
+          charset_add (&s, 0xE000, 0x10FFFF);
+          p++;
+        }
+      else
+        {
+          /* A literal character, perhaps after a stray backslash.  */
+          if (c == '\\' && p + 1 < lim)
+            p++;
+          char32_t wc;
+          int n = utf8_decode (p, lim, &wc);
+          if (!n)
+            goto fail;
+          charset_add_folded (&s, wc, icase);
+          charset_normalize (&s);
+          if (!charset_multibyte (&s))
+            {
+              out_mem (&o, p, n);
+              p += n;
+              continue;
+            }
+          p += n;
+        }
+      out_charset (&o, &s);
+    }
+
+  free (s.r);
+  if (!needed)
+    {
+      free (o.buf);
+      return nullptr;
+    }
+  *newsize = o.len;
+  return o.buf;
+
+ fail:
+  free (s.r);
+  free (o.buf);
+  return nullptr;
+}
+
+/* Return the locale information for a DFA that matches bytes of
+   UTF-8 text as characters.  Each byte stands for itself, so that the
+   DFA never decodes a multibyte character, and ranges are of bytes.  */
+struct localeinfo const *
+utf8_byte_localeinfo (void)
+{
+  static struct localeinfo info;
+  if (!info.simple)
+    {
+      for (int i = 0; i < NCHAR; i++)
+        {
+          info.sbclen[i] = 1;
+          info.sbctowc[i] = i;
+        }
+      info.simple = true;
+    }
+  return &info;
+}
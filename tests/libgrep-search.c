@@ -0,0 +1,168 @@
+/* Auxiliary program to search a file with libgrep.a from several threads.
+   Copyright 2026 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* Usage: libgrep-search -OPTIONS PATTERNS FILE THREADS
+
+   OPTIONS are letters among E, F, G, P, i, w, x and z, meaning what
+   they mean to grep.  Each of the THREADS threads compiles PATTERNS
+   and searches its own copy of FILE.  Output the lines selected, and
+   exit with status 0 if there are any and 1 otherwise, like grep.
+   Exit with status 2 if an error occurs or the threads disagree.  */
+
+#include <config.h>
+#include <locale.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgrep.h"
+
+static struct grep_options options;
+static char const *patterns;
+static char *data;
+static size_t datasize;
+
+struct search
+{
+  pthread_t thread;
+
+  /* The offsets in DATA of the lines selected, and their number.  */
+  size_t *lines;
+  size_t nlines;
+};
+
+static void
+fail (char const *message)
+{
+  fprintf (stderr, "libgrep-search: %s\n", message);
+  exit (2);
+}
+
+static void *
+xrealloc_or_fail (void *p, size_t size)
+{
+  p = realloc (p, size);
+  if (!p)
+    fail ("memory exhausted");
+  return p;
+}
+
+static void *
+search (void *arg)
+{
+  struct search *s = arg;
+  char *error;
+  struct grep_pattern *pat = grep_compile (patterns, strlen (patterns),
+                                           &options, &error);
+  if (!pat)
+    fail (error);
+
+  /* Precede the data with a line terminator, and leave room for the
+     one the search may store after it.  */
+  char *buf = xrealloc_or_fail (nullptr, datasize + 2);
+  buf[0] = options.null_data ? '\0' : '\n';
+  char *beg = memcpy (buf + 1, data, datasize);
+  char *lim = beg + datasize;
+
+  for (char *p = beg; p < lim; )
+    {
+      size_t len;
+      ptrdiff_t offset = grep_execute (pat, p, lim - p, &len);
+      if (offset == -2)
+        fail (grep_error (pat));
+      if (offset < 0)
+        break;
+      s->lines = xrealloc_or_fail (s->lines,
+                                   (s->nlines + 1) * sizeof *s->lines);
+      s->lines[s->nlines++] = p + offset - beg;
+      p += offset + len;
+    }
+
+  free (buf);
+  grep_free (pat);
+  return nullptr;
+}
+
+int
+main (int argc, char **argv)
+{
+  if (argc != 5 || argv[1][0] != '-')
+    fail ("usage: libgrep-search -OPTIONS PATTERNS FILE THREADS");
+  for (char const *o = argv[1] + 1; *o; o++)
+    switch (*o)
+      {
+      case 'E': options.syntax = GREP_SYNTAX_EXTENDED; break;
+      case 'F': options.syntax = GREP_SYNTAX_FIXED; break;
+      case 'G': options.syntax = GREP_SYNTAX_BASIC; break;
+      case 'P': options.syntax = GREP_SYNTAX_PERL; break;
+      case 'i': options.ignore_case = true; break;
+      case 'w': options.match_words = true; break;
+      case 'x': options.match_lines = true; break;
+      case 'z': options.null_data = true; break;
+      default: fail ("invalid option");
+      }
+  patterns = argv[2];
+  int nthreads = atoi (argv[4]);
+  if (nthreads <= 0)
+    fail ("invalid number of threads");
+
+  setlocale (LC_ALL, "");
+
+  FILE *f = fopen (argv[3], "rb");
+  if (!f)
+    fail (argv[3]);
+  size_t alloc = 0;
+  for (size_t n; ; datasize += n)
+    {
+      if (alloc - datasize < BUFSIZ + 1)
+        data = xrealloc_or_fail (data, alloc = 2 * alloc + BUFSIZ + 1);
+      n = fread (data + datasize, 1, alloc - datasize - 1, f);
+      if (n == 0)
+        break;
+    }
+  if (ferror (f) || fclose (f) != 0)
+    fail (argv[3]);
+  char eol = options.null_data ? '\0' : '\n';
+  if (datasize && data[datasize - 1] != eol)
+    data[datasize++] = eol;
+
+  struct search *s = calloc (nthreads, sizeof *s);
+  if (!s)
+    fail ("memory exhausted");
+  for (int i = 0; i < nthreads; i++)
+    if (pthread_create (&s[i].thread, nullptr, search, &s[i]) != 0)
+      fail ("cannot create thread");
+  for (int i = 0; i < nthreads; i++)
+    pthread_join (s[i].thread, nullptr);
+
+  for (int i = 1; i < nthreads; i++)
+    if (s[i].nlines != s[0].nlines
+        || (s[0].nlines
+            && memcmp (s[i].lines, s[0].lines,
+                       s[0].nlines * sizeof *s[0].lines) != 0))
+      fail ("threads disagree");
+
+  for (size_t i = 0; i < s[0].nlines; i++)
+    {
+      char const *line = data + s[0].lines[i];
+      char const *end = memchr (line, eol, data + datasize - line);
+      fwrite (line, 1, end + 1 - line, stdout);
+    }
+  if (fflush (stdout) != 0)
+    fail ("write error");
+  return s[0].nlines ? EXIT_SUCCESS : EXIT_FAILURE;
+}